@@ -0,0 +1,118 @@
+// Compares chunk I/O through a persistent FileHandle (pread/pwrite) against
+// opening an fstream for every chunk, for chunk sizes from 1 KB to 10 MB.
+//
+// Usage: file_io_benchmark [file size in MB] [scratch directory]
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FileSystemManager.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+// Per-chunk fstream path, as FileSystemManager did before handles were kept
+std::vector<uint8_t> fstreamReadChunk(const fs::path& file_path,
+                                      uint64_t offset, size_t size)
+{
+    std::ifstream file(file_path, std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(offset));
+    std::vector<uint8_t> buffer(size);
+    file.read(reinterpret_cast<char*>(buffer.data()), size);
+    buffer.resize(file.gcount());
+    return buffer;
+}
+
+void fstreamWriteChunk(const fs::path& file_path, uint64_t offset,
+                       const std::vector<uint8_t>& data)
+{
+    std::fstream file(file_path,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+double measureMBps(uint64_t file_size, const std::function<void()>& run)
+{
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<double>(file_size) / (1024 * 1024) / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    uint64_t file_size_mb = argc > 1 ? std::stoull(argv[1]) : 64;
+    fs::path scratch_dir =
+        argc > 2 ? fs::path(argv[2]) : fs::temp_directory_path();
+    uint64_t file_size = file_size_mb * 1024 * 1024;
+
+    fs::path          file_path = scratch_dir / "quickshare_file_io_bench.bin";
+    FileSystemManager fs_manager;
+    fs_manager.createFile(file_path, file_size);
+
+    std::vector<size_t> chunk_sizes;
+    for (size_t size = 1024; size < 10485760; size *= 2)
+    {
+        chunk_sizes.push_back(size);
+    }
+    chunk_sizes.push_back(10485760);
+
+    std::printf("file size: %llu MB\n",
+                static_cast<unsigned long long>(file_size_mb));
+    std::printf("%10s %16s %16s %16s %16s\n", "chunk", "fstream read",
+                "pread", "fstream write", "pwrite");
+
+    for (size_t chunk_size : chunk_sizes)
+    {
+        std::vector<uint8_t> data(chunk_size, 0x5a);
+
+        double fstream_read = measureMBps(file_size, [&] {
+            for (uint64_t offset = 0; offset < file_size; offset += chunk_size)
+            {
+                fstreamReadChunk(file_path, offset, chunk_size);
+            }
+        });
+
+        double handle_read = measureMBps(file_size, [&] {
+            auto file = fs_manager.openFile(file_path, FileHandle::Mode::Read);
+            for (uint64_t offset = 0; offset < file_size; offset += chunk_size)
+            {
+                fs_manager.readChunk(*file, offset, chunk_size);
+            }
+        });
+
+        double fstream_write = measureMBps(file_size, [&] {
+            for (uint64_t offset = 0; offset < file_size; offset += chunk_size)
+            {
+                fstreamWriteChunk(file_path, offset, data);
+            }
+        });
+
+        double handle_write = measureMBps(file_size, [&] {
+            auto file =
+                fs_manager.openFile(file_path, FileHandle::Mode::ReadWrite);
+            for (uint64_t offset = 0; offset < file_size; offset += chunk_size)
+            {
+                fs_manager.writeChunk(*file, offset, data);
+            }
+        });
+
+        std::printf("%8zuKB %13.1fMB/s %13.1fMB/s %13.1fMB/s %13.1fMB/s\n",
+                    chunk_size / 1024, fstream_read, handle_read, fstream_write,
+                    handle_write);
+    }
+
+    fs_manager.deleteFile(file_path);
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Reports digest throughput for every HashAlgorithm: single-threaded over
+// an in-memory buffer, and through FileSystemManager::calculateFileHash,
+// which splits large files across all cores for splittable algorithms.
+//
+// Usage: hash_benchmark [data size in MB] [scratch directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Digest.hpp"
+#include "FileSystemManager.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+double measureGBps(uint64_t size, const std::function<void()>& run)
+{
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<double>(size) / (1024.0 * 1024 * 1024) /
+           elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    uint64_t data_size_mb = argc > 1 ? std::stoull(argv[1]) : 256;
+    fs::path scratch_dir =
+        argc > 2 ? fs::path(argv[2]) : fs::temp_directory_path();
+    size_t data_size = static_cast<size_t>(data_size_mb * 1024 * 1024);
+
+    std::vector<uint8_t> data(data_size);
+    std::mt19937_64      random(42);
+    for (size_t i = 0; i + 8 <= data.size(); i += 8)
+    {
+        uint64_t value = random();
+        std::memcpy(data.data() + i, &value, sizeof(value));
+    }
+
+    fs::path file_path = scratch_dir / "quickshare_hash_bench.bin";
+    {
+        std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    FileSystemManager fs_manager;
+
+    std::printf("data size: %llu MB, hardware CRC32C: %s\n",
+                static_cast<unsigned long long>(data_size_mb),
+                Digest::hasHardwareCrc32c() ? "yes" : "no");
+    std::printf("%12s %14s %14s %8s\n", "algorithm", "memory", "file",
+                "match");
+
+    for (HashAlgorithm algorithm :
+         {HashAlgorithm::CRC32, HashAlgorithm::CRC32C, HashAlgorithm::XXH64,
+          HashAlgorithm::XXH64_TREE})
+    {
+        std::string memory_digest;
+        double      memory_speed = measureGBps(data_size, [&] {
+            std::unique_ptr<Digest> digest = Digest::create(algorithm);
+            digest->update(data.data(), data.size());
+            memory_digest = digest->digest();
+        });
+
+        std::string file_digest;
+        double      file_speed = measureGBps(data_size, [&] {
+            file_digest = fs_manager.calculateFileHash(file_path, algorithm);
+        });
+
+        std::printf("%12s %11.2fGB/s %11.2fGB/s %8s\n", Digest::name(algorithm),
+                    memory_speed, file_speed,
+                    memory_digest == file_digest ? "yes" : "NO");
+    }
+
+    fs_manager.deleteFile(file_path);
+    return 0;
+}
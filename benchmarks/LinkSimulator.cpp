@@ -0,0 +1,372 @@
+// Replays a transfer over modelled links for every chunk control policy and
+// reports how long each takes to converge, the throughput it settles at and
+// the bytes it fell short of the link by. Each policy runs again
+// warm-started from the estimate of its first run, as a second transfer to
+// a peer would. Time is simulated and the only randomness is a seeded
+// generator, so the same arguments always print the same numbers and no
+// network is touched.
+//
+// Usage: link_simulator [seconds per run] [seed]
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ChunkController.hpp"
+
+namespace
+{
+
+using Clock = ChunkController::Clock;
+
+// FileTransfer's chunk limits and NetworkSettings' default window
+constexpr size_t MIN_CHUNK_SIZE = 1024;
+constexpr size_t MAX_CHUNK_SIZE = 10485760;
+constexpr size_t MAX_IN_FLIGHT_BYTES = 33554432;
+constexpr size_t MAX_IN_FLIGHT_CHUNKS = 32;
+
+// A lost segment is resent after about one RTT and holds up everything
+// behind it, as TCP would
+constexpr size_t SEGMENT_SIZE = 1448;
+// Receiver work per chunk besides the disk write: checksum, framing and
+// the hop to the disk executor
+constexpr double CHUNK_OVERHEAD = 50e-6;
+
+constexpr double SAMPLE_INTERVAL = 0.1;
+constexpr size_t SMOOTHING_SAMPLES = 20;
+constexpr double CONVERGED_TOLERANCE = 0.1;
+
+struct Link
+{
+    const char* name;
+    double      bandwidth; // bytes per second
+    double      rtt;       // seconds
+    double      jitter;    // seconds, added uniformly to each one-way delay
+    double      loss;      // per segment
+    double      disk_speed;
+    // Bandwidth from halfway through the run, 0 keeps it
+    double      changed_bandwidth;
+};
+
+constexpr double MBIT = 1e6 / 8;
+constexpr double MB = 1024.0 * 1024.0;
+
+const Link LINKS[] = {
+    {"lan", 1000 * MBIT, 0.0005, 0.0001, 0.0, 400 * MB, 0},
+    {"wifi", 200 * MBIT, 0.005, 0.003, 0.001, 400 * MB, 0},
+    {"wan", 50 * MBIT, 0.08, 0.005, 0.005, 400 * MB, 0},
+    {"satellite", 20 * MBIT, 0.6, 0.01, 0.01, 400 * MB, 0},
+    {"slow-disk", 1000 * MBIT, 0.001, 0.0002, 0.0, 40 * MB, 0},
+    {"bandwidth-drop", 1000 * MBIT, 0.01, 0.001, 0.0, 400 * MB, 100 * MBIT},
+};
+
+struct Policy
+{
+    const char*        name;
+    ChunkControlPolicy policy;
+};
+
+const Policy POLICIES[] = {
+    {"bbr", ChunkControlPolicy::BBR},
+    {"aimd", ChunkControlPolicy::AIMD},
+    {"epsilon", ChunkControlPolicy::EPSILON_GREEDY},
+};
+
+struct Result
+{
+    double convergence_time; // negative when never converged
+    double steady_throughput;
+    double ideal_throughput;
+    double regret; // fraction of the ideal bytes not delivered
+    double chunk_size;
+
+    std::optional<LinkEstimate> estimate;
+};
+
+// Portable across standard libraries, unlike the std distributions
+double uniform(std::mt19937_64& rng)
+{
+    return static_cast<double>(rng() >> 11) * 0x1.0p-53;
+}
+
+Clock::time_point at(double seconds)
+{
+    // Away from the epoch, which controllers may treat as never
+    return Clock::time_point(std::chrono::hours(1)) +
+           std::chrono::duration_cast<Clock::duration>(
+               std::chrono::duration<double>(seconds));
+}
+
+double bandwidthAt(const Link& link, double time, double duration)
+{
+    return link.changed_bandwidth > 0 && time >= duration / 2
+               ? link.changed_bandwidth
+               : link.bandwidth;
+}
+
+double idealThroughput(const Link& link, double time, double duration)
+{
+    return std::min(bandwidthAt(link, time, duration) * (1.0 - link.loss),
+                    link.disk_speed);
+}
+
+Result simulate(const Link& link, ChunkControlPolicy policy, double duration,
+                uint32_t seed, const std::optional<LinkEstimate>& warm_start)
+{
+    struct InFlight
+    {
+        size_t offset;
+        size_t size;
+        double sent_time;
+        double ack_time;
+    };
+
+    std::mt19937_64 rng(seed);
+    auto controller =
+        ChunkController::create(policy, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    controller->seed(seed);
+    if (warm_start)
+    {
+        controller->warmStart(*warm_start, at(0.0));
+    }
+
+    std::deque<InFlight> in_flight;
+    size_t               bytes_in_flight = 0;
+    size_t               next_offset = 0;
+    double               link_free = 0.0;
+    double               last_arrival = 0.0;
+    double               disk_free = 0.0;
+    double               last_ack = 0.0;
+
+    std::vector<double> samples(static_cast<size_t>(
+        std::ceil(duration / SAMPLE_INTERVAL)));
+    std::vector<double> chunk_sizes(samples.size());
+    std::vector<size_t> chunk_counts(samples.size());
+
+    // The path is FIFO end to end, so a chunk's ack time is known when it
+    // is sent and acks come back in send order
+    auto send = [&](double now) {
+        size_t size = controller->nextChunkSize();
+        controller->onChunkSent(next_offset, size, at(now));
+
+        double start = std::max(now, link_free);
+        double wire_bytes = static_cast<double>(size);
+        double delay = 0.0;
+        if (link.loss > 0.0)
+        {
+            size_t segments = (size + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+            size_t lost = 0;
+            for (size_t i = 0; i < segments; ++i)
+            {
+                lost += uniform(rng) < link.loss;
+            }
+            wire_bytes += static_cast<double>(lost * SEGMENT_SIZE);
+            delay = lost > 0 ? link.rtt : 0.0;
+        }
+        link_free = start + wire_bytes / bandwidthAt(link, start, duration);
+
+        double arrival = link_free + link.rtt / 2 + delay +
+                         uniform(rng) * link.jitter;
+        last_arrival = std::max(arrival, last_arrival);
+        disk_free = std::max(last_arrival, disk_free) + CHUNK_OVERHEAD +
+                    size / link.disk_speed;
+        double ack = disk_free + link.rtt / 2 + uniform(rng) * link.jitter;
+        last_ack = std::max(ack, last_ack);
+
+        in_flight.push_back({next_offset, size, now, last_ack});
+        bytes_in_flight += size;
+        next_offset += size;
+    };
+
+    auto windowOpen = [&] {
+        if (in_flight.empty())
+        {
+            return true;
+        }
+        if (in_flight.size() >= MAX_IN_FLIGHT_CHUNKS)
+        {
+            return false;
+        }
+        size_t window = controller->windowBytes();
+        window = window == 0 ? MAX_IN_FLIGHT_BYTES
+                             : std::min(window, MAX_IN_FLIGHT_BYTES);
+        return bytes_in_flight < window;
+    };
+
+    double now = 0.0;
+    double previous_ack = 0.0;
+    while (now < duration)
+    {
+        while (windowOpen())
+        {
+            send(now);
+        }
+
+        InFlight chunk = in_flight.front();
+        in_flight.pop_front();
+        bytes_in_flight -= chunk.size;
+        now = chunk.ack_time;
+        if (now >= duration)
+        {
+            break;
+        }
+
+        auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::duration<double>(now - chunk.sent_time));
+        controller->onChunkAcked(chunk.offset, chunk.size, rtt, at(now));
+
+        // Spread over the time since the previous ack, or a run of large
+        // chunks reads as bursts and gaps. Acks released together by a
+        // stalled chunk have no time to spread over
+        size_t sample = static_cast<size_t>(now / SAMPLE_INTERVAL);
+        chunk_sizes[sample] += chunk.size;
+        ++chunk_counts[sample];
+        if (now <= previous_ack)
+        {
+            samples[sample] += chunk.size / SAMPLE_INTERVAL;
+            continue;
+        }
+        double rate = chunk.size / (now - previous_ack);
+        for (size_t i = static_cast<size_t>(previous_ack / SAMPLE_INTERVAL);
+             i <= sample; ++i)
+        {
+            double begin = std::max(previous_ack, i * SAMPLE_INTERVAL);
+            double end = std::min(now, (i + 1) * SAMPLE_INTERVAL);
+            samples[i] += rate * std::max(end - begin, 0.0) / SAMPLE_INTERVAL;
+        }
+        previous_ack = now;
+    }
+
+    Result result{};
+    result.estimate = controller->linkEstimate();
+    size_t steady_start = samples.size() * 2 / 3;
+    double steady_bytes = 0.0;
+    size_t steady_chunks = 0;
+    double delivered = 0.0;
+    double ideal = 0.0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        double time = (i + 0.5) * SAMPLE_INTERVAL;
+        delivered += samples[i] * SAMPLE_INTERVAL;
+        ideal += idealThroughput(link, time, duration) * SAMPLE_INTERVAL;
+        if (i >= steady_start)
+        {
+            result.steady_throughput += samples[i];
+            steady_bytes += chunk_sizes[i];
+            steady_chunks += chunk_counts[i];
+        }
+    }
+    result.steady_throughput /= samples.size() - steady_start;
+    result.ideal_throughput = idealThroughput(link, duration, duration);
+    result.regret = ideal > 0.0 ? 1.0 - delivered / ideal : 0.0;
+    result.chunk_size = steady_chunks > 0 ? steady_bytes / steady_chunks : 0;
+
+    // Converged from the first moving average after which every one stays
+    // within the tolerance of the steady throughput
+    result.convergence_time = -1.0;
+    double window_sum = 0.0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        window_sum += samples[i];
+        if (i >= SMOOTHING_SAMPLES)
+        {
+            window_sum -= samples[i - SMOOTHING_SAMPLES];
+        }
+        double average =
+            window_sum / std::min(i + 1, SMOOTHING_SAMPLES);
+        bool within = std::abs(average - result.steady_throughput) <=
+                      CONVERGED_TOLERANCE * result.steady_throughput;
+        if (!within)
+        {
+            result.convergence_time = -1.0;
+        } else if (result.convergence_time < 0.0) {
+            result.convergence_time = (i + 1) * SAMPLE_INTERVAL;
+        }
+    }
+    return result;
+}
+
+void printResult(const char* name, const Result& result)
+{
+    char converged[16] = "never";
+    if (result.convergence_time >= 0.0)
+    {
+        std::snprintf(converged, sizeof(converged), "%.1fs",
+                      result.convergence_time);
+    }
+    std::printf("%12s %10s %10.1fMB/s %10.1fMB/s %7.1f%% %8.0fKB\n", name,
+                converged, result.steady_throughput / MB,
+                result.ideal_throughput / MB, result.regret * 100,
+                result.chunk_size / 1024);
+}
+
+// The whole argument as a number, nothing when any of it is not
+template <typename T>
+std::optional<T> parseArgument(const char* text)
+{
+    T           value{};
+    const char* end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, value);
+    if (ec != std::errc() || ptr != end || ptr == text)
+    {
+        return std::nullopt;
+    }
+    return value;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::optional<double>   duration = 60.0;
+    std::optional<uint32_t> seed = 1u;
+    if (argc > 1)
+    {
+        duration = parseArgument<double>(argv[1]);
+    }
+    if (argc > 2)
+    {
+        seed = parseArgument<uint32_t>(argv[2]);
+    }
+    if (argc > 3 || !duration || !seed || !(*duration > 0.0))
+    {
+        std::fprintf(stderr,
+                     "Usage: link_simulator [seconds per run] [seed]\n");
+        return 1;
+    }
+
+    std::printf("%.0fs per run, seed %u\n", *duration, *seed);
+    for (const Link& link : LINKS)
+    {
+        std::printf("\n%s: %.0f Mbit/s", link.name, link.bandwidth / MBIT);
+        if (link.changed_bandwidth > 0)
+        {
+            std::printf(" then %.0f Mbit/s", link.changed_bandwidth / MBIT);
+        }
+        std::printf(", RTT %.1f ms, jitter %.1f ms, loss %.2f%%, "
+                    "disk %.0f MB/s\n",
+                    link.rtt * 1e3, link.jitter * 1e3, link.loss * 100,
+                    link.disk_speed / MB);
+        std::printf("%12s %10s %14s %14s %8s %10s\n", "policy", "converged",
+                    "steady", "ideal", "regret", "chunk");
+
+        for (const Policy& policy : POLICIES)
+        {
+            Result cold =
+                simulate(link, policy.policy, *duration, *seed, std::nullopt);
+            Result warm = simulate(link, policy.policy, *duration, *seed + 1,
+                                   cold.estimate);
+            printResult(policy.name, cold);
+            printResult((std::string(policy.name) + " warm").c_str(), warm);
+        }
+    }
+    return 0;
+}
@@ -51,6 +51,8 @@ void Logger::log(LogLevel level, const QString& message)
         return;
     }
 
+    QMutexLocker locker(&m_mutex);
+
     QString timestamp =
         QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss.zzz");
     QString logMessage = QString("[%1] [%2] %3")
@@ -5,6 +5,7 @@
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QMutex>
 #include <QObject>
 #include <QString>
 #include <QTextStream>
@@ -34,6 +35,7 @@ class Logger : public QObject
     QTextStream m_logStream;
     bool        m_consoleOutput;
     LogLevel    m_logLevel;
+    QMutex      m_mutex; // log() is called from network and disk threads
 };
 
 #define LOG_TRACE(msg)   Logger::instance().log(Logger::LogLevel::Trace, msg)
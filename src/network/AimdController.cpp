@@ -0,0 +1,133 @@
+#include "AimdController.hpp"
+
+#include <algorithm>
+
+AimdController::AimdController(size_t min_chunk_size, size_t max_chunk_size) :
+    min_chunk_size_(min_chunk_size), max_chunk_size_(max_chunk_size),
+    chunk_size_(0.0), window_(static_cast<double>(INITIAL_WINDOW)),
+    slow_start_(true), min_rtt_(0), smoothed_rtt_(0.0), round_min_rtt_(0)
+{
+    chunk_size_ = std::clamp(window_ / CHUNKS_PER_WINDOW,
+                             static_cast<double>(min_chunk_size_),
+                             static_cast<double>(max_chunk_size_));
+}
+
+void AimdController::onChunkAcked(size_t /*offset*/, size_t size,
+                                  std::chrono::microseconds rtt,
+                                  Clock::time_point         now)
+{
+    if (rtt.count() <= 0)
+    {
+        return;
+    }
+    if (min_rtt_.count() == 0 || rtt <= min_rtt_ ||
+        now - min_rtt_time_ > MIN_RTT_WINDOW)
+    {
+        min_rtt_ = rtt;
+        min_rtt_time_ = now;
+    }
+    smoothed_rtt_ = smoothed_rtt_ == 0.0
+                        ? rtt.count()
+                        : 0.875 * smoothed_rtt_ + 0.125 * rtt.count();
+
+    // A queue delays every chunk of a round trip, a lost segment only the
+    // chunks behind it, so only the fastest chunk of the round counts
+    if (round_min_rtt_.count() == 0 || rtt < round_min_rtt_)
+    {
+        round_min_rtt_ = rtt;
+    }
+    std::chrono::microseconds round(static_cast<int64_t>(smoothed_rtt_));
+    bool congested = false;
+    if (now - round_start_ >= round)
+    {
+        congested =
+            round_min_rtt_.count() > min_rtt_.count() * QUEUE_DELAY_FACTOR &&
+            round_min_rtt_ - min_rtt_ > MIN_QUEUE_DELAY;
+        round_start_ = now;
+        round_min_rtt_ = std::chrono::microseconds(0);
+    }
+
+    if (congested)
+    {
+        window_ *= DECREASE_FACTOR;
+        slow_start_ = false;
+    } else if (slow_start_)
+    {
+        window_ += size;
+    } else {
+        window_ += static_cast<double>(currentChunkSize()) * size / window_;
+    }
+
+    double lower = static_cast<double>(std::clamp(
+        MIN_CONTROLLED_CHUNK_SIZE, min_chunk_size_, max_chunk_size_));
+    window_ = std::clamp(window_, lower * MIN_WINDOW_CHUNKS,
+                         static_cast<double>(MAX_WINDOW));
+    double target = std::clamp(window_ / CHUNKS_PER_WINDOW, lower,
+                               static_cast<double>(max_chunk_size_));
+    chunk_size_ += (target - chunk_size_) / 4;
+}
+
+size_t AimdController::nextChunkSize()
+{
+    return currentChunkSize();
+}
+
+size_t AimdController::currentChunkSize() const
+{
+    size_t size = static_cast<size_t>(chunk_size_) / 4096 * 4096;
+    return std::clamp(size, min_chunk_size_, max_chunk_size_);
+}
+
+size_t AimdController::windowBytes() const
+{
+    return std::max(static_cast<size_t>(window_),
+                    MIN_WINDOW_CHUNKS * currentChunkSize());
+}
+
+std::optional<LinkEstimate> AimdController::linkEstimate() const
+{
+    if (smoothed_rtt_ == 0.0)
+    {
+        return std::nullopt;
+    }
+    return LinkEstimate{window_ / smoothed_rtt_ * 1e6, min_rtt_,
+                        currentChunkSize(), windowBytes()};
+}
+
+void AimdController::warmStart(const LinkEstimate& estimate,
+                               Clock::time_point /*now*/)
+{
+    double window = static_cast<double>(estimate.window);
+    if (window == 0.0)
+    {
+        window = estimate.bandwidth *
+                 std::chrono::duration<double>(estimate.min_rtt).count();
+    }
+    if (window <= 0.0)
+    {
+        return;
+    }
+
+    // A window that ended with a queue standing is cut to a multiple of
+    // the BDP it implies, and chunks to their share of what is left
+    double bdp = estimate.bandwidth *
+                 std::chrono::duration<double>(estimate.min_rtt).count();
+    if (bdp > 0.0)
+    {
+        window = std::min(window, WARM_WINDOW_GAIN * bdp);
+    }
+
+    double lower = static_cast<double>(std::clamp(
+        MIN_CONTROLLED_CHUNK_SIZE, min_chunk_size_, max_chunk_size_));
+    window_ = std::clamp(window, lower * MIN_WINDOW_CHUNKS,
+                         static_cast<double>(MAX_WINDOW));
+    slow_start_ = false;
+    double upper = std::clamp(window_ / CHUNKS_PER_WINDOW, lower,
+                              static_cast<double>(max_chunk_size_));
+    chunk_size_ = upper;
+    if (estimate.chunk_size > 0)
+    {
+        chunk_size_ = std::clamp(static_cast<double>(estimate.chunk_size),
+                                 static_cast<double>(min_chunk_size_), upper);
+    }
+}
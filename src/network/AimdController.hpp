@@ -0,0 +1,63 @@
+#ifndef AIMD_CONTROLLER_HPP
+#define AIMD_CONTROLLER_HPP
+
+#include "ChunkController.hpp"
+
+// Additive increase, multiplicative decrease on queueing delay: TCP below
+// hides losses, but a queue building anywhere on the path shows as RTT
+// above the lowest one seen. Each round trip is judged by its fastest
+// chunk, as a lost segment delays the chunks behind it by a whole round
+// trip without any queue. The window doubles each round trip until the
+// first such sign, then grows by a chunk per round trip and shrinks by 30%
+// after each congested one. Chunks follow the window like in BbrController
+class AimdController : public ChunkController
+{
+  public:
+    static constexpr size_t INITIAL_WINDOW = 2097152; // 2MB
+    static constexpr size_t MAX_WINDOW = 268435456;   // 256MB
+    static constexpr size_t MIN_CONTROLLED_CHUNK_SIZE = 65536; // 64KB
+    static constexpr size_t CHUNKS_PER_WINDOW = 8;
+    static constexpr size_t MIN_WINDOW_CHUNKS = 4;
+    // A round trip whose fastest chunk took over this multiple of the
+    // lowest RTT, and by at least the delay below, counts as congestion
+    static constexpr double                    QUEUE_DELAY_FACTOR = 1.5;
+    static constexpr std::chrono::microseconds MIN_QUEUE_DELAY{2000};
+    static constexpr double                    DECREASE_FACTOR = 0.7;
+    // Most BDPs a warm start opens the window to, above the BDP as the
+    // sawtooth peaks are
+    static constexpr double WARM_WINDOW_GAIN = 3.0;
+
+    AimdController(size_t min_chunk_size, size_t max_chunk_size);
+
+    void onChunkAcked(size_t offset, size_t size,
+                      std::chrono::microseconds rtt,
+                      Clock::time_point         now) override;
+
+    size_t nextChunkSize() override;
+    size_t currentChunkSize() const override;
+    size_t windowBytes() const override;
+
+    std::optional<LinkEstimate> linkEstimate() const override;
+    // Opens at the estimated window past slow start. The lowest RTT is
+    // measured again, a stale one would read as congestion
+    void warmStart(const LinkEstimate& estimate,
+                   Clock::time_point   now) override;
+
+  private:
+    static constexpr std::chrono::seconds MIN_RTT_WINDOW{10};
+
+    size_t min_chunk_size_;
+    size_t max_chunk_size_;
+    double chunk_size_;
+    double window_;
+    bool   slow_start_;
+
+    std::chrono::microseconds min_rtt_;
+    Clock::time_point         min_rtt_time_;
+    double                    smoothed_rtt_; // microseconds
+    // Round trip being measured and its fastest chunk so far
+    Clock::time_point         round_start_;
+    std::chrono::microseconds round_min_rtt_;
+};
+
+#endif // AIMD_CONTROLLER_HPP
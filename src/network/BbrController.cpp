@@ -0,0 +1,320 @@
+#include "BbrController.hpp"
+
+#include <algorithm>
+
+BbrController::BbrController(size_t min_chunk_size, size_t max_chunk_size) :
+    min_chunk_size_(min_chunk_size), max_chunk_size_(max_chunk_size),
+    chunk_size_(static_cast<double>(
+        std::clamp(INITIAL_CHUNK_SIZE, min_chunk_size, max_chunk_size))),
+    bytes_in_flight_(0), delivered_(0), delivered_time_(Clock::now()),
+    round_count_(0), next_round_delivered_(0), round_start_(false),
+    btl_bw_(0.0), ack_epoch_acked_(0.0), extra_acked_(0.0), min_rtt_(0),
+    mode_(Mode::STARTUP), full_bw_(0.0),
+    full_bw_rounds_(0), cycle_index_(0),
+    probe_rtt_return_mode_(Mode::PROBE_BW), probe_rtt_delivered_(0),
+    probe_rtt_min_(0)
+{}
+
+void BbrController::onChunkSent(size_t offset, size_t size,
+                                Clock::time_point now)
+{
+    // Time spent idle is not part of any delivery rate
+    if (bytes_in_flight_ == 0)
+    {
+        delivered_time_ = now;
+    }
+
+    SentChunk& chunk = sent_chunks_[offset];
+    bytes_in_flight_ += size - chunk.size;
+    chunk = {size, delivered_, delivered_time_};
+}
+
+void BbrController::onChunkAcked(size_t offset, size_t /*size*/,
+                                 std::chrono::microseconds rtt,
+                                 Clock::time_point         now)
+{
+    auto it = sent_chunks_.find(offset);
+    if (it == sent_chunks_.end())
+    {
+        return;
+    }
+    SentChunk sent = it->second;
+    sent_chunks_.erase(it);
+    bytes_in_flight_ -= sent.size;
+    delivered_ += sent.size;
+    delivered_time_ = now;
+
+    round_start_ = sent.delivered >= next_round_delivered_;
+    if (round_start_)
+    {
+        next_round_delivered_ = delivered_;
+        ++round_count_;
+    }
+
+    std::chrono::duration<double> interval = now - sent.delivered_time;
+    if (interval.count() > 0.0)
+    {
+        updateBandwidth((delivered_ - sent.delivered) / interval.count());
+    }
+
+    updateExtraAcked(sent.size, now);
+    if (rtt.count() > 0)
+    {
+        updateMinRtt(rtt, sent, now);
+    }
+
+    updateMode(now);
+
+    // A window of CHUNKS_PER_WINDOW chunks at the steady-state gain
+    if (bdp() > 0.0)
+    {
+        double lower = static_cast<double>(std::clamp(
+            MIN_CONTROLLED_CHUNK_SIZE, min_chunk_size_, max_chunk_size_));
+        double target = std::clamp(WINDOW_GAIN * bdp() / CHUNKS_PER_WINDOW,
+                                   lower,
+                                   static_cast<double>(max_chunk_size_));
+        chunk_size_ += (target - chunk_size_) / 4;
+    }
+}
+
+size_t BbrController::nextChunkSize()
+{
+    return currentChunkSize();
+}
+
+size_t BbrController::currentChunkSize() const
+{
+    return mode_ == Mode::PROBE_RTT ? probeChunkSize() : steadyChunkSize();
+}
+
+size_t BbrController::steadyChunkSize() const
+{
+    // Whole 4KB pages keep disk reads aligned
+    size_t size = static_cast<size_t>(chunk_size_) / 4096 * 4096;
+    return std::clamp(size, min_chunk_size_, max_chunk_size_);
+}
+
+size_t BbrController::probeChunkSize() const
+{
+    // The smallest chunks keep the shrunk window from queueing
+    return std::clamp(MIN_CONTROLLED_CHUNK_SIZE, min_chunk_size_,
+                      max_chunk_size_);
+}
+
+size_t BbrController::windowBytes() const
+{
+    size_t chunk_size = currentChunkSize();
+    if (mode_ == Mode::PROBE_RTT)
+    {
+        return MIN_WINDOW_CHUNKS * chunk_size;
+    }
+    if (bdp() == 0.0)
+    {
+        return CHUNKS_PER_WINDOW * chunk_size;
+    }
+    return std::max(
+        static_cast<size_t>(gain() * WINDOW_GAIN * bdp() + extra_acked_),
+        MIN_WINDOW_CHUNKS * chunk_size);
+}
+
+std::optional<LinkEstimate> BbrController::linkEstimate() const
+{
+    if (bdp() == 0.0)
+    {
+        return std::nullopt;
+    }
+    return LinkEstimate{btl_bw_, min_rtt_, steadyChunkSize(),
+                        std::max(static_cast<size_t>(WINDOW_GAIN * bdp()),
+                                 MIN_WINDOW_CHUNKS * steadyChunkSize())};
+}
+
+void BbrController::warmStart(const LinkEstimate& estimate,
+                              Clock::time_point   now)
+{
+    if (estimate.bandwidth <= 0.0 || estimate.min_rtt.count() <= 0)
+    {
+        return;
+    }
+
+    updateBandwidth(estimate.bandwidth);
+    min_rtt_ = estimate.min_rtt;
+    min_rtt_time_ = now;
+    full_bw_ = btl_bw_;
+    mode_ = Mode::PROBE_BW;
+    cycle_index_ = 2;
+    cycle_start_ = now;
+    // No larger than the chunks the restored BDP leads to, whatever an
+    // estimate saved with a queue standing says
+    double lower = static_cast<double>(std::clamp(
+        MIN_CONTROLLED_CHUNK_SIZE, min_chunk_size_, max_chunk_size_));
+    double upper = std::clamp(WINDOW_GAIN * bdp() / CHUNKS_PER_WINDOW, lower,
+                              static_cast<double>(max_chunk_size_));
+    if (estimate.chunk_size > 0)
+    {
+        chunk_size_ = std::clamp(static_cast<double>(estimate.chunk_size),
+                                 static_cast<double>(min_chunk_size_), upper);
+    } else {
+        chunk_size_ = upper;
+    }
+}
+
+void BbrController::updateBandwidth(double rate)
+{
+    // Monotonic deque: a sample evicts the older ones it beats, and the
+    // front is the highest rate of the last rounds
+    while (!bandwidth_samples_.empty() &&
+           bandwidth_samples_.back().second <= rate)
+    {
+        bandwidth_samples_.pop_back();
+    }
+    bandwidth_samples_.emplace_back(round_count_, rate);
+    while (bandwidth_samples_.front().first + BANDWIDTH_WINDOW_ROUNDS <
+           round_count_)
+    {
+        bandwidth_samples_.pop_front();
+    }
+    btl_bw_ = bandwidth_samples_.front().second;
+}
+
+void BbrController::updateExtraAcked(size_t size, Clock::time_point now)
+{
+    if (btl_bw_ == 0.0)
+    {
+        return;
+    }
+
+    // A new epoch once acks fall behind the bandwidth again
+    double expected =
+        btl_bw_ * std::chrono::duration<double>(now - ack_epoch_start_).count();
+    if (ack_epoch_acked_ <= expected)
+    {
+        ack_epoch_start_ = now;
+        ack_epoch_acked_ = 0.0;
+        expected = 0.0;
+    }
+    ack_epoch_acked_ += size;
+    double extra = std::min(ack_epoch_acked_ - expected, WINDOW_GAIN * bdp());
+
+    while (!extra_acked_samples_.empty() &&
+           extra_acked_samples_.back().second <= extra)
+    {
+        extra_acked_samples_.pop_back();
+    }
+    extra_acked_samples_.emplace_back(round_count_, extra);
+    while (extra_acked_samples_.front().first + BANDWIDTH_WINDOW_ROUNDS <
+           round_count_)
+    {
+        extra_acked_samples_.pop_front();
+    }
+    extra_acked_ = extra_acked_samples_.front().second;
+}
+
+void BbrController::updateMinRtt(std::chrono::microseconds rtt,
+                                 const SentChunk&          sent,
+                                 Clock::time_point         now)
+{
+    // The chunk's own transmission is not propagation delay. The
+    // bandwidth is still an underestimate during STARTUP, and never more
+    // than half of the sample is taken off
+    if (mode_ != Mode::STARTUP && btl_bw_ > 0.0)
+    {
+        auto transmission = std::chrono::microseconds(
+            static_cast<int64_t>(sent.size / btl_bw_ * 1e6));
+        rtt -= std::min(transmission, rtt / 2);
+    }
+
+    if (min_rtt_.count() == 0 || rtt <= min_rtt_)
+    {
+        min_rtt_ = rtt;
+        min_rtt_time_ = now;
+    }
+    // Only chunks sent after the window drained saw no queue
+    if (mode_ == Mode::PROBE_RTT && probe_rtt_done_ != Clock::time_point() &&
+        sent.delivered >= probe_rtt_delivered_ &&
+        (probe_rtt_min_.count() == 0 || rtt < probe_rtt_min_))
+    {
+        probe_rtt_min_ = rtt;
+    }
+}
+
+void BbrController::updateMode(Clock::time_point now)
+{
+    // Any RTT taken with a queue ahead would only grow the estimate
+    if (mode_ != Mode::PROBE_RTT && min_rtt_.count() > 0 &&
+        now - min_rtt_time_ > MIN_RTT_WINDOW)
+    {
+        probe_rtt_return_mode_ = mode_;
+        mode_ = Mode::PROBE_RTT;
+        probe_rtt_done_ = Clock::time_point();
+        probe_rtt_min_ = std::chrono::microseconds(0);
+    }
+
+    switch (mode_)
+    {
+        case Mode::STARTUP:
+            // Full once three rounds in a row failed to add a quarter
+            if (!round_start_)
+            {
+                break;
+            }
+            if (btl_bw_ >= full_bw_ * 1.25)
+            {
+                full_bw_ = btl_bw_;
+                full_bw_rounds_ = 0;
+            } else if (++full_bw_rounds_ >= 3)
+            {
+                mode_ = Mode::DRAIN;
+            }
+            break;
+        case Mode::DRAIN:
+            if (bytes_in_flight_ <= bdp())
+            {
+                mode_ = Mode::PROBE_BW;
+                cycle_index_ = 2;
+                cycle_start_ = now;
+            }
+            break;
+        case Mode::PROBE_BW:
+            if (now - cycle_start_ >= min_rtt_)
+            {
+                cycle_index_ = (cycle_index_ + 1) % PROBE_GAINS.size();
+                cycle_start_ = now;
+            }
+            break;
+        case Mode::PROBE_RTT:
+            if (probe_rtt_done_ == Clock::time_point())
+            {
+                if (bytes_in_flight_ <= windowBytes())
+                {
+                    probe_rtt_done_ =
+                        now + std::max<Clock::duration>(PROBE_RTT_DURATION,
+                                                        min_rtt_);
+                    probe_rtt_delivered_ = delivered_;
+                }
+            } else if (now >= probe_rtt_done_ && probe_rtt_min_.count() > 0)
+            {
+                min_rtt_ = probe_rtt_min_;
+                min_rtt_time_ = now;
+                mode_ = probe_rtt_return_mode_;
+                cycle_index_ = 2;
+                cycle_start_ = now;
+            }
+            break;
+    }
+}
+
+double BbrController::bdp() const
+{
+    return btl_bw_ * std::chrono::duration<double>(min_rtt_).count();
+}
+
+double BbrController::gain() const
+{
+    switch (mode_)
+    {
+        case Mode::STARTUP: return STARTUP_GAIN;
+        case Mode::DRAIN: return 1.0 / STARTUP_GAIN;
+        case Mode::PROBE_RTT: return 1.0;
+        default: return PROBE_GAINS[cycle_index_];
+    }
+}
@@ -0,0 +1,130 @@
+#ifndef BBR_CONTROLLER_HPP
+#define BBR_CONTROLLER_HPP
+
+#include <array>
+#include <deque>
+#include <unordered_map>
+
+#include "ChunkController.hpp"
+
+// Models the path as its bottleneck bandwidth (the highest delivery rate
+// of the last rounds) and its round-trip propagation time (the lowest RTT
+// of the last seconds), after BBR. The window is a multiple of their
+// product: STARTUP grows it until the bandwidth stops rising, DRAIN lets
+// the queue built meanwhile empty, and PROBE_BW cycles slightly above and
+// below the estimate to notice changes. Before the lowest RTT expires,
+// PROBE_RTT shrinks the window for a round trip so it is measured without
+// a queue. Acks held back by a lost segment arrive in a burst, so the
+// window also covers the largest burst of the last rounds. Chunks are a
+// fraction of the window and move towards their target a step per ack, so
+// they change gradually
+class BbrController : public ChunkController
+{
+  public:
+    static constexpr size_t INITIAL_CHUNK_SIZE = 262144; // 256KB
+    // Chunks smaller than this cost more in acks and disk jobs than they
+    // save in latency
+    static constexpr size_t MIN_CONTROLLED_CHUNK_SIZE = 65536; // 64KB
+    static constexpr size_t CHUNKS_PER_WINDOW = 8;
+    static constexpr size_t MIN_WINDOW_CHUNKS = 4;
+
+    BbrController(size_t min_chunk_size, size_t max_chunk_size);
+
+    void onChunkSent(size_t offset, size_t size,
+                     Clock::time_point now) override;
+    void onChunkAcked(size_t offset, size_t size,
+                      std::chrono::microseconds rtt,
+                      Clock::time_point         now) override;
+
+    size_t nextChunkSize() override;
+    size_t currentChunkSize() const override;
+    size_t windowBytes() const override;
+
+    std::optional<LinkEstimate> linkEstimate() const override;
+    // Skips STARTUP: the window opens at the estimated BDP and PROBE_BW
+    // corrects it, the estimated bandwidth ages out like any sample
+    void warmStart(const LinkEstimate& estimate,
+                   Clock::time_point   now) override;
+
+    // Bytes per second, 0 until the first ack
+    double                    bottleneckBandwidth() const { return btl_bw_; }
+    std::chrono::microseconds minRtt() const { return min_rtt_; }
+
+  private:
+    enum class Mode
+    {
+        STARTUP,
+        DRAIN,
+        PROBE_BW,
+        PROBE_RTT,
+    };
+
+    // Delivery state when a chunk was sent, for its rate sample
+    struct SentChunk
+    {
+        size_t            size = 0;
+        uint64_t          delivered = 0;
+        Clock::time_point delivered_time;
+    };
+
+    static constexpr double STARTUP_GAIN = 2.89; // 2 / ln 2
+    static constexpr double WINDOW_GAIN = 2.0;
+    static constexpr std::array<double, 8> PROBE_GAINS = {1.25, 0.75, 1, 1,
+                                                          1,    1,    1, 1};
+    static constexpr uint64_t BANDWIDTH_WINDOW_ROUNDS = 10;
+    static constexpr std::chrono::seconds MIN_RTT_WINDOW{10};
+    // Least time PROBE_RTT holds the window down once drained
+    static constexpr std::chrono::milliseconds PROBE_RTT_DURATION{200};
+
+    void   updateBandwidth(double rate);
+    void   updateExtraAcked(size_t size, Clock::time_point now);
+    void   updateMinRtt(std::chrono::microseconds rtt, const SentChunk& sent,
+                        Clock::time_point now);
+    void   updateMode(Clock::time_point now);
+    // Chunk size outside PROBE_RTT
+    size_t steadyChunkSize() const;
+    size_t probeChunkSize() const;
+    double bdp() const;
+    double gain() const;
+
+    size_t min_chunk_size_;
+    size_t max_chunk_size_;
+    double chunk_size_;
+
+    std::unordered_map<size_t, SentChunk> sent_chunks_;
+    size_t                                bytes_in_flight_;
+    uint64_t                              delivered_;
+    Clock::time_point                     delivered_time_;
+
+    // Round trips counted by acks of chunks sent after the last round began
+    uint64_t round_count_;
+    uint64_t next_round_delivered_;
+    bool     round_start_;
+
+    // (round, rate) of the windowed maximum, highest first
+    std::deque<std::pair<uint64_t, double>> bandwidth_samples_;
+    double                                  btl_bw_;
+    // Bytes acked beyond the bandwidth estimate since the epoch start, and
+    // (round, bytes) of their windowed maximum, highest first
+    Clock::time_point                       ack_epoch_start_;
+    double                                  ack_epoch_acked_;
+    std::deque<std::pair<uint64_t, double>> extra_acked_samples_;
+    double                                  extra_acked_;
+    std::chrono::microseconds               min_rtt_;
+    Clock::time_point                       min_rtt_time_;
+
+    Mode              mode_;
+    double            full_bw_;
+    int               full_bw_rounds_;
+    size_t            cycle_index_;
+    Clock::time_point cycle_start_;
+
+    // Mode PROBE_RTT returns to, when it ends (unset while draining), the
+    // bytes delivered once drained and the lowest RTT of chunks sent since
+    Mode                      probe_rtt_return_mode_;
+    Clock::time_point         probe_rtt_done_;
+    uint64_t                  probe_rtt_delivered_;
+    std::chrono::microseconds probe_rtt_min_;
+};
+
+#endif // BBR_CONTROLLER_HPP
@@ -0,0 +1,230 @@
+#include "ChunkCompressor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <zlib.h>
+
+namespace
+{
+
+constexpr size_t SAMPLE_WINDOWS = 16;
+constexpr size_t SAMPLE_WINDOW_SIZE = 256;
+
+// Raw deflate, the frame already carries a CRC32C
+constexpr int WINDOW_BITS = -15;
+constexpr int MEMORY_LEVEL = 8;
+
+// Rough zlib speeds on text until a level has been measured, in bytes per
+// second. Index matches ChunkCompressor::LEVELS
+constexpr std::array<double, 5> PRIOR_SPEEDS = {0.0, 150e6, 100e6, 40e6,
+                                                15e6};
+
+} // namespace
+
+ChunkCompressor::ChunkCompressor(size_t workers) :
+    workers_(std::max<size_t>(workers, 1)), link_rate_(0.0), chunks_(0),
+    enabled_(true)
+{
+    for (size_t i = 0; i < LEVELS.size(); ++i)
+    {
+        stats_[i].speed = PRIOR_SPEEDS[i];
+    }
+}
+
+int ChunkCompressor::chooseLevel()
+{
+    if (!enabled_ || link_rate_ <= 0.0)
+    {
+        return 0;
+    }
+
+    size_t best = 0;
+    for (size_t i = 1; i < LEVELS.size(); ++i)
+    {
+        if (throughput(i) > throughput(best))
+        {
+            best = i;
+        }
+    }
+
+    if (++chunks_ % EXPLORE_INTERVAL == 0)
+    {
+        bool up = (chunks_ / EXPLORE_INTERVAL) % 2 == 0 || best == 0;
+        if (up && best + 1 < LEVELS.size())
+        {
+            return LEVELS[best + 1];
+        }
+        if (best > 0)
+        {
+            return LEVELS[best - 1];
+        }
+    }
+    return LEVELS[best];
+}
+
+void ChunkCompressor::recordCompression(int level, size_t input_size,
+                                        size_t output_size, double seconds)
+{
+    size_t index = levelIndex(level);
+    if (index == 0 || input_size == 0)
+    {
+        return;
+    }
+
+    LevelStats& stats = stats_[index];
+    double      ratio = static_cast<double>(output_size) / input_size;
+    stats.ratio = stats.measured ? 0.8 * stats.ratio + 0.2 * ratio : ratio;
+    // Chunks skipped on entropy never ran deflate and say nothing on speed
+    if (seconds > 0.0)
+    {
+        double speed = input_size / seconds;
+        stats.speed = stats.measured ? 0.8 * stats.speed + 0.2 * speed : speed;
+    }
+    stats.measured = true;
+}
+
+void ChunkCompressor::recordLinkRate(double bytes_per_second)
+{
+    link_rate_ = link_rate_ == 0.0
+                     ? bytes_per_second
+                     : 0.7 * link_rate_ + 0.3 * bytes_per_second;
+}
+
+double ChunkCompressor::sampleEntropy(const uint8_t* data, size_t size)
+{
+    std::array<uint32_t, 256> counts{};
+    size_t                    sampled = 0;
+    if (size <= SAMPLE_WINDOWS * SAMPLE_WINDOW_SIZE)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            ++counts[data[i]];
+        }
+        sampled = size;
+    } else {
+        size_t stride = size / SAMPLE_WINDOWS;
+        for (size_t window = 0; window < SAMPLE_WINDOWS; ++window)
+        {
+            const uint8_t* begin = data + window * stride;
+            for (size_t i = 0; i < SAMPLE_WINDOW_SIZE; ++i)
+            {
+                ++counts[begin[i]];
+            }
+        }
+        sampled = SAMPLE_WINDOWS * SAMPLE_WINDOW_SIZE;
+    }
+
+    double entropy = 0.0;
+    for (uint32_t count : counts)
+    {
+        if (count > 0)
+        {
+            double p = static_cast<double>(count) / sampled;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+ChunkCompressor::Result ChunkCompressor::compress(
+    const std::vector<uint8_t>& data, int level)
+{
+    Result result;
+    if (level <= 0 || data.size() < MIN_CHUNK_SIZE)
+    {
+        return result;
+    }
+    // Skipping on entropy still counts as a try at this level, one that
+    // saved nothing
+    result.level = level;
+    if (sampleEntropy(data.data(), data.size()) > MAX_ENTROPY)
+    {
+        return result;
+    }
+
+    auto     start = std::chrono::steady_clock::now();
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, WINDOW_BITS, MEMORY_LEVEL,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return result;
+    }
+
+    std::vector<uint8_t> compressed(
+        deflateBound(&stream, static_cast<uLong>(data.size())));
+    stream.next_in = const_cast<Bytef*>(data.data());
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = compressed.data();
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    int    status = deflate(&stream, Z_FINISH);
+    size_t compressed_size = stream.total_out;
+    deflateEnd(&stream);
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+    if (status == Z_STREAM_END &&
+        compressed_size < data.size() - data.size() / 16)
+    {
+        compressed.resize(compressed_size);
+        result.data = std::move(compressed);
+    }
+    return result;
+}
+
+std::optional<std::vector<uint8_t>>
+ChunkCompressor::decompress(const std::vector<uint8_t>& data,
+                            size_t                      data_size)
+{
+    z_stream stream{};
+    if (inflateInit2(&stream, WINDOW_BITS) != Z_OK)
+    {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> decompressed(data_size);
+    stream.next_in = const_cast<Bytef*>(data.data());
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = decompressed.data();
+    stream.avail_out = static_cast<uInt>(decompressed.size());
+    int  status = inflate(&stream, Z_FINISH);
+    bool complete = status == Z_STREAM_END && stream.avail_in == 0 &&
+                    stream.total_out == data_size;
+    inflateEnd(&stream);
+
+    if (!complete)
+    {
+        return std::nullopt;
+    }
+    return decompressed;
+}
+
+size_t ChunkCompressor::levelIndex(int level) const
+{
+    auto it = std::find(LEVELS.begin(), LEVELS.end(), level);
+    return it != LEVELS.end() ? static_cast<size_t>(it - LEVELS.begin()) : 0;
+}
+
+double ChunkCompressor::throughput(size_t index) const
+{
+    if (index == 0)
+    {
+        return link_rate_;
+    }
+
+    // An unmeasured level is assumed to shrink data like the closest
+    // weaker level that was measured
+    double ratio = 1.0;
+    for (size_t i = index; i > 0; --i)
+    {
+        if (stats_[i].measured)
+        {
+            ratio = stats_[i].ratio;
+            break;
+        }
+    }
+    return std::min(stats_[index].speed * workers_,
+                    link_rate_ / std::max(ratio, 0.01));
+}
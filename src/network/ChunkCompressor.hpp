@@ -0,0 +1,76 @@
+#ifndef CHUNK_COMPRESSOR_HPP
+#define CHUNK_COMPRESSOR_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Per-chunk deflate between the disk and the wire. Chunks whose sampled
+// entropy says they will not shrink (media, archives) are sent as they are.
+// The level is picked by comparing how fast each level compresses with how
+// fast the link delivers, measured as the transfer runs: a slow link
+// favours stronger levels, a fast one no compression at all. Level choice
+// and measurements live on the network executor, compress() and
+// decompress() run on disk workers
+class ChunkCompressor
+{
+  public:
+    // Candidate zlib levels, 0 sends chunks uncompressed
+    static constexpr std::array<int, 5> LEVELS = {0, 1, 3, 6, 9};
+    // Sampled entropy above which a chunk is sent as is, in bits per byte
+    static constexpr double MAX_ENTROPY = 7.5;
+    // Smaller chunks are not worth the call
+    static constexpr size_t MIN_CHUNK_SIZE = 4096; // 4KB
+    // Every this many chunks a level next to the best one is tried, so the
+    // estimates follow the data and the link
+    static constexpr uint64_t EXPLORE_INTERVAL = 16;
+
+    struct Result
+    {
+        // Empty when the chunk is sent uncompressed
+        std::vector<uint8_t> data;
+        // 0 when the chunk was too small to try
+        int                  level = 0;
+        double               seconds = 0.0;
+    };
+
+    explicit ChunkCompressor(size_t workers = 1);
+
+    void setEnabled(bool enabled) { enabled_ = enabled; }
+    bool isEnabled() const { return enabled_; }
+
+    int  chooseLevel();
+    void recordCompression(int level, size_t input_size, size_t output_size,
+                           double seconds);
+    // Rate at which the peer acknowledges bytes as they went on the wire
+    void recordLinkRate(double bytes_per_second);
+
+    // Shannon entropy of a sample spread over the data, in bits per byte
+    static double sampleEntropy(const uint8_t* data, size_t size);
+    // Skips data that looks incompressible or does not shrink by 1/16
+    static Result compress(const std::vector<uint8_t>& data, int level);
+    static std::optional<std::vector<uint8_t>>
+    decompress(const std::vector<uint8_t>& data, size_t data_size);
+
+  private:
+    struct LevelStats
+    {
+        double speed = 0.0; // input bytes per second
+        double ratio = 1.0; // output / input
+        bool   measured = false;
+    };
+
+    size_t levelIndex(int level) const;
+    // Bytes of file data per second the pipeline could move at this level
+    double throughput(size_t index) const;
+
+    std::array<LevelStats, LEVELS.size()> stats_;
+    size_t                                workers_;
+    double                                link_rate_;
+    uint64_t                              chunks_;
+    bool                                  enabled_;
+};
+
+#endif // CHUNK_COMPRESSOR_HPP
@@ -0,0 +1,30 @@
+#include "ChunkController.hpp"
+
+#include "AimdController.hpp"
+#include "BbrController.hpp"
+#include "ChunkSizeOptimizer.hpp"
+
+std::unique_ptr<ChunkController>
+ChunkController::create(ChunkControlPolicy policy, size_t min_chunk_size,
+                        size_t max_chunk_size)
+{
+    switch (policy)
+    {
+        case ChunkControlPolicy::AIMD:
+            return std::make_unique<AimdController>(min_chunk_size,
+                                                    max_chunk_size);
+        case ChunkControlPolicy::EPSILON_GREEDY:
+        {
+            std::vector<size_t> sizes;
+            for (size_t size = min_chunk_size; size <= max_chunk_size;
+                 size *= 2)
+            {
+                sizes.push_back(size);
+            }
+            return std::make_unique<ChunkSizeOptimizer>(std::move(sizes));
+        }
+        default:
+            return std::make_unique<BbrController>(min_chunk_size,
+                                                   max_chunk_size);
+    }
+}
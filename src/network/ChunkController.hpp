@@ -0,0 +1,67 @@
+#ifndef CHUNK_CONTROLLER_HPP
+#define CHUNK_CONTROLLER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+// How an outgoing transfer sizes its chunks and its window
+enum class ChunkControlPolicy : uint8_t {
+    BBR,            // bandwidth and RTT model, see BbrController
+    AIMD,           // additive increase, multiplicative decrease on delay
+    EPSILON_GREEDY, // ChunkSizeOptimizer, the window left to the settings
+};
+
+// What a controller has learned about the path to a peer. Kept per peer,
+// so the next transfer there starts from it
+struct LinkEstimate
+{
+    double                    bandwidth = 0.0; // bytes per second
+    std::chrono::microseconds min_rtt{0};
+    size_t                    chunk_size = 0;
+    size_t                    window = 0; // bytes, 0 when not modelled
+};
+
+// Decides the size of the next chunk of a transfer and how many bytes may
+// be unacknowledged, learning from the acks of earlier chunks. One per
+// transfer, used on the network executor only
+class ChunkController
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    virtual ~ChunkController() = default;
+
+    virtual void onChunkSent(size_t /*offset*/, size_t /*size*/,
+                             Clock::time_point /*now*/)
+    {}
+    virtual void onChunkAcked(size_t offset, size_t size,
+                              std::chrono::microseconds rtt,
+                              Clock::time_point         now) = 0;
+
+    virtual size_t nextChunkSize() = 0;
+    // Size the last nextChunkSize() returned
+    virtual size_t currentChunkSize() const = 0;
+    // Bytes allowed in flight, 0 leaves the window to the configured limits
+    virtual size_t windowBytes() const { return 0; }
+    // Replaces any random seed, so that simulated runs repeat exactly
+    virtual void seed(uint32_t /*value*/) {}
+
+    // Empty until enough acks have been seen to say anything
+    virtual std::optional<LinkEstimate> linkEstimate() const
+    {
+        return std::nullopt;
+    }
+    // Starts from an earlier transfer's estimate instead of probing anew
+    virtual void warmStart(const LinkEstimate& /*estimate*/,
+                           Clock::time_point /*now*/)
+    {}
+
+    static std::unique_ptr<ChunkController>
+    create(ChunkControlPolicy policy, size_t min_chunk_size,
+           size_t max_chunk_size);
+};
+
+#endif // CHUNK_CONTROLLER_HPP
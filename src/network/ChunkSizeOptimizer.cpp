@@ -25,7 +25,7 @@ void ChunkSizeOptimizer::recordPerformance(size_t                    chunk_size,
     {
         data.latencies.pop_front();
     }
-    updateMetrics(data);
+    updateMetrics(chunk_size, data);
 }
 
 size_t ChunkSizeOptimizer::getOptimalChunkSize()
@@ -34,6 +34,18 @@ size_t ChunkSizeOptimizer::getOptimalChunkSize()
     return possible_sizes_[current_size_index_];
 }
 
+void ChunkSizeOptimizer::onChunkAcked(size_t /*offset*/, size_t size,
+                                      std::chrono::microseconds rtt,
+                                      Clock::time_point /*now*/)
+{
+    recordPerformance(size, rtt);
+}
+
+size_t ChunkSizeOptimizer::currentChunkSize() const
+{
+    return possible_sizes_[current_size_index_];
+}
+
 void ChunkSizeOptimizer::optimizeChunkSize()
 {
     if (shouldExplore())
@@ -42,20 +54,67 @@ void ChunkSizeOptimizer::optimizeChunkSize()
                                                    possible_sizes_.size() - 1);
         current_size_index_ = dist(rng_);
     } else {
-        auto it =
-            std::max_element(performance_data_.begin(), performance_data_.end(),
-                             [this](const auto& a, const auto& b) {
-                                 return comparePerformance(a, b);
-                             });
-
-        size_t optimal_size = it->first;
-        auto size_it = std::find(possible_sizes_.begin(), possible_sizes_.end(),
-                                 optimal_size);
-        if (size_it != possible_sizes_.end())
-        {
-            current_size_index_ =
-                std::distance(possible_sizes_.begin(), size_it);
-        }
+        current_size_index_ = bestSizeIndex();
+    }
+}
+
+size_t ChunkSizeOptimizer::bestSizeIndex() const
+{
+    auto it =
+        std::max_element(performance_data_.begin(), performance_data_.end(),
+                         [this](const auto& a, const auto& b) {
+                             return comparePerformance(a, b);
+                         });
+
+    size_t optimal_size = it->first;
+    auto size_it = std::find(possible_sizes_.begin(), possible_sizes_.end(),
+                             optimal_size);
+    if (size_it == possible_sizes_.end())
+    {
+        return current_size_index_;
+    }
+    return std::distance(possible_sizes_.begin(), size_it);
+}
+
+std::optional<LinkEstimate> ChunkSizeOptimizer::linkEstimate() const
+{
+    if (max_observed_throughput_ == 0)
+    {
+        return std::nullopt;
+    }
+    LinkEstimate estimate;
+    estimate.bandwidth = max_observed_throughput_ * 1024 * 1024;
+    estimate.min_rtt = std::chrono::microseconds(
+        static_cast<int64_t>(min_observed_latency_));
+    estimate.chunk_size = possible_sizes_[bestSizeIndex()];
+    return estimate;
+}
+
+void ChunkSizeOptimizer::warmStart(const LinkEstimate& estimate,
+                                   Clock::time_point /*now*/)
+{
+    if (estimate.chunk_size == 0)
+    {
+        return;
+    }
+
+    auto distance = [&estimate](size_t size) {
+        return size > estimate.chunk_size ? size - estimate.chunk_size
+                                          : estimate.chunk_size - size;
+    };
+    current_size_index_ = std::distance(
+        possible_sizes_.begin(),
+        std::min_element(possible_sizes_.begin(), possible_sizes_.end(),
+                         [&distance](size_t a, size_t b) {
+                             return distance(a) < distance(b);
+                         }));
+
+    if (estimate.min_rtt.count() > 0)
+    {
+        size_t size = possible_sizes_[current_size_index_];
+        auto&  data = performance_data_[size];
+        data.latencies.assign(window_size_, estimate.min_rtt);
+        updateMetrics(size, data);
     }
 }
 
@@ -92,7 +151,8 @@ double ChunkSizeOptimizer::calculateScore(const PerformanceData& data) const
            latency_weight * normalized_latency + stability_weight * stability;
 }
 
-void ChunkSizeOptimizer::updateMetrics(PerformanceData& data)
+void ChunkSizeOptimizer::updateMetrics(size_t           chunk_size,
+                                       PerformanceData& data)
 {
     if (data.latencies.empty()) return;
 
@@ -110,10 +170,10 @@ void ChunkSizeOptimizer::updateMetrics(PerformanceData& data)
     }
     data.variance = sum_squared_diff / data.latencies.size();
 
+    // MB/s of this chunk size at its average latency
     double seconds = data.average_latency / 1e6;
     data.effective_throughput =
-        static_cast<double>(data.latencies.front().count()) / seconds /
-        (1024 * 1024);
+        static_cast<double>(chunk_size) / seconds / (1024 * 1024);
 
     max_observed_throughput_ =
         std::max(max_observed_throughput_, data.effective_throughput);
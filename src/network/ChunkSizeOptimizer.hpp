@@ -10,7 +10,11 @@
 #include <unordered_map>
 #include <vector>
 
-class ChunkSizeOptimizer
+#include "ChunkController.hpp"
+
+// Epsilon-greedy choice among fixed chunk sizes, scored on the throughput
+// and latency of their last acks. Leaves the window to the settings
+class ChunkSizeOptimizer : public ChunkController
 {
   public:
     ChunkSizeOptimizer(std::vector<size_t> possible_sizes,
@@ -20,6 +24,20 @@ class ChunkSizeOptimizer
                              std::chrono::microseconds latency);
     size_t getOptimalChunkSize();
 
+    void   onChunkAcked(size_t offset, size_t size,
+                        std::chrono::microseconds rtt,
+                        Clock::time_point         now) override;
+    size_t nextChunkSize() override { return getOptimalChunkSize(); }
+    size_t currentChunkSize() const override;
+    void   seed(uint32_t value) override { rng_.seed(value); }
+
+    std::optional<LinkEstimate> linkEstimate() const override;
+    // Starts at the ladder size nearest the estimate's chunk, credited with
+    // a full window of samples at the estimated RTT so exploitation stays
+    // there until measured sizes beat it
+    void warmStart(const LinkEstimate& estimate,
+                   Clock::time_point   now) override;
+
   private:
     struct PerformanceData
     {
@@ -29,12 +47,13 @@ class ChunkSizeOptimizer
         double                                variance = 0;
     };
 
-    void optimizeChunkSize();
+    void   optimizeChunkSize();
+    size_t bestSizeIndex() const;
     bool
            comparePerformance(const std::pair<const size_t, PerformanceData>& a,
                               const std::pair<const size_t, PerformanceData>& b) const;
     double calculateScore(const PerformanceData& data) const;
-    void   updateMetrics(PerformanceData& data);
+    void   updateMetrics(size_t chunk_size, PerformanceData& data);
     bool   shouldExplore();
 
     std::vector<size_t>                         possible_sizes_;
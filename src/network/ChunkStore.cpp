@@ -0,0 +1,229 @@
+#include "ChunkStore.hpp"
+
+#include "Logger.hpp"
+#include "Message/WireFormat.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr uint32_t INDEX_MAGIC = 0x31435351; // "QSC1"
+constexpr size_t   RECORD_HEADER_SIZE = 2;   // path length
+constexpr size_t   RECORD_COUNT_SIZE = 4;
+constexpr size_t   CHUNK_RECORD_SIZE = 24;
+constexpr size_t   MAX_PATH_SIZE = 65535;
+
+} // namespace
+
+ChunkStore::ChunkStore(fs::path index_path) : index_path_(std::move(index_path))
+{
+    load();
+}
+
+std::optional<ChunkStore::Location> ChunkStore::lookup(const ChunkId& id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto                        it = entries_.find(id);
+    if (it == entries_.end())
+    {
+        return std::nullopt;
+    }
+    return Location{paths_[it->second.path_index], it->second.offset};
+}
+
+void ChunkStore::add(const fs::path&             file_path,
+                     const std::vector<ChunkId>& chunks)
+{
+    std::error_code ec;
+    std::string     path = fs::absolute(file_path, ec).string();
+    if (ec || path.size() > MAX_PATH_SIZE)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t                    path_index = pathIndex(path);
+
+    std::vector<std::pair<ChunkId, uint64_t>> added;
+    uint64_t                                  offset = 0;
+    for (const ChunkId& id : chunks)
+    {
+        if (entries_.size() < MAX_ENTRIES || entries_.count(id))
+        {
+            entries_.insert_or_assign(id, Entry{path_index, offset});
+            added.emplace_back(id, offset);
+        }
+        offset += id.size;
+    }
+    if (added.size() < chunks.size())
+    {
+        LOG_WARNING(QString("Chunk store is full, %1 chunks of %2 not indexed")
+                        .arg(chunks.size() - added.size())
+                        .arg(path.c_str()));
+    }
+    appendRecord(path, added);
+}
+
+void ChunkStore::forget(const ChunkId& id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(id);
+}
+
+size_t ChunkStore::ChunkIdHash::operator()(const ChunkId& id) const
+{
+    // Already a hash of the contents
+    return static_cast<size_t>(id.hash ^ (static_cast<uint64_t>(id.checksum)
+                                          << 32));
+}
+
+uint32_t ChunkStore::pathIndex(const std::string& path)
+{
+    auto [it, inserted] =
+        path_indices_.emplace(path, static_cast<uint32_t>(paths_.size()));
+    if (inserted)
+    {
+        paths_.push_back(path);
+    }
+    return it->second;
+}
+
+void ChunkStore::load()
+{
+    size_t record_count = 0;
+    bool   valid_index = false;
+    {
+        std::ifstream file(index_path_, std::ios::binary);
+        uint8_t       magic[4];
+        valid_index =
+            file.read(reinterpret_cast<char*>(magic), sizeof(magic)) &&
+            wire::getLE<uint32_t>(magic) == INDEX_MAGIC;
+        uint8_t header[RECORD_HEADER_SIZE];
+        while (valid_index &&
+               file.read(reinterpret_cast<char*>(header), sizeof(header)))
+        {
+            std::string path(wire::getLE<uint16_t>(header), '\0');
+            uint8_t     count[RECORD_COUNT_SIZE];
+            if (!file.read(path.data(), path.size()) ||
+                !file.read(reinterpret_cast<char*>(count), sizeof(count)))
+            {
+                break;
+            }
+
+            uint32_t             path_index = pathIndex(path);
+            std::vector<uint8_t> records(
+                static_cast<size_t>(wire::getLE<uint32_t>(count)) *
+                CHUNK_RECORD_SIZE);
+            if (!file.read(reinterpret_cast<char*>(records.data()),
+                           records.size()))
+            {
+                break;
+            }
+            for (size_t i = 0; i < records.size(); i += CHUNK_RECORD_SIZE)
+            {
+                const uint8_t* record = records.data() + i;
+                ChunkId        id;
+                id.size = wire::getLE<uint32_t>(record);
+                id.hash = wire::getLE<uint64_t>(record + 4);
+                id.checksum = wire::getLE<uint32_t>(record + 12);
+                entries_.insert_or_assign(
+                    id, Entry{path_index, wire::getLE<uint64_t>(record + 16)});
+                ++record_count;
+            }
+        }
+    }
+
+    // Rewrite the index when superseded records dominate it
+    if (!valid_index || record_count > 2 * entries_.size())
+    {
+        compact();
+    } else {
+        index_.open(index_path_, std::ios::binary | std::ios::app);
+    }
+
+    LOG_INFO(QString("Loaded %1 stored chunks").arg(entries_.size()));
+}
+
+void ChunkStore::compact()
+{
+    fs::path tmp_path = index_path_;
+    tmp_path += ".tmp";
+
+    index_.close();
+    index_.open(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!index_)
+    {
+        LOG_WARNING(QString("Unable to write chunk store index: %1")
+                        .arg(tmp_path.string().c_str()));
+        return;
+    }
+
+    uint8_t magic[4];
+    wire::putLE<uint32_t>(magic, INDEX_MAGIC);
+    index_.write(reinterpret_cast<const char*>(magic), sizeof(magic));
+
+    // Paths no entry refers to any more are dropped
+    std::vector<std::vector<std::pair<ChunkId, uint64_t>>> files(paths_.size());
+    for (const auto& [id, entry] : entries_)
+    {
+        files[entry.path_index].emplace_back(id, entry.offset);
+    }
+    std::vector<std::string> paths = std::move(paths_);
+    paths_.clear();
+    path_indices_.clear();
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (files[i].empty())
+        {
+            continue;
+        }
+        uint32_t path_index = pathIndex(paths[i]);
+        for (const auto& [id, offset] : files[i])
+        {
+            entries_[id].path_index = path_index;
+        }
+        appendRecord(paths[i], files[i]);
+    }
+    index_.close();
+
+    std::error_code ec;
+    fs::rename(tmp_path, index_path_, ec);
+    if (ec)
+    {
+        LOG_WARNING(QString("Unable to replace chunk store index: %1")
+                        .arg(ec.message().c_str()));
+    }
+    index_.open(index_path_, std::ios::binary | std::ios::app);
+}
+
+void ChunkStore::appendRecord(
+    const std::string&                               path,
+    const std::vector<std::pair<ChunkId, uint64_t>>& chunks)
+{
+    if (!index_.is_open() || chunks.empty())
+    {
+        return;
+    }
+
+    std::vector<uint8_t> record(RECORD_HEADER_SIZE + path.size() +
+                                RECORD_COUNT_SIZE +
+                                chunks.size() * CHUNK_RECORD_SIZE);
+    uint8_t*             out = record.data();
+    wire::putLE<uint16_t>(out, static_cast<uint16_t>(path.size()));
+    std::copy(path.begin(), path.end(), out + RECORD_HEADER_SIZE);
+    out += RECORD_HEADER_SIZE + path.size();
+    wire::putLE<uint32_t>(out, static_cast<uint32_t>(chunks.size()));
+    out += RECORD_COUNT_SIZE;
+    for (const auto& [id, offset] : chunks)
+    {
+        wire::putLE<uint32_t>(out, id.size);
+        wire::putLE<uint64_t>(out + 4, id.hash);
+        wire::putLE<uint32_t>(out + 12, id.checksum);
+        wire::putLE<uint64_t>(out + 16, offset);
+        out += CHUNK_RECORD_SIZE;
+    }
+
+    index_.write(reinterpret_cast<const char*>(record.data()), record.size());
+    index_.flush();
+}
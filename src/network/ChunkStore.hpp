@@ -0,0 +1,70 @@
+#ifndef CHUNK_STORE_HPP
+#define CHUNK_STORE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Message/FileMetadata.hpp"
+
+// Content-addressed index of the chunks of received files. It records
+// where a chunk lives instead of keeping a copy, so an entry goes stale
+// once its file changes: callers check the bytes they read against the id
+// and forget entries that no longer match. Persisted like FileHashCache
+// and safe to use from several disk workers at once
+class ChunkStore
+{
+  public:
+    using ChunkId = FileMetadata::ContentChunk;
+
+    struct Location
+    {
+        std::filesystem::path file_path;
+        uint64_t              offset = 0;
+    };
+
+    // About 256GB of average-sized chunks
+    static constexpr size_t MAX_ENTRIES = 4194304;
+
+    struct ChunkIdHash
+    {
+        size_t operator()(const ChunkId& id) const;
+    };
+
+    explicit ChunkStore(std::filesystem::path index_path);
+
+    std::optional<Location> lookup(const ChunkId& id);
+    // Indexes a file by its chunks, which follow each other from offset 0
+    void add(const std::filesystem::path& file_path,
+             const std::vector<ChunkId>&  chunks);
+    void forget(const ChunkId& id);
+
+  private:
+    struct Entry
+    {
+        uint32_t path_index = 0;
+        uint64_t offset = 0;
+    };
+
+    uint32_t pathIndex(const std::string& path);
+
+    void load();
+    void compact();
+    // One record per file: its path, then each chunk id with its offset
+    void appendRecord(const std::string&                              path,
+                      const std::vector<std::pair<ChunkId, uint64_t>>& chunks);
+
+    std::filesystem::path                           index_path_;
+    std::mutex                                      mutex_;
+    std::unordered_map<ChunkId, Entry, ChunkIdHash> entries_;
+    std::vector<std::string>                        paths_;
+    std::unordered_map<std::string, uint32_t>       path_indices_;
+    std::ofstream                                   index_;
+};
+
+#endif // CHUNK_STORE_HPP
@@ -0,0 +1,118 @@
+#include "ContentChunker.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace
+{
+
+// Random values per byte, fixed so every peer cuts at the same places
+constexpr std::array<uint64_t, 256> makeGearTable()
+{
+    std::array<uint64_t, 256> table{};
+    uint64_t                  state = 0x5153434443000000ULL;
+    for (uint64_t& value : table)
+    {
+        // splitmix64
+        state += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        value = z ^ (z >> 31);
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, 256> GEAR = makeGearTable();
+
+// Normalized chunking: two more mask bits than the average needs before
+// it, two fewer after, which keeps chunk sizes close to the average. The
+// top bits of the gear hash depend on the most recent bytes
+constexpr uint64_t MASK_SMALL = ~0ULL << (64 - 18);
+constexpr uint64_t MASK_LARGE = ~0ULL << (64 - 14);
+
+} // namespace
+
+size_t ContentChunker::nextBoundary(const uint8_t* data, size_t size)
+{
+    if (size <= MIN_SIZE)
+    {
+        return size;
+    }
+
+    size_t   normal_size = std::min(size, AVERAGE_SIZE);
+    size_t   end = std::min(size, MAX_SIZE);
+    uint64_t hash = 0;
+    size_t   i = MIN_SIZE;
+    for (; i < normal_size; ++i)
+    {
+        hash = (hash << 1) + GEAR[data[i]];
+        if (!(hash & MASK_SMALL))
+        {
+            return i + 1;
+        }
+    }
+    for (; i < end; ++i)
+    {
+        hash = (hash << 1) + GEAR[data[i]];
+        if (!(hash & MASK_LARGE))
+        {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+ContentChunker::Chunk ContentChunker::identify(const uint8_t* data,
+                                               size_t         size)
+{
+    return {static_cast<uint32_t>(size),
+            Digest::hashLeaf(HashAlgorithm::XXH64, data, size),
+            Digest::crc32c(data, size)};
+}
+
+std::optional<std::vector<ContentChunker::Chunk>>
+ContentChunker::chunkFile(const FileHandle& file, uint64_t file_size,
+                          Digest* digest)
+{
+    std::vector<Chunk> chunks;
+    chunks.reserve(file_size / AVERAGE_SIZE + 1);
+
+    std::vector<uint8_t> buffer(READ_SIZE);
+    size_t               begin = 0;
+    size_t               end = 0;
+    uint64_t             read_offset = 0;
+    while (true)
+    {
+        if (end - begin < MAX_SIZE && read_offset < file_size)
+        {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+
+            size_t size = std::min<uint64_t>(buffer.size() - end,
+                                             file_size - read_offset);
+            if (file.readAt(read_offset, buffer.data() + end, size) !=
+                static_cast<int64_t>(size))
+            {
+                return std::nullopt;
+            }
+            if (digest)
+            {
+                digest->update(buffer.data() + end, size);
+            }
+            end += size;
+            read_offset += size;
+        }
+        if (begin == end)
+        {
+            break;
+        }
+
+        size_t length = nextBoundary(buffer.data() + begin, end - begin);
+        chunks.push_back(identify(buffer.data() + begin, length));
+        begin += length;
+    }
+    return chunks;
+}
@@ -0,0 +1,44 @@
+#ifndef CONTENT_CHUNKER_HPP
+#define CONTENT_CHUNKER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "Digest.hpp"
+#include "FileHandle.hpp"
+#include "Message/FileMetadata.hpp"
+
+// FastCDC content-defined chunking. Boundaries follow a gear hash over the
+// bytes instead of fixed offsets, so an insertion only changes the chunks
+// around it and the rest keep their identity. Sender and receiver must cut
+// with the same parameters
+class ContentChunker
+{
+  public:
+    using Chunk = FileMetadata::ContentChunk;
+
+    static constexpr size_t MIN_SIZE = 16384;     // 16KB
+    static constexpr size_t AVERAGE_SIZE = 65536; // 64KB
+    static constexpr size_t MAX_SIZE = 262144;    // 256KB
+    // Smaller files are sent whole
+    static constexpr uint64_t MIN_FILE_SIZE = 1048576; // 1MB
+
+    // Length of the chunk starting at data. Fewer than MAX_SIZE bytes are
+    // only passed at the end of the file
+    static size_t nextBoundary(const uint8_t* data, size_t size);
+
+    static Chunk identify(const uint8_t* data, size_t size);
+
+    // Chunks of the whole file, also fed to digest when given. Nothing on a
+    // read error
+    static std::optional<std::vector<Chunk>>
+    chunkFile(const FileHandle& file, uint64_t file_size,
+              Digest* digest = nullptr);
+
+  private:
+    static constexpr size_t READ_SIZE = 4194304; // 4MB
+};
+
+#endif // CONTENT_CHUNKER_HPP
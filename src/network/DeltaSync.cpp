@@ -0,0 +1,245 @@
+#include "DeltaSync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+// rsync's weak checksum: a is the sum of the bytes and b the sum of the
+// running a values, both mod 2^16, so the window slides by a byte in O(1)
+class RollingChecksum
+{
+  public:
+    void reset(const uint8_t* data, size_t size)
+    {
+        a_ = 0;
+        b_ = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            a_ += data[i];
+            b_ += a_;
+        }
+    }
+
+    void roll(uint8_t out, uint8_t in, size_t size)
+    {
+        a_ += in - out;
+        b_ += a_ - static_cast<uint32_t>(size) * out;
+    }
+
+    uint32_t value() const { return (a_ & 0xffff) | (b_ << 16); }
+
+  private:
+    uint32_t a_ = 0;
+    uint32_t b_ = 0;
+};
+
+size_t filterIndex(uint32_t weak)
+{
+    return (weak ^ (weak >> 16)) & 0xffff;
+}
+
+} // namespace
+
+fs::path DeltaSync::basisPath(const fs::path& file_path)
+{
+    fs::path path = file_path;
+    path += BASIS_EXTENSION;
+    return path;
+}
+
+size_t DeltaSync::blockSize(uint64_t basis_size)
+{
+    size_t block_size =
+        static_cast<size_t>(std::sqrt(static_cast<double>(basis_size)));
+    block_size = (block_size + 1023) / 1024 * 1024;
+    return std::clamp(block_size, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+}
+
+std::optional<std::vector<DeltaSync::Signature>>
+DeltaSync::sign(const FileHandle& basis, uint64_t basis_size,
+                size_t block_size)
+{
+    std::vector<Signature> signatures;
+    signatures.reserve((basis_size + block_size - 1) / block_size);
+
+    std::vector<uint8_t> buffer(std::max<size_t>(1, READ_SIZE / block_size) *
+                                block_size);
+    for (uint64_t offset = 0; offset < basis_size; offset += buffer.size())
+    {
+        size_t size = std::min<uint64_t>(buffer.size(), basis_size - offset);
+        if (basis.readAt(offset, buffer.data(), size) !=
+            static_cast<int64_t>(size))
+        {
+            return std::nullopt;
+        }
+
+        for (size_t block = 0; block < size; block += block_size)
+        {
+            size_t         block_length = std::min(block_size, size - block);
+            RollingChecksum checksum;
+            checksum.reset(buffer.data() + block, block_length);
+            signatures.push_back(
+                {checksum.value(),
+                 strongHash(buffer.data() + block, block_length)});
+        }
+    }
+    return signatures;
+}
+
+std::optional<DeltaSync::Delta>
+DeltaSync::diff(const FileHandle& file, uint64_t file_size, size_t block_size,
+                uint64_t basis_size, const std::vector<Signature>& signatures,
+                HashAlgorithm algorithm)
+{
+    // Full blocks by weak checksum, the short last block can only match the
+    // end of the file. The 16-bit filter skips the lookup for most windows
+    size_t full_blocks = static_cast<size_t>(basis_size / block_size);
+    std::unordered_multimap<uint32_t, uint32_t> blocks;
+    std::vector<bool>                           filter(65536);
+    blocks.reserve(full_blocks);
+    for (size_t i = 0; i < full_blocks; ++i)
+    {
+        blocks.emplace(signatures[i].weak, static_cast<uint32_t>(i));
+        filter[filterIndex(signatures[i].weak)] = true;
+    }
+
+    Delta                   delta;
+    std::unique_ptr<Digest> digest = Digest::create(algorithm);
+    std::vector<uint8_t>    buffer;
+    uint64_t                buffer_offset = 0;
+    uint64_t                position = 0;
+
+    // Reads on until [position, end) is buffered, dropping what the window
+    // has passed. Every byte goes through the digest exactly once
+    auto readUntil = [&](uint64_t end) {
+        end = std::min(end, file_size);
+        while (buffer_offset + buffer.size() < end)
+        {
+            uint64_t buffer_end = buffer_offset + buffer.size();
+            size_t   consumed = static_cast<size_t>(
+                std::min(position, buffer_end) - buffer_offset);
+            buffer.erase(buffer.begin(), buffer.begin() + consumed);
+            buffer_offset += consumed;
+
+            size_t size = std::min<uint64_t>(READ_SIZE, file_size - buffer_end);
+            size_t used = buffer.size();
+            buffer.resize(used + size);
+            if (file.readAt(buffer_end, buffer.data() + used, size) !=
+                static_cast<int64_t>(size))
+            {
+                return false;
+            }
+            digest->update(buffer.data() + used, size);
+        }
+        return true;
+    };
+
+    auto addCopy = [&delta](uint64_t offset, uint64_t basis_offset,
+                            uint64_t size) {
+        delta.copied_bytes += size;
+        if (!delta.copies.empty())
+        {
+            Copy& last = delta.copies.back();
+            if (last.offset + last.size == offset &&
+                last.basis_offset + last.size == basis_offset)
+            {
+                last.size += size;
+                return;
+            }
+        }
+        delta.copies.push_back({offset, basis_offset, size});
+    };
+
+    RollingChecksum rolling;
+    bool            rolling_valid = false;
+    while (full_blocks > 0 && position + block_size <= file_size)
+    {
+        if (!readUntil(position + block_size + 1))
+        {
+            return std::nullopt;
+        }
+        const uint8_t* window = buffer.data() + (position - buffer_offset);
+        if (!rolling_valid)
+        {
+            rolling.reset(window, block_size);
+            rolling_valid = true;
+        }
+
+        uint32_t weak = rolling.value();
+        if (filter[filterIndex(weak)])
+        {
+            auto [begin, end] = blocks.equal_range(weak);
+            if (begin != end)
+            {
+                uint64_t strong = strongHash(window, block_size);
+                // Of identical blocks, the one continuing the last copy
+                // keeps the copy list short
+                uint64_t next_basis_offset =
+                    delta.copies.empty() ? 0
+                                         : delta.copies.back().basis_offset +
+                                               delta.copies.back().size;
+                std::optional<uint64_t> match;
+                for (auto it = begin; it != end; ++it)
+                {
+                    if (signatures[it->second].strong != strong)
+                    {
+                        continue;
+                    }
+                    uint64_t basis_offset =
+                        static_cast<uint64_t>(it->second) * block_size;
+                    if (!match || basis_offset == next_basis_offset)
+                    {
+                        match = basis_offset;
+                    }
+                }
+                if (match)
+                {
+                    addCopy(position, *match, block_size);
+                    position += block_size;
+                    rolling_valid = false;
+                    continue;
+                }
+            }
+        }
+
+        if (position + block_size < file_size)
+        {
+            rolling.roll(window[0], window[block_size], block_size);
+        }
+        ++position;
+    }
+
+    // What is left before the short last block is sent as is
+    uint64_t tail_size = basis_size % block_size;
+    bool     tail_fits = tail_size > 0 && file_size >= position + tail_size;
+    position = tail_fits ? file_size - tail_size : file_size;
+    if (!readUntil(file_size))
+    {
+        return std::nullopt;
+    }
+    if (tail_fits)
+    {
+        const uint8_t*  tail = buffer.data() + (position - buffer_offset);
+        RollingChecksum checksum;
+        checksum.reset(tail, tail_size);
+        const Signature& last = signatures.back();
+        if (checksum.value() == last.weak &&
+            strongHash(tail, tail_size) == last.strong)
+        {
+            addCopy(position, basis_size - tail_size, tail_size);
+        }
+    }
+
+    delta.file_hash = digest->digest();
+    return delta;
+}
+
+uint64_t DeltaSync::strongHash(const uint8_t* data, size_t size)
+{
+    return Digest::hashLeaf(HashAlgorithm::XXH64, data, size);
+}
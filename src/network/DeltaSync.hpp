@@ -0,0 +1,64 @@
+#ifndef DELTA_SYNC_HPP
+#define DELTA_SYNC_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Digest.hpp"
+#include "FileHandle.hpp"
+#include "Message/BlockSignatures.hpp"
+#include "Message/DeltaCopy.hpp"
+
+// rsync-style delta against an older copy of a file on the receiver. The
+// receiver signs fixed-size blocks of its copy, the sender slides a rolling
+// checksum over the new file and turns every window matching a block into a
+// copy. Only the ranges between copies travel as chunks
+class DeltaSync
+{
+  public:
+    using Signature = BlockSignatures::Signature;
+    using Copy = DeltaCopy::Copy;
+
+    // The older copy is moved here while the new file is written
+    static constexpr const char* BASIS_EXTENSION = ".qsbasis";
+    // Smaller files are cheaper to send whole than to sign
+    static constexpr uint64_t MIN_FILE_SIZE = 1048576;  // 1MB
+    static constexpr size_t   MIN_BLOCK_SIZE = 2048;    // 2KB
+    static constexpr size_t   MAX_BLOCK_SIZE = 131072;  // 128KB
+    // Bytes the receiver copies per disk job
+    static constexpr size_t   COPY_BATCH_SIZE = 4194304; // 4MB
+
+    struct Delta
+    {
+        std::vector<Copy> copies;
+        uint64_t          copied_bytes = 0;
+        // Digest of the whole new file, read in full to find the matches
+        std::string file_hash;
+    };
+
+    static std::filesystem::path
+    basisPath(const std::filesystem::path& file_path);
+
+    // About the square root of the size, as rsync picks it, so signatures
+    // and unmatched data grow alike
+    static size_t blockSize(uint64_t basis_size);
+
+    // Nothing on a read error
+    static std::optional<std::vector<Signature>>
+    sign(const FileHandle& basis, uint64_t basis_size, size_t block_size);
+
+    static std::optional<Delta>
+    diff(const FileHandle& file, uint64_t file_size, size_t block_size,
+         uint64_t basis_size, const std::vector<Signature>& signatures,
+         HashAlgorithm algorithm);
+
+  private:
+    static constexpr size_t READ_SIZE = 1048576; // 1MB
+
+    static uint64_t strongHash(const uint8_t* data, size_t size);
+};
+
+#endif // DELTA_SYNC_HPP
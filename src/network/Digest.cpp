@@ -0,0 +1,537 @@
+#include "Digest.hpp"
+
+#include <array>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+
+#include <boost/crc.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define QUICKSHARE_X86_64
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(QUICKSHARE_X86_64) && !defined(_MSC_VER)
+#define QUICKSHARE_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define QUICKSHARE_TARGET_SSE42
+#endif
+
+namespace
+{
+
+template <typename T>
+T loadLE(const uint8_t* data)
+{
+    if constexpr (std::endian::native == std::endian::little)
+    {
+        T value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    } else {
+        T value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i)
+        {
+            value |= static_cast<T>(data[i]) << (8 * i);
+        }
+        return value;
+    }
+}
+
+std::string toHex(uint64_t value, int digits)
+{
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%0*llx", digits,
+                  static_cast<unsigned long long>(value));
+    return buffer;
+}
+
+// ------------------------------- CRC32C --------------------------------
+
+constexpr uint32_t CRC32C_POLY = 0x82F63B78; // reflected Castagnoli
+
+using Crc32cTables = std::array<std::array<uint32_t, 256>, 8>;
+
+const Crc32cTables& crc32cTables()
+{
+    static const Crc32cTables tables = [] {
+        Crc32cTables t{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+            }
+            t[0][i] = crc;
+        }
+        for (size_t k = 1; k < t.size(); ++k)
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+            }
+        }
+        return t;
+    }();
+    return tables;
+}
+
+// Slicing-by-8 fallback for CPUs without SSE4.2
+uint32_t crc32cSoftware(uint32_t crc, const uint8_t* data, size_t size)
+{
+    const Crc32cTables& t = crc32cTables();
+    while (size >= 8)
+    {
+        uint64_t word = loadLE<uint64_t>(data) ^ crc;
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^
+              t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+              t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+              t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+        data += 8;
+        size -= 8;
+    }
+    while (size--)
+    {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef QUICKSHARE_X86_64
+QUICKSHARE_TARGET_SSE42
+uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (size--)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+bool cpuHasSse42()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+using Crc32cUpdate = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+Crc32cUpdate crc32cUpdate()
+{
+#ifdef QUICKSHARE_X86_64
+    static const Crc32cUpdate update =
+        cpuHasSse42() ? crc32cHardware : crc32cSoftware;
+    return update;
+#else
+    return crc32cSoftware;
+#endif
+}
+
+uint32_t computeCrc32c(const uint8_t* data, size_t size)
+{
+    return ~crc32cUpdate()(0xFFFFFFFF, data, size);
+}
+
+// CRC of A followed by B from crc(A), crc(B) and len(B), by applying
+// len(B) zero bytes to crc(A) as a GF(2) matrix power (as zlib does)
+uint32_t gf2MatrixTimes(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    while (vec)
+    {
+        if (vec & 1)
+        {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        ++mat;
+    }
+    return sum;
+}
+
+void gf2MatrixSquare(uint32_t* square, const uint32_t* mat)
+{
+    for (int n = 0; n < 32; ++n)
+    {
+        square[n] = gf2MatrixTimes(mat, mat[n]);
+    }
+}
+
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    if (len2 == 0)
+    {
+        return crc1;
+    }
+
+    uint32_t even[32];
+    uint32_t odd[32];
+    odd[0] = CRC32C_POLY;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; ++n)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2MatrixSquare(even, odd);
+    gf2MatrixSquare(odd, even);
+
+    do
+    {
+        gf2MatrixSquare(even, odd);
+        if (len2 & 1)
+        {
+            crc1 = gf2MatrixTimes(even, crc1);
+        }
+        len2 >>= 1;
+        if (len2 == 0)
+        {
+            break;
+        }
+        gf2MatrixSquare(odd, even);
+        if (len2 & 1)
+        {
+            crc1 = gf2MatrixTimes(odd, crc1);
+        }
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+// ------------------------------- xxHash64 ------------------------------
+
+constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+constexpr uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+constexpr uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+constexpr uint64_t xxhMergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= xxhRound(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+class Xxh64State
+{
+  public:
+    void update(const uint8_t* data, size_t size)
+    {
+        total_size_ += size;
+        if (buffered_ + size < STRIPE_SIZE)
+        {
+            std::memcpy(buffer_ + buffered_, data, size);
+            buffered_ += size;
+            return;
+        }
+
+        if (buffered_ > 0)
+        {
+            size_t fill = STRIPE_SIZE - buffered_;
+            std::memcpy(buffer_ + buffered_, data, fill);
+            consumeStripe(buffer_);
+            data += fill;
+            size -= fill;
+            buffered_ = 0;
+        }
+        while (size >= STRIPE_SIZE)
+        {
+            consumeStripe(data);
+            data += STRIPE_SIZE;
+            size -= STRIPE_SIZE;
+        }
+        std::memcpy(buffer_, data, size);
+        buffered_ = size;
+    }
+
+    uint64_t finish() const
+    {
+        uint64_t h;
+        if (total_size_ >= STRIPE_SIZE)
+        {
+            h = rotl64(v_[0], 1) + rotl64(v_[1], 7) + rotl64(v_[2], 12) +
+                rotl64(v_[3], 18);
+            for (uint64_t v : v_)
+            {
+                h = xxhMergeRound(h, v);
+            }
+        } else {
+            h = XXH_PRIME64_5;
+        }
+        h += total_size_;
+
+        const uint8_t* p = buffer_;
+        size_t         remaining = buffered_;
+        while (remaining >= 8)
+        {
+            h ^= xxhRound(0, loadLE<uint64_t>(p));
+            h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+            p += 8;
+            remaining -= 8;
+        }
+        if (remaining >= 4)
+        {
+            h ^= static_cast<uint64_t>(loadLE<uint32_t>(p)) * XXH_PRIME64_1;
+            h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+            p += 4;
+            remaining -= 4;
+        }
+        while (remaining--)
+        {
+            h ^= *p++ * XXH_PRIME64_5;
+            h = rotl64(h, 11) * XXH_PRIME64_1;
+        }
+
+        h ^= h >> 33;
+        h *= XXH_PRIME64_2;
+        h ^= h >> 29;
+        h *= XXH_PRIME64_3;
+        h ^= h >> 32;
+        return h;
+    }
+
+  private:
+    static constexpr size_t STRIPE_SIZE = 32;
+
+    void consumeStripe(const uint8_t* stripe)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            v_[lane] = xxhRound(v_[lane], loadLE<uint64_t>(stripe + 8 * lane));
+        }
+    }
+
+    uint64_t v_[4] = {XXH_PRIME64_1 + XXH_PRIME64_2, XXH_PRIME64_2, 0,
+                      0 - XXH_PRIME64_1};
+    uint8_t  buffer_[STRIPE_SIZE];
+    size_t   buffered_ = 0;
+    uint64_t total_size_ = 0;
+};
+
+uint64_t xxh64(const uint8_t* data, size_t size)
+{
+    Xxh64State state;
+    state.update(data, size);
+    return state.finish();
+}
+
+void updateWithLeaf(Xxh64State& root, uint64_t leaf_digest)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        bytes[i] = static_cast<uint8_t>(leaf_digest >> (8 * i));
+    }
+    root.update(bytes, sizeof(bytes));
+}
+
+// ---------------------------- Digest classes ---------------------------
+
+class Crc32Digest : public Digest
+{
+  public:
+    void update(const uint8_t* data, size_t size) override
+    {
+        crc_.process_bytes(data, size);
+    }
+
+    // Same format as before digests became selectable
+    std::string digest() const override
+    {
+        return std::to_string(crc_.checksum());
+    }
+
+  private:
+    boost::crc_32_type crc_;
+};
+
+class Crc32cDigest : public Digest
+{
+  public:
+    void update(const uint8_t* data, size_t size) override
+    {
+        crc_ = crc32cUpdate()(crc_, data, size);
+    }
+
+    std::string digest() const override { return toHex(~crc_, 8); }
+
+  private:
+    uint32_t crc_ = 0xFFFFFFFF;
+};
+
+class Xxh64Digest : public Digest
+{
+  public:
+    void update(const uint8_t* data, size_t size) override
+    {
+        state_.update(data, size);
+    }
+
+    std::string digest() const override { return toHex(state_.finish(), 16); }
+
+  private:
+    Xxh64State state_;
+};
+
+class Xxh64TreeDigest : public Digest
+{
+  public:
+    void update(const uint8_t* data, size_t size) override
+    {
+        while (size > 0)
+        {
+            size_t take = std::min(size, LEAF_SIZE - leaf_size_);
+            leaf_.update(data, take);
+            leaf_size_ += take;
+            data += take;
+            size -= take;
+
+            if (leaf_size_ == LEAF_SIZE)
+            {
+                updateWithLeaf(root_, leaf_.finish());
+                leaf_ = Xxh64State();
+                leaf_size_ = 0;
+            }
+        }
+    }
+
+    std::string digest() const override
+    {
+        Xxh64State root = root_;
+        if (leaf_size_ > 0)
+        {
+            updateWithLeaf(root, leaf_.finish());
+        }
+        return toHex(root.finish(), 16);
+    }
+
+  private:
+    Xxh64State root_;
+    Xxh64State leaf_;
+    size_t     leaf_size_ = 0;
+};
+
+} // namespace
+
+std::unique_ptr<Digest> Digest::create(HashAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+        case HashAlgorithm::CRC32: return std::make_unique<Crc32Digest>();
+        case HashAlgorithm::CRC32C: return std::make_unique<Crc32cDigest>();
+        case HashAlgorithm::XXH64: return std::make_unique<Xxh64Digest>();
+        case HashAlgorithm::XXH64_TREE:
+            return std::make_unique<Xxh64TreeDigest>();
+    }
+    return nullptr;
+}
+
+std::optional<HashAlgorithm> Digest::fromId(uint8_t id)
+{
+    if (id > static_cast<uint8_t>(HashAlgorithm::XXH64_TREE))
+    {
+        return std::nullopt;
+    }
+    return static_cast<HashAlgorithm>(id);
+}
+
+const char* Digest::name(HashAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+        case HashAlgorithm::CRC32: return "CRC32";
+        case HashAlgorithm::CRC32C: return "CRC32C";
+        case HashAlgorithm::XXH64: return "XXH64";
+        case HashAlgorithm::XXH64_TREE: return "XXH64-tree";
+    }
+    return "unknown";
+}
+
+bool Digest::isSplittable(HashAlgorithm algorithm)
+{
+    return algorithm == HashAlgorithm::CRC32C ||
+           algorithm == HashAlgorithm::XXH64_TREE;
+}
+
+uint64_t Digest::hashLeaf(HashAlgorithm algorithm, const uint8_t* data,
+                          size_t size)
+{
+    if (algorithm == HashAlgorithm::CRC32C)
+    {
+        return computeCrc32c(data, size);
+    }
+    return xxh64(data, size);
+}
+
+std::string Digest::combineLeaves(HashAlgorithm                algorithm,
+                                  const std::vector<uint64_t>& leaves,
+                                  uint64_t                     total_size)
+{
+    if (algorithm == HashAlgorithm::CRC32C)
+    {
+        uint32_t crc = 0;
+        uint64_t remaining = total_size;
+        for (uint64_t leaf : leaves)
+        {
+            uint64_t leaf_size = std::min<uint64_t>(remaining, LEAF_SIZE);
+            crc = crc32cCombine(crc, static_cast<uint32_t>(leaf), leaf_size);
+            remaining -= leaf_size;
+        }
+        return toHex(crc, 8);
+    }
+
+    Xxh64State root;
+    for (uint64_t leaf : leaves)
+    {
+        updateWithLeaf(root, leaf);
+    }
+    return toHex(root.finish(), 16);
+}
+
+uint32_t Digest::crc32c(const uint8_t* data, size_t size)
+{
+    return computeCrc32c(data, size);
+}
+
+bool Digest::hasHardwareCrc32c()
+{
+#ifdef QUICKSHARE_X86_64
+    return crc32cUpdate() == crc32cHardware;
+#else
+    return false;
+#endif
+}
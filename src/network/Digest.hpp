@@ -0,0 +1,53 @@
+#ifndef DIGEST_HPP
+#define DIGEST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Whole-file digest used to verify transfers. The sender picks one and
+// announces it in FileMetadata; the receiver hashes with the same one
+enum class HashAlgorithm : uint8_t {
+    CRC32,      // boost::crc_32_type, the original digest
+    CRC32C,     // Castagnoli, SSE4.2 instruction when the CPU has it
+    XXH64,      // xxHash64
+    XXH64_TREE, // xxHash64 of the xxHash64 digests of fixed-size leaves
+};
+
+// Incremental digest. Implementations are cheap to create, so callers keep
+// one per file being hashed
+class Digest
+{
+  public:
+    // Leaf size of splittable algorithms
+    static constexpr size_t LEAF_SIZE = 4194304; // 4MB
+
+    virtual ~Digest() = default;
+
+    static std::unique_ptr<Digest> create(HashAlgorithm algorithm);
+
+    static std::optional<HashAlgorithm> fromId(uint8_t id);
+    static const char*                  name(HashAlgorithm algorithm);
+
+    // Splittable digests can hash LEAF_SIZE leaves independently and fold
+    // the leaf results in order, giving the same digest as update()
+    static bool        isSplittable(HashAlgorithm algorithm);
+    static uint64_t    hashLeaf(HashAlgorithm algorithm, const uint8_t* data,
+                                size_t size);
+    static std::string combineLeaves(HashAlgorithm                algorithm,
+                                     const std::vector<uint64_t>& leaves,
+                                     uint64_t                     total_size);
+
+    // Standalone CRC32C, also used for the per-chunk frame checksums
+    static uint32_t crc32c(const uint8_t* data, size_t size);
+    // True when CRC32C runs on the SSE4.2 instruction
+    static bool     hasHardwareCrc32c();
+
+    virtual void        update(const uint8_t* data, size_t size) = 0;
+    virtual std::string digest() const = 0;
+};
+
+#endif // DIGEST_HPP
@@ -0,0 +1,83 @@
+#include "DiskIoExecutor.hpp"
+
+#include <algorithm>
+#include <exception>
+
+#include "Logger.hpp"
+
+DiskIoExecutor::DiskIoExecutor(size_t thread_count) : stopping_(false)
+{
+    thread_count = std::max<size_t>(thread_count, 1);
+    workers_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        workers_.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+DiskIoExecutor::~DiskIoExecutor()
+{
+    stop();
+}
+
+void DiskIoExecutor::submit(Job job)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_)
+    {
+        return;
+    }
+
+    jobs_.push_back(std::move(job));
+    not_empty_.notify_one();
+}
+
+void DiskIoExecutor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+        {
+            return;
+        }
+        stopping_ = true;
+        jobs_.clear();
+    }
+    not_empty_.notify_all();
+
+    for (auto& worker : workers_)
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+}
+
+void DiskIoExecutor::workerLoop()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock,
+                            [this]() { return stopping_ || !jobs_.empty(); });
+            if (stopping_)
+            {
+                return;
+            }
+
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        // A throwing job must not take the worker down with it
+        try
+        {
+            job();
+        } catch (const std::exception& e)
+        {
+            LOG_ERROR(QString("Disk job failed: %1").arg(e.what()));
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef DISK_IO_EXECUTOR_HPP
+#define DISK_IO_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker pool for blocking file I/O, so the network io_context threads
+// never wait on the disk. Jobs run in FIFO order on any worker. The queue
+// is unbounded: callers limit their own outstanding work, as FileTransfer
+// does with its in-flight window
+class DiskIoExecutor
+{
+  public:
+    using Job = std::function<void()>;
+
+    static constexpr size_t DEFAULT_THREAD_COUNT = 2;
+
+    explicit DiskIoExecutor(size_t thread_count = DEFAULT_THREAD_COUNT);
+    ~DiskIoExecutor();
+
+    DiskIoExecutor(const DiskIoExecutor&) = delete;
+    DiskIoExecutor& operator=(const DiskIoExecutor&) = delete;
+
+    // Never blocks, so it is safe to call from the network threads
+    void submit(Job job);
+    void stop();
+
+    size_t threadCount() const { return workers_.size(); }
+
+  private:
+    void workerLoop();
+
+    std::mutex               mutex_;
+    std::condition_variable  not_empty_;
+    std::deque<Job>          jobs_;
+    bool                     stopping_;
+    std::vector<std::thread> workers_;
+};
+
+#endif // DISK_IO_EXECUTOR_HPP
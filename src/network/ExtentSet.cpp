@@ -0,0 +1,56 @@
+#include "ExtentSet.hpp"
+
+#include <algorithm>
+
+void ExtentSet::add(uint64_t begin, uint64_t end)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    // Swallow every extent that overlaps or touches [begin, end)
+    auto it = extents_.upper_bound(begin);
+    if (it != extents_.begin() && std::prev(it)->second >= begin)
+    {
+        --it;
+    }
+    while (it != extents_.end() && it->first <= end)
+    {
+        begin = std::min(begin, it->first);
+        end = std::max(end, it->second);
+        covered_bytes_ -= it->second - it->first;
+        it = extents_.erase(it);
+    }
+
+    extents_.emplace(begin, end);
+    covered_bytes_ += end - begin;
+}
+
+void ExtentSet::clear()
+{
+    extents_.clear();
+    covered_bytes_ = 0;
+}
+
+uint64_t ExtentSet::coveredUntil(uint64_t offset) const
+{
+    auto it = extents_.upper_bound(offset);
+    if (it == extents_.begin())
+    {
+        return offset;
+    }
+    --it;
+    return it->second > offset ? it->second : offset;
+}
+
+uint64_t ExtentSet::nextExtentAfter(uint64_t offset) const
+{
+    auto it = extents_.upper_bound(offset);
+    return it != extents_.end() ? it->first : NO_OFFSET;
+}
+
+std::vector<ExtentSet::Extent> ExtentSet::extents() const
+{
+    return std::vector<Extent>(extents_.begin(), extents_.end());
+}
@@ -0,0 +1,38 @@
+#ifndef EXTENT_SET_HPP
+#define EXTENT_SET_HPP
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Set of disjoint half-open byte ranges [begin, end). Adjacent and
+// overlapping ranges are merged, so a file received in order is one extent
+// no matter how many chunks it took
+class ExtentSet
+{
+  public:
+    using Extent = std::pair<uint64_t, uint64_t>;
+
+    static constexpr uint64_t NO_OFFSET = std::numeric_limits<uint64_t>::max();
+
+    void add(uint64_t begin, uint64_t end);
+    void clear();
+
+    bool     empty() const { return extents_.empty(); }
+    uint64_t coveredBytes() const { return covered_bytes_; }
+
+    // End of the extent containing offset, or offset if it is not covered
+    uint64_t coveredUntil(uint64_t offset) const;
+    // Begin of the first extent starting after offset, or NO_OFFSET
+    uint64_t nextExtentAfter(uint64_t offset) const;
+
+    std::vector<Extent> extents() const;
+
+  private:
+    std::map<uint64_t, uint64_t> extents_; // begin -> end
+    uint64_t                     covered_bytes_ = 0;
+};
+
+#endif // EXTENT_SET_HPP
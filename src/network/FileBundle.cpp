@@ -0,0 +1,135 @@
+#include "FileBundle.hpp"
+
+#include <cstring>
+#include <system_error>
+
+#include "FileHandle.hpp"
+#include "FileSystemManager.hpp"
+#include "Logger.hpp"
+
+FileBundle::FileBundle(std::vector<Entry> entries) :
+    entries_(std::move(entries))
+{
+    for (const Entry& entry : entries_)
+    {
+        total_size_ += entry.size;
+    }
+    data_.resize(total_size_);
+}
+
+bool FileBundle::withinLimits(const std::vector<Entry>& entries)
+{
+    if (entries.size() > MAX_ENTRIES)
+    {
+        return false;
+    }
+    // Checked entry by entry, so the sum cannot wrap
+    uint64_t total_size = 0;
+    for (const Entry& entry : entries)
+    {
+        if (entry.size > MAX_BUNDLE_SIZE - total_size)
+        {
+            return false;
+        }
+        total_size += entry.size;
+    }
+    return true;
+}
+
+bool FileBundle::canAdd(uint64_t size) const
+{
+    if (entries_.empty())
+    {
+        return true;
+    }
+    return entries_.size() < MAX_ENTRIES &&
+           total_size_ + size <= MAX_BUNDLE_SIZE;
+}
+
+void FileBundle::addFile(const std::filesystem::path& source_path,
+                         std::string name, uint64_t size)
+{
+    entries_.push_back({std::move(name), size});
+    source_paths_.push_back(source_path);
+    total_size_ += size;
+}
+
+bool FileBundle::load()
+{
+    data_.resize(total_size_);
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < entries_.size(); ++i)
+    {
+        const Entry& entry = entries_[i];
+        if (entry.size > 0)
+        {
+            FileHandle file(source_paths_[i], FileHandle::Mode::Read);
+            if (!file.isOpen() ||
+                file.readAt(0, data_.data() + offset, entry.size) !=
+                    static_cast<int64_t>(entry.size))
+            {
+                LOG_ERROR(QString("Failed to read bundled file: %1")
+                              .arg(source_paths_[i].string().c_str()));
+                return false;
+            }
+        }
+        offset += entry.size;
+    }
+    return true;
+}
+
+bool FileBundle::write(uint64_t offset, const std::vector<uint8_t>& data)
+{
+    if (offset > data_.size() || data.size() > data_.size() - offset)
+    {
+        return false;
+    }
+    std::memcpy(data_.data() + offset, data.data(), data.size());
+    return true;
+}
+
+bool FileBundle::unpack(const std::filesystem::path& base_dir) const
+{
+    std::filesystem::path created_dir;
+    uint64_t              offset = 0;
+    for (const Entry& entry : entries_)
+    {
+        if (!FileSystemManager::isSafeRelativePath(entry.name))
+        {
+            LOG_ERROR(QString("Refusing bundled file outside the target "
+                              "directory: %1")
+                          .arg(entry.name.c_str()));
+            return false;
+        }
+
+        std::filesystem::path file_path = base_dir / entry.name;
+        // Entries come in directory order, so most share the last parent
+        std::filesystem::path dir = file_path.parent_path();
+        if (dir != created_dir)
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            if (ec)
+            {
+                LOG_ERROR(QString("Failed to create directory %1: %2")
+                              .arg(dir.string().c_str())
+                              .arg(ec.message().c_str()));
+                return false;
+            }
+            created_dir = dir;
+        }
+
+        FileHandle file(file_path, FileHandle::Mode::Create);
+        if (!file.isOpen() ||
+            file.writeAt(0, data_.data() + offset, entry.size) !=
+                static_cast<int64_t>(entry.size))
+        {
+            LOG_ERROR(QString("Failed to write bundled file: %1")
+                          .arg(file_path.string().c_str()));
+            return false;
+        }
+        offset += entry.size;
+    }
+    return true;
+}
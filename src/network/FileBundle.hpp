@@ -0,0 +1,57 @@
+#ifndef FILE_BUNDLE_HPP
+#define FILE_BUNDLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Message/FileMetadata.hpp"
+
+// Small files of a directory sent as one transfer, their contents back to
+// back in entry order. A bundle is held in memory on both sides, so a few
+// hundred files cost one metadata message and a handful of chunks instead
+// of a round trip each
+class FileBundle
+{
+  public:
+    using Entry = FileMetadata::BundleEntry;
+
+    // Files larger than this are sent as transfers of their own
+    static constexpr size_t MAX_FILE_SIZE = 1048576;   // 1MB
+    static constexpr size_t MAX_BUNDLE_SIZE = 8388608; // 8MB
+    static constexpr size_t MAX_ENTRIES = 4096;
+
+    FileBundle() = default;
+    // Receiving side, with room for the announced entries
+    explicit FileBundle(std::vector<Entry> entries);
+
+    // Whether announced entries stay within MAX_ENTRIES and MAX_BUNDLE_SIZE
+    static bool withinLimits(const std::vector<Entry>& entries);
+
+    // Sending side: files are collected until the bundle is full and read
+    // in one pass once it is scheduled
+    bool canAdd(uint64_t size) const;
+    void addFile(const std::filesystem::path& source_path, std::string name,
+                 uint64_t size);
+    // False if a source is missing or shrank since it was listed
+    bool load();
+
+    // Copies a received chunk into place, false if it does not fit
+    bool write(uint64_t offset, const std::vector<uint8_t>& data);
+    // Writes every entry below base_dir with one open and write each
+    bool unpack(const std::filesystem::path& base_dir) const;
+
+    const std::vector<Entry>&   entries() const { return entries_; }
+    const std::vector<uint8_t>& data() const { return data_; }
+    uint64_t                    totalSize() const { return total_size_; }
+
+  private:
+    std::vector<Entry>                 entries_;
+    std::vector<std::filesystem::path> source_paths_;
+    std::vector<uint8_t>               data_;
+    uint64_t                           total_size_ = 0;
+};
+
+#endif // FILE_BUNDLE_HPP
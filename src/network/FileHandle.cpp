@@ -0,0 +1,157 @@
+#include "FileHandle.hpp"
+
+#include <cerrno>
+#include <utility>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <mutex>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+#ifdef _WIN32
+// The CRT has no positional I/O, so seek and transfer under one lock
+std::mutex& windowsIoMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+int64_t positionalRead(int fd, uint64_t offset, void* buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(windowsIoMutex());
+    if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0)
+    {
+        return -1;
+    }
+    return _read(fd, buffer, static_cast<unsigned int>(size));
+}
+
+int64_t positionalWrite(int fd, uint64_t offset, const void* buffer,
+                        size_t size)
+{
+    std::lock_guard<std::mutex> lock(windowsIoMutex());
+    if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0)
+    {
+        return -1;
+    }
+    return _write(fd, buffer, static_cast<unsigned int>(size));
+}
+#else
+int64_t positionalRead(int fd, uint64_t offset, void* buffer, size_t size)
+{
+    return ::pread(fd, buffer, size, static_cast<off_t>(offset));
+}
+
+int64_t positionalWrite(int fd, uint64_t offset, const void* buffer,
+                        size_t size)
+{
+    return ::pwrite(fd, buffer, size, static_cast<off_t>(offset));
+}
+#endif
+
+} // namespace
+
+FileHandle::FileHandle(const std::filesystem::path& file_path, Mode mode)
+{
+#ifdef _WIN32
+    int flags = (mode == Mode::Read ? _O_RDONLY : _O_RDWR) | _O_BINARY;
+    if (mode == Mode::Create)
+    {
+        flags = _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY;
+    }
+    fd_ = _wopen(file_path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    int flags = (mode == Mode::Read ? O_RDONLY : O_RDWR) | O_CLOEXEC;
+    if (mode == Mode::Create)
+    {
+        flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    }
+    fd_ = ::open(file_path.c_str(), flags, 0644);
+#endif
+}
+
+FileHandle::~FileHandle()
+{
+    close();
+}
+
+FileHandle::FileHandle(FileHandle&& other) noexcept :
+    fd_(std::exchange(other.fd_, -1))
+{}
+
+FileHandle& FileHandle::operator=(FileHandle&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        fd_ = std::exchange(other.fd_, -1);
+    }
+    return *this;
+}
+
+void FileHandle::close()
+{
+    if (fd_ >= 0)
+    {
+#ifdef _WIN32
+        _close(fd_);
+#else
+        ::close(fd_);
+#endif
+        fd_ = -1;
+    }
+}
+
+int64_t FileHandle::readAt(uint64_t offset, void* buffer, size_t size) const
+{
+    auto*  out = static_cast<uint8_t*>(buffer);
+    size_t total = 0;
+    while (total < size)
+    {
+        int64_t n = positionalRead(fd_, offset + total, out + total,
+                                   size - total);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return static_cast<int64_t>(total);
+}
+
+int64_t FileHandle::writeAt(uint64_t offset, const void* buffer, size_t size)
+{
+    const auto* in = static_cast<const uint8_t*>(buffer);
+    size_t      total = 0;
+    while (total < size)
+    {
+        int64_t n = positionalWrite(fd_, offset + total, in + total,
+                                    size - total);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return static_cast<int64_t>(total);
+}
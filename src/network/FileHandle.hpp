@@ -0,0 +1,38 @@
+#ifndef FILE_HANDLE_HPP
+#define FILE_HANDLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Owning wrapper around a raw file descriptor with positional I/O, so a
+// transfer can keep its file open and read or write any offset without
+// seeking
+class FileHandle
+{
+  public:
+    // Create makes or truncates the file and opens it for writing
+    enum class Mode { Read, ReadWrite, Create };
+
+    FileHandle() = default;
+    FileHandle(const std::filesystem::path& file_path, Mode mode);
+    ~FileHandle();
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+    FileHandle(FileHandle&& other) noexcept;
+    FileHandle& operator=(FileHandle&& other) noexcept;
+
+    bool isOpen() const { return fd_ >= 0; }
+    void close();
+
+    // Both return the number of bytes transferred, or -1 on error. Short
+    // counts only happen at end of file
+    int64_t readAt(uint64_t offset, void* buffer, size_t size) const;
+    int64_t writeAt(uint64_t offset, const void* buffer, size_t size);
+
+  private:
+    int fd_ = -1;
+};
+
+#endif // FILE_HANDLE_HPP
@@ -0,0 +1,215 @@
+#include "FileHashCache.hpp"
+
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include "Logger.hpp"
+#include "Message/WireFormat.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr uint32_t INDEX_MAGIC = 0x32485351; // "QSH2"
+constexpr size_t   RECORD_KEY_SIZE = 33;
+constexpr size_t   MAX_HASH_SIZE = 255;
+
+} // namespace
+
+FileHashCache::FileHashCache(fs::path index_path) :
+    index_path_(std::move(index_path))
+{
+    load();
+}
+
+std::optional<std::string> FileHashCache::lookup(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto                        it = entries_.find(key);
+    if (it == entries_.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void FileHashCache::store(const fs::path& file_path, const Key& key,
+                          const std::string& hash)
+{
+    if (hash.empty() || hash.size() > MAX_HASH_SIZE)
+    {
+        return;
+    }
+    // Written to while it was being read, the hash matches neither version
+    std::optional<Key> current =
+        makeKey(file_path, static_cast<HashAlgorithm>(key.algorithm));
+    if (!current || *current != key)
+    {
+        LOG_WARNING(QString("Not caching the hash of changed file: %1")
+                        .arg(file_path.string().c_str()));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.insert_or_assign(key, hash);
+    appendRecord(key, hash);
+}
+
+size_t FileHashCache::KeyHash::operator()(const Key& key) const
+{
+    size_t seed = std::hash<uint64_t>{}(key.inode);
+    for (uint64_t value : {key.device, key.size,
+                           static_cast<uint64_t>(key.mtime_ns),
+                           static_cast<uint64_t>(key.algorithm)})
+    {
+        seed ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15ULL +
+                (seed << 6) + (seed >> 2);
+    }
+    return seed;
+}
+
+std::optional<FileHashCache::Key>
+FileHashCache::makeKey(const fs::path& file_path, HashAlgorithm algorithm)
+{
+    Key key;
+    key.algorithm = static_cast<uint8_t>(algorithm);
+#ifdef _WIN32
+    std::error_code ec;
+    key.size = fs::file_size(file_path, ec);
+    if (ec)
+    {
+        return std::nullopt;
+    }
+    auto mtime = fs::last_write_time(file_path, ec);
+    if (ec)
+    {
+        return std::nullopt;
+    }
+    key.mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       mtime.time_since_epoch())
+                       .count();
+    // No inode numbers here, the canonical path stands in for them
+    key.inode = std::hash<std::string>{}(
+        fs::weakly_canonical(file_path, ec).string());
+#else
+    struct stat st;
+    if (::stat(file_path.c_str(), &st) != 0)
+    {
+        return std::nullopt;
+    }
+    key.device = static_cast<uint64_t>(st.st_dev);
+    key.inode = static_cast<uint64_t>(st.st_ino);
+    key.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    key.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 +
+                   st.st_mtimespec.tv_nsec;
+#else
+    key.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                   st.st_mtim.tv_nsec;
+#endif
+#endif
+    return key;
+}
+
+void FileHashCache::load()
+{
+    size_t record_count = 0;
+    bool   valid_index = false;
+    {
+        std::ifstream file(index_path_, std::ios::binary);
+        uint8_t       magic[4];
+        valid_index =
+            file.read(reinterpret_cast<char*>(magic), sizeof(magic)) &&
+            wire::getLE<uint32_t>(magic) == INDEX_MAGIC;
+        if (valid_index)
+        {
+            uint8_t record[RECORD_KEY_SIZE + 1];
+            while (file.read(reinterpret_cast<char*>(record), sizeof(record)))
+            {
+                Key key;
+                key.device = wire::getLE<uint64_t>(record);
+                key.inode = wire::getLE<uint64_t>(record + 8);
+                key.size = wire::getLE<uint64_t>(record + 16);
+                key.mtime_ns =
+                    static_cast<int64_t>(wire::getLE<uint64_t>(record + 24));
+                key.algorithm = record[32];
+
+                std::string hash(record[RECORD_KEY_SIZE], '\0');
+                if (!file.read(hash.data(), hash.size()))
+                {
+                    break;
+                }
+                entries_.insert_or_assign(key, std::move(hash));
+                ++record_count;
+            }
+        }
+    }
+
+    // Rewrite the index when superseded records dominate it
+    if (!valid_index || record_count > 2 * entries_.size())
+    {
+        compact();
+    } else {
+        index_.open(index_path_, std::ios::binary | std::ios::app);
+    }
+
+    LOG_INFO(QString("Loaded %1 cached file hashes").arg(entries_.size()));
+}
+
+void FileHashCache::compact()
+{
+    fs::path tmp_path = index_path_;
+    tmp_path += ".tmp";
+
+    index_.close();
+    index_.open(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!index_)
+    {
+        LOG_WARNING(QString("Unable to write hash cache index: %1")
+                        .arg(tmp_path.string().c_str()));
+        return;
+    }
+
+    uint8_t magic[4];
+    wire::putLE<uint32_t>(magic, INDEX_MAGIC);
+    index_.write(reinterpret_cast<const char*>(magic), sizeof(magic));
+    for (const auto& [key, hash] : entries_)
+    {
+        appendRecord(key, hash);
+    }
+    index_.close();
+
+    std::error_code ec;
+    fs::rename(tmp_path, index_path_, ec);
+    if (ec)
+    {
+        LOG_WARNING(QString("Unable to replace hash cache index: %1")
+                        .arg(ec.message().c_str()));
+    }
+    index_.open(index_path_, std::ios::binary | std::ios::app);
+}
+
+void FileHashCache::appendRecord(const Key& key, const std::string& hash)
+{
+    if (!index_.is_open())
+    {
+        return;
+    }
+
+    std::vector<uint8_t> record(RECORD_KEY_SIZE + 1 + hash.size());
+    wire::putLE<uint64_t>(record.data(), key.device);
+    wire::putLE<uint64_t>(record.data() + 8, key.inode);
+    wire::putLE<uint64_t>(record.data() + 16, key.size);
+    wire::putLE<uint64_t>(record.data() + 24,
+                          static_cast<uint64_t>(key.mtime_ns));
+    record[32] = key.algorithm;
+    record[RECORD_KEY_SIZE] = static_cast<uint8_t>(hash.size());
+    std::copy(hash.begin(), hash.end(), record.begin() + RECORD_KEY_SIZE + 1);
+
+    index_.write(reinterpret_cast<const char*>(record.data()), record.size());
+    index_.flush();
+}
@@ -0,0 +1,60 @@
+#ifndef FILE_HASH_CACHE_HPP
+#define FILE_HASH_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "Digest.hpp"
+
+// Remembers file hashes keyed by (device, inode, size, mtime, algorithm), so
+// a file that has not changed is never hashed twice. Entries are appended to a
+// compact binary index that is reloaded on the next start. Safe to use from
+// several disk workers at once
+class FileHashCache
+{
+  public:
+    struct Key
+    {
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t  mtime_ns = 0;
+        uint8_t  algorithm = 0;
+
+        bool operator==(const Key& other) const = default;
+    };
+
+    explicit FileHashCache(std::filesystem::path index_path);
+
+    // The file as it is now. Taken when the file is opened, so a hash of
+    // what was read is never filed under a later version
+    static std::optional<Key> makeKey(const std::filesystem::path& file_path,
+                                      HashAlgorithm                algorithm);
+
+    std::optional<std::string> lookup(const Key& key);
+    // Skipped when the file no longer matches the key it was opened with
+    void store(const std::filesystem::path& file_path, const Key& key,
+               const std::string& hash);
+
+  private:
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    void load();
+    void compact();
+    void appendRecord(const Key& key, const std::string& hash);
+
+    std::filesystem::path                         index_path_;
+    std::mutex                                    mutex_;
+    std::unordered_map<Key, std::string, KeyHash> entries_;
+    std::ofstream                                 index_;
+};
+
+#endif // FILE_HASH_CACHE_HPP
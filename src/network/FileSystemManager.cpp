@@ -1,5 +1,7 @@
 #include "FileSystemManager.hpp"
 
+#include <chrono>
+
 namespace fs = std::filesystem;
 
 bool FileSystemManager::fileExists(const fs::path& file_path) const
@@ -17,8 +19,24 @@ std::uintmax_t FileSystemManager::getFileSize(const fs::path& file_path) const
     return fs::file_size(file_path);
 }
 
+uint64_t
+FileSystemManager::getModificationTime(const fs::path& file_path) const
+{
+    std::error_code ec;
+    auto            mtime = fs::last_write_time(file_path, ec);
+    if (ec)
+    {
+        return 0;
+    }
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            mtime.time_since_epoch())
+            .count());
+}
+
 std::string
-FileSystemManager::calculateFileHash(const fs::path& file_path) const
+FileSystemManager::calculateFileHash(const fs::path& file_path,
+                                     HashAlgorithm   algorithm) const
 {
     if (!fileExists(file_path))
     {
@@ -26,62 +44,80 @@ FileSystemManager::calculateFileHash(const fs::path& file_path) const
         return "";
     }
 
-    std::ifstream file(file_path, std::ios::binary);
+    auto file = openFile(file_path, FileHandle::Mode::Read);
     if (!file)
     {
-        LOG_ERROR(QString("Unable to open file: %1").arg(file_path.c_str()));
         return "";
     }
 
-    boost::crc_32_type result;
-    char               buffer[4096];
-    while (file)
+    uint64_t file_size = getFileSize(file_path);
+    if (Digest::isSplittable(algorithm) && file_size > Digest::LEAF_SIZE)
+    {
+        return calculateTreeHash(*file, file_size, algorithm);
+    }
+
+    std::unique_ptr<Digest> digest = Digest::create(algorithm);
+    std::vector<uint8_t>    buffer(HASH_BUFFER_SIZE);
+    uint64_t                offset = 0;
+    while (true)
     {
-        file.read(buffer, sizeof(buffer));
-        result.process_bytes(buffer, file.gcount());
+        int64_t bytes_read = file->readAt(offset, buffer.data(), buffer.size());
+        if (bytes_read < 0)
+        {
+            LOG_ERROR(QString("Error reading file for hashing: %1")
+                          .arg(file_path.c_str()));
+            return "";
+        }
+        if (bytes_read == 0)
+        {
+            break;
+        }
+        digest->update(buffer.data(), static_cast<size_t>(bytes_read));
+        offset += static_cast<uint64_t>(bytes_read);
     }
 
-    return std::to_string(result.checksum());
+    return digest->digest();
 }
 
-std::vector<uint8_t> FileSystemManager::readChunk(const fs::path& file_path,
-                                                  std::streampos  offset,
-                                                  std::streamsize size) const
+std::unique_ptr<FileHandle>
+FileSystemManager::openFile(const fs::path& file_path,
+                            FileHandle::Mode mode) const
 {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file)
+    auto file = std::make_unique<FileHandle>(file_path, mode);
+    if (!file->isOpen())
     {
         LOG_ERROR(QString("Unable to open file: %1").arg(file_path.c_str()));
-        return {};
+        return nullptr;
     }
+    return file;
+}
 
-    file.seekg(offset);
+std::vector<uint8_t> FileSystemManager::readChunk(const FileHandle& file,
+                                                  uint64_t          offset,
+                                                  size_t            size) const
+{
     std::vector<uint8_t> buffer(size);
-    file.read(reinterpret_cast<char*>(buffer.data()), size);
+    int64_t              bytes_read = file.readAt(offset, buffer.data(), size);
+    if (bytes_read < 0)
+    {
+        LOG_ERROR(QString("Error reading chunk at offset %1").arg(offset));
+        return {};
+    }
 
-    buffer.resize(file.gcount());
+    buffer.resize(static_cast<size_t>(bytes_read));
     return buffer;
 }
 
-void FileSystemManager::writeChunk(const fs::path&             file_path,
-                                   std::streampos              offset,
+bool FileSystemManager::writeChunk(FileHandle& file, uint64_t offset,
                                    const std::vector<uint8_t>& data)
 {
-    std::fstream file(file_path,
-                      std::ios::binary | std::ios::in | std::ios::out);
-    if (!file)
-    {
-        LOG_ERROR(QString("Unable to open file: %1").arg(file_path.c_str()));
-        return;
-    }
-
-    file.seekp(offset);
-    file.write(reinterpret_cast<const char*>(data.data()), data.size());
-
-    if (!file)
+    if (file.writeAt(offset, data.data(), data.size()) !=
+        static_cast<int64_t>(data.size()))
     {
-        LOG_ERROR(QString("Error writing to file: %1").arg(file_path.c_str()));
+        LOG_ERROR(QString("Error writing chunk at offset %1").arg(offset));
+        return false;
     }
+    return true;
 }
 
 void FileSystemManager::createFile(const fs::path& file_path,
@@ -94,8 +130,12 @@ void FileSystemManager::createFile(const fs::path& file_path,
         return;
     }
 
-    file.seekp(size - 1);
-    file.put(0);
+    // An empty file is complete once opened
+    if (size > 0)
+    {
+        file.seekp(size - 1);
+        file.put(0);
+    }
 
     if (!file)
     {
@@ -114,18 +154,52 @@ void FileSystemManager::deleteFile(const fs::path& file_path)
     }
 }
 
+std::string FileSystemManager::calculateTreeHash(const FileHandle& file,
+                                                 uint64_t          file_size,
+                                                 HashAlgorithm algorithm) const
+{
+    size_t leaf_count =
+        static_cast<size_t>((file_size + Digest::LEAF_SIZE - 1) /
+                            Digest::LEAF_SIZE);
+    // One leaf after another: this runs as a disk job, and threads of its
+    // own would compete with the disk workers for the same cores
+    std::vector<uint64_t> leaves(leaf_count);
+    std::vector<uint8_t>  buffer(Digest::LEAF_SIZE);
+    for (size_t leaf = 0; leaf < leaf_count; ++leaf)
+    {
+        uint64_t offset = static_cast<uint64_t>(leaf) * Digest::LEAF_SIZE;
+        size_t   size = static_cast<size_t>(
+            std::min<uint64_t>(Digest::LEAF_SIZE, file_size - offset));
+        if (file.readAt(offset, buffer.data(), size) !=
+            static_cast<int64_t>(size))
+        {
+            LOG_ERROR(
+                "Error reading file for hashing, it may have been truncated");
+            return "";
+        }
+        leaves[leaf] = Digest::hashLeaf(algorithm, buffer.data(), size);
+    }
+    return Digest::combineLeaves(algorithm, leaves, file_size);
+}
+
 std::string FileSystemManager::getFileName(const fs::path& file_path) const
 {
     return file_path.filename().string();
 }
 
-std::fstream FileSystemManager::openFile(const fs::path&         file_path,
-                                         std::ios_base::openmode mode) const
+bool FileSystemManager::isSafeRelativePath(const fs::path& path)
 {
-    std::fstream file(file_path, mode);
-    if (!file)
+    if (path.empty() || path.is_absolute() || path.has_root_name() ||
+        path.has_root_directory())
     {
-        LOG_ERROR(QString("Unable to open file: %1").arg(file_path.c_str()));
+        return false;
     }
-    return file;
+    for (const fs::path& part : path)
+    {
+        if (part == "..")
+        {
+            return false;
+        }
+    }
+    return true;
 }
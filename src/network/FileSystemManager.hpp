@@ -3,11 +3,12 @@
 
 #include <filesystem>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
-#include <boost/crc.hpp>
-
+#include "Digest.hpp"
+#include "FileHandle.hpp"
 #include "Logger.hpp"
 
 class FileSystemManager
@@ -23,13 +24,22 @@ class FileSystemManager
 
     bool           fileExists(const std::filesystem::path& file_path) const;
     std::uintmax_t getFileSize(const std::filesystem::path& file_path) const;
-    std::string calculateFileHash(const std::filesystem::path& file_path) const;
-
-    std::vector<uint8_t> readChunk(const std::filesystem::path& file_path,
-                                   std::streampos               offset,
-                                   std::streamsize              size) const;
-    void                 writeChunk(const std::filesystem::path& file_path,
-                                    std::streampos offset, const std::vector<uint8_t>& data);
+    // Last write time in nanoseconds, 0 if it cannot be read
+    uint64_t getModificationTime(const std::filesystem::path& file_path) const;
+    // Splittable algorithms hash files larger than one leaf as a tree of
+    // leaves, one leaf at a time
+    std::string calculateFileHash(const std::filesystem::path& file_path,
+                                  HashAlgorithm algorithm) const;
+
+    // Transfers keep the returned handle for their whole lifetime and do all
+    // chunk I/O through it
+    std::unique_ptr<FileHandle> openFile(const std::filesystem::path& file_path,
+                                         FileHandle::Mode mode) const;
+
+    std::vector<uint8_t> readChunk(const FileHandle& file, uint64_t offset,
+                                   size_t size) const;
+    bool                 writeChunk(FileHandle& file, uint64_t offset,
+                                    const std::vector<uint8_t>& data);
 
     void createFile(const std::filesystem::path& file_path,
                     std::uintmax_t               size);
@@ -37,9 +47,15 @@ class FileSystemManager
 
     std::string getFileName(const std::filesystem::path& file_path) const;
 
+    // True for a non-empty relative path without "..", so a name received
+    // from a peer cannot escape the download directory
+    static bool isSafeRelativePath(const std::filesystem::path& path);
+
   private:
-    std::fstream openFile(const std::filesystem::path& file_path,
-                          std::ios_base::openmode      mode) const;
+    static constexpr size_t HASH_BUFFER_SIZE = 1048576; // 1MB
+
+    std::string calculateTreeHash(const FileHandle& file, uint64_t file_size,
+                                  HashAlgorithm algorithm) const;
 };
 
 #endif // FILE_SYSTEM_MANAGER_HPP
@@ -1,325 +1,2320 @@
 #include "FileTransfer.hpp"
 
-FileTransfer::FileTransfer(std::shared_ptr<FileSystemManager> fs_manager) :
-    fs_manager_(std::move(fs_manager))
+FileTransfer::FileTransfer(std::shared_ptr<FileSystemManager> fs_manager,
+                           std::shared_ptr<DiskIoExecutor>    disk_executor,
+                           boost::asio::any_io_executor       network_executor) :
+    fs_manager_(std::move(fs_manager)),
+    disk_executor_(std::move(disk_executor)),
+    network_executor_(std::move(network_executor)),
+    compressor_(disk_executor_->threadCount()), max_in_flight_bytes_(0),
+    max_in_flight_chunks_(1), inline_threshold_(0), delta_transfers_(false),
+    content_chunking_(false), chunk_control_policy_(ChunkControlPolicy::BBR),
+    hash_algorithm_(HashAlgorithm::CRC32)
 {}
 
 void FileTransfer::startSending(const std::string& file_path,
                                 const std::string& peer_id)
 {
-    if (!fs_manager_->fileExists(file_path))
+    // The size only orders the queue, but stat still stays off the network
+    // thread. The sequence keeps submission order across disk workers
+    uint64_t sequence = next_request_sequence_++;
+    runOnDisk(
+        [this, file_path]() -> size_t {
+            return fs_manager_->fileExists(file_path)
+                       ? fs_manager_->getFileSize(file_path)
+                       : 0;
+        },
+        [this, file_path, peer_id, sequence](size_t file_size) {
+            scheduler_.enqueue(
+                {file_path, peer_id, file_size, sequence, "", nullptr});
+            send_batch_bytes_ += file_size;
+            dispatchQueuedTransfers();
+        });
+}
+
+void FileTransfer::startSendingDirectory(const std::string& dir_path,
+                                         const std::string& peer_id)
+{
+    struct DirectoryListing
+    {
+        std::vector<TransferScheduler::Request> files;
+        std::vector<std::shared_ptr<FileBundle>> bundles;
+    };
+
+    runOnDisk(
+        [dir_path, peer_id]() {
+            DirectoryListing listing;
+            std::filesystem::path root(dir_path);
+            // Everything lands below a directory of the same name
+            std::filesystem::path remote_root = root.filename();
+            if (remote_root.empty())
+            {
+                remote_root = root.parent_path().filename();
+            }
+
+            std::error_code ec;
+            std::filesystem::recursive_directory_iterator it(
+                root, std::filesystem::directory_options::skip_permission_denied,
+                ec);
+            if (ec)
+            {
+                LOG_ERROR(QString("Failed to list directory %1: %2")
+                              .arg(dir_path.c_str())
+                              .arg(ec.message().c_str()));
+                return listing;
+            }
+
+            auto bundle = std::make_shared<FileBundle>();
+            for (; it != std::filesystem::recursive_directory_iterator();
+                 it.increment(ec))
+            {
+                if (ec || !it->is_regular_file(ec))
+                {
+                    continue;
+                }
+                uint64_t file_size = it->file_size(ec);
+                if (ec)
+                {
+                    continue;
+                }
+                std::filesystem::path relative_path =
+                    std::filesystem::relative(it->path(), root, ec);
+
+                if (file_size > FileBundle::MAX_FILE_SIZE)
+                {
+                    TransferScheduler::Request file;
+                    file.file_path = it->path().string();
+                    file.peer_id = peer_id;
+                    file.file_size = file_size;
+                    file.remote_name =
+                        (remote_root / relative_path).generic_string();
+                    listing.files.push_back(std::move(file));
+                    continue;
+                }
+
+                if (!bundle->canAdd(file_size))
+                {
+                    listing.bundles.push_back(std::move(bundle));
+                    bundle = std::make_shared<FileBundle>();
+                }
+                bundle->addFile(it->path(), relative_path.generic_string(),
+                                file_size);
+            }
+            if (!bundle->entries().empty())
+            {
+                listing.bundles.push_back(std::move(bundle));
+            }
+
+            // Bundles carry the directory name, their entries are relative
+            for (auto& files : listing.bundles)
+            {
+                TransferScheduler::Request request;
+                request.file_path = dir_path;
+                request.peer_id = peer_id;
+                request.file_size = files->totalSize();
+                request.remote_name = remote_root.generic_string();
+                request.bundle = files;
+                listing.files.push_back(std::move(request));
+            }
+            return listing;
+        },
+        [this, dir_path](DirectoryListing listing) {
+            LOG_INFO(QString("Queued %1 transfers, %2 of them bundles, for "
+                             "directory: %3")
+                         .arg(listing.files.size())
+                         .arg(listing.bundles.size())
+                         .arg(dir_path.c_str()));
+            for (auto& request : listing.files)
+            {
+                request.sequence = next_request_sequence_++;
+                send_batch_bytes_ += request.file_size;
+                scheduler_.enqueue(std::move(request));
+            }
+            dispatchQueuedTransfers();
+        });
+}
+
+void FileTransfer::dispatchQueuedTransfers()
+{
+    while (std::optional<TransferScheduler::Request> request =
+               scheduler_.next())
+    {
+        beginSending(*request);
+    }
+}
+
+void FileTransfer::beginSending(const TransferScheduler::Request& request)
+{
+    const std::string& file_path = request.file_path;
+    const std::string& peer_id = request.peer_id;
+
+    struct PreparedFile
+    {
+        std::shared_ptr<FileHandle> file_handle;
+        std::shared_ptr<FileBundle> bundle;
+        std::string                 file_id;
+        size_t                      file_size = 0;
+        uint64_t                    file_version = 0;
+        std::string                 file_hash;
+        // The file as opened, for the hash cache
+        std::optional<FileHashCache::Key> hash_key;
+        // Contents sent within the metadata
+        std::optional<std::vector<uint8_t>> inline_data;
+        // Offered to the receiver's chunk store
+        std::vector<ContentChunker::Chunk> chunks;
+    };
+
+    HashAlgorithm algorithm = hash_algorithm_;
+    size_t        inline_threshold = inline_threshold_;
+    bool          content_chunking = content_chunking_;
+    runOnDisk(
+        [this, file_path, peer_id, algorithm, inline_threshold,
+         content_chunking, bundle = request.bundle,
+         sequence = request.sequence]() {
+            PreparedFile prepared;
+            if (bundle)
+            {
+                // Already in memory, so the digest goes in the metadata
+                if (!bundle->load())
+                {
+                    return prepared;
+                }
+                std::unique_ptr<Digest> digest = Digest::create(algorithm);
+                digest->update(bundle->data().data(), bundle->data().size());
+                prepared.file_hash = digest->digest();
+                prepared.file_size = bundle->totalSize();
+                prepared.file_id = generateFileId(
+                    prepared.file_hash + "-" + std::to_string(sequence),
+                    peer_id);
+                prepared.bundle = bundle;
+                if (prepared.file_size <= inline_threshold)
+                {
+                    prepared.inline_data = bundle->data();
+                }
+                return prepared;
+            }
+
+            if (!fs_manager_->fileExists(file_path))
+            {
+                LOG_ERROR(
+                    QString("File does not exist: %1").arg(file_path.c_str()));
+                return prepared;
+            }
+
+            prepared.file_handle =
+                fs_manager_->openFile(file_path, FileHandle::Mode::Read);
+            if (!prepared.file_handle)
+            {
+                return prepared;
+            }
+            if (hash_cache_)
+            {
+                prepared.hash_key =
+                    FileHashCache::makeKey(file_path, algorithm);
+            }
+
+            prepared.file_size = fs_manager_->getFileSize(file_path);
+            prepared.file_version = fs_manager_->getModificationTime(file_path);
+
+            // Small enough to read and hash right away and send whole
+            if (prepared.file_size <= inline_threshold)
+            {
+                std::vector<uint8_t> data = fs_manager_->readChunk(
+                    *prepared.file_handle, 0, prepared.file_size);
+                if (data.size() != prepared.file_size)
+                {
+                    LOG_ERROR(QString("Failed to read file: %1")
+                                  .arg(file_path.c_str()));
+                    prepared.file_handle.reset();
+                    return prepared;
+                }
+                std::unique_ptr<Digest> digest = Digest::create(algorithm);
+                digest->update(data.data(), data.size());
+                prepared.file_hash = digest->digest();
+                prepared.file_id = generateFileId(prepared.file_hash, peer_id);
+                prepared.inline_data = std::move(data);
+                return prepared;
+            }
+
+            // Without a cached digest the file is hashed while it streams
+            // and the digest follows in a TransferFinalize, so the first
+            // chunk never waits for a full pass over the file
+            std::optional<std::string> cached_hash;
+            if (prepared.hash_key)
+            {
+                cached_hash = hash_cache_->lookup(*prepared.hash_key);
+            }
+            if (cached_hash)
+            {
+                prepared.file_hash = std::move(*cached_hash);
+                prepared.file_id = generateFileId(prepared.file_hash, peer_id);
+            } else {
+                prepared.file_id = generateFileId(
+                    std::to_string(std::hash<std::string>{}(file_path)) + "-" +
+                        std::to_string(prepared.file_size),
+                    peer_id);
+            }
+
+            // Finding the chunks reads the whole file, so the digest comes
+            // from the same pass
+            if (content_chunking &&
+                prepared.file_size >= ContentChunker::MIN_FILE_SIZE)
+            {
+                std::unique_ptr<Digest> digest;
+                if (prepared.file_hash.empty())
+                {
+                    digest = Digest::create(algorithm);
+                }
+                std::optional<std::vector<ContentChunker::Chunk>> chunks =
+                    ContentChunker::chunkFile(*prepared.file_handle,
+                                              prepared.file_size,
+                                              digest.get());
+                if (chunks)
+                {
+                    prepared.chunks = std::move(*chunks);
+                    if (digest)
+                    {
+                        prepared.file_hash = digest->digest();
+                        if (prepared.hash_key)
+                        {
+                            hash_cache_->store(file_path, *prepared.hash_key,
+                                               prepared.file_hash);
+                        }
+                    }
+                }
+            }
+            return prepared;
+        },
+        [this, file_path, peer_id, algorithm, queued_size = request.file_size,
+         remote_name = request.remote_name,
+         disconnects = peerDisconnects(peer_id)](PreparedFile prepared) {
+            if ((!prepared.file_handle && !prepared.bundle) ||
+                peerDisconnects(peer_id) != disconnects)
+            {
+                scheduler_.finished(peer_id);
+                send_batch_done_bytes_ += queued_size;
+                dispatchQueuedTransfers();
+                return;
+            }
+
+            TransferInfo info{
+                file_path,
+                peer_id,
+                0,
+                prepared.file_size,
+                true,
+                false,
+                prepared.file_hash,
+                ChunkController::create(chunk_control_policy_,
+                                        MIN_CHUNK_SIZE, MAX_CHUNK_SIZE)};
+            info.hash_algorithm = algorithm;
+            info.file_id = prepared.file_id;
+            info.file_handle = std::move(prepared.file_handle);
+            info.bundle = prepared.bundle;
+            info.hash_key = prepared.hash_key;
+            info.streaming_hash = StreamingHash(algorithm);
+            if (link_estimates_)
+            {
+                if (std::optional<LinkEstimate> estimate =
+                        link_estimates_->lookup(peerHost(peer_id)))
+                {
+                    info.chunk_controller->warmStart(
+                        *estimate, std::chrono::steady_clock::now());
+                    size_t chunk_size =
+                        info.chunk_controller->currentChunkSize();
+                    LOG_INFO(QString("Starting transfer to %1 at %2KB chunks "
+                                     "from its last link estimate")
+                                 .arg(peer_id.c_str())
+                                 .arg(chunk_size / 1024));
+                }
+            }
+            // The receiver may hold an older copy worth diffing against,
+            // offered chunks take the older copy into account as well
+            bool offer_chunks = !prepared.chunks.empty();
+            bool offer_delta = delta_transfers_ && info.file_handle &&
+                               !prepared.inline_data && !offer_chunks &&
+                               prepared.file_size >= DeltaSync::MIN_FILE_SIZE;
+            info.awaiting_receiver = offer_delta || offer_chunks;
+            if (prepared.inline_data)
+            {
+                // Sent like one chunk covering the file, the receiver's ack
+                // for it completes the transfer
+                info.current_offset = prepared.file_size;
+                info.bytes_read = prepared.file_size;
+                info.unacked_chunks[0] = prepared.file_size;
+                info.bytes_in_flight = prepared.file_size;
+            }
+            TransferHandle handle = allocateTransfer(std::move(info));
+            // The file may have changed size since it was queued
+            send_batch_bytes_ += prepared.file_size;
+            send_batch_bytes_ -= std::min(send_batch_bytes_, queued_size);
+
+            FileMetadata metadata(prepared.file_id, handle,
+                                  remote_name.empty()
+                                      ? fs_manager_->getFileName(file_path)
+                                      : remote_name,
+                                  prepared.file_size, prepared.file_hash,
+                                  static_cast<uint8_t>(algorithm),
+                                  prepared.file_version);
+            if (prepared.bundle)
+            {
+                metadata.setBundleEntries(prepared.bundle->entries());
+            }
+            if (prepared.inline_data)
+            {
+                metadata.setInlineData(std::move(*prepared.inline_data));
+            }
+            metadata.setDeltaOffered(offer_delta);
+            metadata.setOfferedChunks(std::move(prepared.chunks));
+            if (file_metadata_callback_)
+            {
+                file_metadata_callback_(metadata, peer_id);
+            }
+
+            processNextChunk(handle);
+        });
+}
+
+void FileTransfer::startReceiving(const FileMetadata& metadata,
+                                  const std::string&  downloadPath,
+                                  const std::string&  peer_id,
+                                  uint32_t            connection_id)
+{
+    std::optional<HashAlgorithm> algorithm =
+        Digest::fromId(metadata.getHashAlgorithm());
+    if (!algorithm)
+    {
+        LOG_ERROR(QString("Unsupported hash algorithm %1 for file: %2")
+                      .arg(metadata.getHashAlgorithm())
+                      .arg(metadata.getFileName().c_str()));
+        return;
+    }
+
+    if (metadata.hasInlineData() &&
+        metadata.getInlineData().size() != metadata.getFileSize())
+    {
+        LOG_ERROR(QString("Inline data does not match the size of file: %1")
+                      .arg(metadata.getFileName().c_str()));
+        return;
+    }
+
+    uint64_t offered_bytes = 0;
+    for (const FileMetadata::ContentChunk& chunk : metadata.getOfferedChunks())
+    {
+        if (chunk.size == 0 || chunk.size > ContentChunker::MAX_SIZE)
+        {
+            offered_bytes = ExtentSet::NO_OFFSET;
+            break;
+        }
+        offered_bytes += chunk.size;
+    }
+    if (metadata.hasChunkOffer() && offered_bytes != metadata.getFileSize())
+    {
+        LOG_ERROR(QString("Offered chunks do not match the size of file: %1")
+                      .arg(metadata.getFileName().c_str()));
+        return;
+    }
+
+    // A bundle is held in memory whole, so its size must be bounded before
+    // anything is allocated for it
+    if (metadata.isBundle() &&
+        !FileBundle::withinLimits(metadata.getBundleEntries()))
+    {
+        LOG_ERROR(QString("Bundle exceeds %1 entries or %2 bytes: %3")
+                      .arg(FileBundle::MAX_ENTRIES)
+                      .arg(FileBundle::MAX_BUNDLE_SIZE)
+                      .arg(metadata.getFileName().c_str()));
+        return;
+    }
+
+    // Names may carry subdirectories of a directory transfer
+    if (!FileSystemManager::isSafeRelativePath(metadata.getFileName()))
+    {
+        LOG_ERROR(QString("Refusing file outside the download directory: %1")
+                      .arg(metadata.getFileName().c_str()));
+        return;
+    }
+
+    std::filesystem::path filePath = downloadPath;
+    // A bundle names the directory it unpacks into, a file may be headed
+    // for an existing directory of its name, which the disk side checks
+    bool into_directory = !filePath.empty() && !metadata.isBundle();
+    if (filePath.empty())
+    {
+        filePath = std::filesystem::current_path() / metadata.getFileName();
+    }
+
+    struct PreparedReceive
+    {
+        std::filesystem::path            file_path;
+        std::shared_ptr<TransferJournal> journal;
+        std::shared_ptr<FileHandle>      file_handle;
+        std::shared_ptr<FileBundle>      bundle;
+        std::shared_ptr<FileHandle>      basis_handle;
+        uint64_t                         basis_size = 0;
+        bool                             resuming = false;
+    };
+
+    // Chunks and the finalize may arrive before the file is ready, they
+    // wait in pending_receives_ until then
+    uint64_t route = makeInboundRoute(connection_id,
+                                      metadata.getTransferHandle());
+    if (pending_receives_.count(route))
+    {
+        LOG_WARNING(QString("Ignoring repeated metadata for file ID: %1")
+                        .arg(metadata.getFileId().c_str()));
+        return;
+    }
+    pending_receives_[route];
+    runOnDisk(
+        [this, metadata, filePath,
+         into_directory]() mutable -> std::optional<PreparedReceive> {
+            std::error_code ec;
+            if (into_directory && std::filesystem::is_directory(filePath, ec))
+            {
+                filePath /= metadata.getFileName();
+            }
+            std::filesystem::path dir = filePath.parent_path();
+            std::filesystem::create_directories(dir, ec);
+
+            PreparedReceive prepared;
+            prepared.file_path = filePath;
+            if (metadata.isBundle())
+            {
+                // Kept in memory and unpacked once the digest matches
+                prepared.bundle =
+                    std::make_shared<FileBundle>(metadata.getBundleEntries());
+                if (prepared.bundle->totalSize() != metadata.getFileSize())
+                {
+                    LOG_ERROR(
+                        QString("Bundle size does not match its entries: %1")
+                            .arg(metadata.getFileName().c_str()));
+                    return std::nullopt;
+                }
+                return prepared;
+            }
+
+            // Inline files arrive whole, there is nothing to resume
+            if (!metadata.hasInlineData())
+            {
+                prepared.journal =
+                    TransferJournal::open(filePath, metadata.getFileSize(),
+                                          metadata.getFileVersion());
+            }
+            prepared.resuming =
+                prepared.journal &&
+                !prepared.journal->recoveredExtents().empty();
+
+            // An existing file of that name becomes the basis of a delta.
+            // One left by an interrupted attempt is still the older copy
+            std::filesystem::path basis_path = DeltaSync::basisPath(filePath);
+            bool has_basis = std::filesystem::is_regular_file(basis_path, ec);
+            if (!has_basis && !prepared.resuming &&
+                (metadata.isDeltaOffered() || metadata.hasChunkOffer()) &&
+                std::filesystem::is_regular_file(filePath, ec) &&
+                std::filesystem::file_size(filePath, ec) > 0 && !ec)
+            {
+                std::filesystem::rename(filePath, basis_path, ec);
+                has_basis = !ec;
+            }
+            if (has_basis)
+            {
+                prepared.basis_handle =
+                    fs_manager_->openFile(basis_path, FileHandle::Mode::Read);
+                prepared.basis_size = fs_manager_->getFileSize(basis_path);
+            }
+
+            if (!prepared.resuming)
+            {
+                fs_manager_->createFile(filePath, metadata.getFileSize());
+            }
+
+            prepared.file_handle =
+                fs_manager_->openFile(filePath, FileHandle::Mode::ReadWrite);
+            if (!prepared.file_handle)
+            {
+                return std::nullopt;
+            }
+            return prepared;
+        },
+        [this, metadata, peer_id, route, algorithm,
+         disconnects = peerDisconnects(peer_id)](
+            std::optional<PreparedReceive> prepared) {
+            auto pending_it = pending_receives_.find(route);
+            std::vector<std::function<void()>> deferred =
+                std::move(pending_it->second);
+            pending_receives_.erase(pending_it);
+            // The journal stays for when the peer comes back
+            if (!prepared || peerDisconnects(peer_id) != disconnects)
+            {
+                return;
+            }
+            const std::filesystem::path& filePath = prepared->file_path;
+
+            // A transfer of the same file left over from a dropped
+            // connection would otherwise keep writing next to the new one
+            TransferHandle stale_handle =
+                findReceivingTransfer(filePath.string());
+            if (stale_handle != INVALID_TRANSFER_HANDLE && !metadata.isBundle())
+            {
+                LOG_WARNING(QString("Dropping stale transfer of file: %1")
+                                .arg(filePath.string().c_str()));
+                releaseTransfer(stale_handle);
+            }
+
+            TransferInfo info{
+                filePath.string(),
+                peer_id,
+                0,
+                metadata.getFileSize(),
+                false,
+                false,
+                metadata.getFileHash(),
+                ChunkController::create(chunk_control_policy_,
+                                        MIN_CHUNK_SIZE, MAX_CHUNK_SIZE)};
+            info.hash_algorithm = *algorithm;
+            info.file_id = metadata.getFileId();
+            info.file_handle = std::move(prepared->file_handle);
+            info.bundle = std::move(prepared->bundle);
+            info.streaming_hash = StreamingHash(*algorithm);
+            info.inbound_route = route;
+            info.remote_handle = metadata.getTransferHandle();
+            info.journal = prepared->journal;
+            info.basis_handle = std::move(prepared->basis_handle);
+            info.basis_size = prepared->basis_size;
+            info.content_chunks = metadata.getOfferedChunks();
+            std::shared_ptr<TransferJournal> journal = prepared->journal;
+            bool                             resuming = prepared->resuming;
+            if (resuming)
+            {
+                info.received_extents = journal->recoveredExtents();
+                // Bytes from the previous run never reach the streaming
+                // digest, the file is hashed from disk once complete
+                info.streaming_hash.invalidate();
+            }
+
+            auto route_it = inbound_routes_.find(route);
+            if (route_it != inbound_routes_.end())
+            {
+                LOG_WARNING(
+                    QString("Replacing incoming transfer for file ID: %1")
+                        .arg(metadata.getFileId().c_str()));
+                releaseTransfer(route_it->second);
+            }
+
+            TransferHandle handle = allocateTransfer(std::move(info));
+            inbound_routes_[route] = handle;
+            receive_batch_bytes_ += metadata.getFileSize();
+            ++receiving_transfers_;
+
+            LOG_INFO(QString("Started receiving file: %1, size: %2 bytes, "
+                             "to path: %3")
+                         .arg(metadata.getFileName().c_str())
+                         .arg(metadata.getFileSize())
+                         .arg(filePath.string().c_str()));
+
+            if (metadata.hasInlineData())
+            {
+                writeReceivedData(handle, 0,
+                                  std::make_shared<const std::vector<uint8_t>>(
+                                      metadata.getInlineData()),
+                                  {0, std::chrono::steady_clock::now()});
+            } else if (resuming)
+            {
+                LOG_INFO(
+                    QString("Resuming file %1 with %2 bytes already on disk")
+                        .arg(filePath.string().c_str())
+                        .arg(journal->recoveredExtents().coveredBytes()));
+                if (transfer_resume_callback_)
+                {
+                    transfer_resume_callback_(
+                        TransferResume(metadata.getTransferHandle(),
+                                       journal->recoveredExtents().extents()),
+                        peer_id);
+                }
+                checkTransferCompletion(handle);
+            } else if (metadata.hasChunkOffer())
+            {
+                copyStoredChunks(handle);
+            } else if (metadata.isDeltaOffered())
+            {
+                if (findTransfer(handle)->basis_handle)
+                {
+                    signBasis(handle);
+                } else if (transfer_resume_callback_)
+                {
+                    // Nothing to diff against, the sender starts from scratch
+                    transfer_resume_callback_(
+                        TransferResume(metadata.getTransferHandle(), {}),
+                        peer_id);
+                }
+            }
+
+            for (auto& message : deferred)
+            {
+                message();
+            }
+        });
+}
+
+void FileTransfer::handleIncomingChunk(const ChunkMessage& chunk_msg,
+                                       const std::string&  peer_id,
+                                       uint32_t            connection_id)
+{
+    ChunkArrival arrival{chunk_msg.getSendTime(),
+                         std::chrono::steady_clock::now()};
+
+    uint64_t route =
+        makeInboundRoute(connection_id, chunk_msg.getTransferHandle());
+    auto pending_it = pending_receives_.find(route);
+    if (pending_it != pending_receives_.end())
+    {
+        pending_it->second.push_back(
+            [this, chunk_msg, peer_id, connection_id]() {
+                handleIncomingChunk(chunk_msg, peer_id, connection_id);
+            });
+        return;
+    }
+
+    auto route_it = inbound_routes_.find(route);
+    if (route_it == inbound_routes_.end())
+    {
+        LOG_ERROR(QString("No active transfer for handle: %1")
+                      .arg(chunk_msg.getTransferHandle()));
+        return;
+    }
+
+    TransferHandle handle = route_it->second;
+    TransferInfo*  info = findPeerTransfer(handle, peer_id);
+    if (!info || info->is_sending)
+    {
+        LOG_ERROR(QString("Received chunk for a file being sent: %1")
+                      .arg(chunk_msg.getTransferHandle()));
+        return;
+    }
+
+    size_t offset = chunk_msg.getOffset();
+    size_t                      size = chunk_msg.getDataSize();
+    const std::vector<uint8_t>& wire_data = chunk_msg.getData();
+    if (size == 0 || offset > info->file_size ||
+        size > info->file_size - offset)
+    {
+        LOG_ERROR(QString("Chunk at offset %1 is out of range for file: %2")
+                      .arg(offset)
+                      .arg(info->file_path.c_str()));
+        finishTransfer(handle, TransferOutcome::FAILED);
+        return;
+    }
+    if (chunk_msg.hasChecksum() &&
+        Digest::crc32c(wire_data.data(), wire_data.size()) !=
+            chunk_msg.getChecksum())
+    {
+        LOG_WARNING(QString("Checksum mismatch for chunk at offset %1 of file "
+                            "%2, requesting it again")
+                        .arg(offset)
+                        .arg(info->file_path.c_str()));
+        if (chunk_retransmit_callback_)
+        {
+            chunk_retransmit_callback_(
+                ChunkRetransmitRequest(info->remote_handle, offset, size),
+                info->peer_id);
+        }
+        return;
+    }
+
+    if (!chunk_msg.isCompressed())
+    {
+        writeReceivedData(handle, offset, chunk_msg.getPayload(), arrival);
+        return;
+    }
+    if (size > MAX_CHUNK_SIZE)
+    {
+        LOG_ERROR(QString("Compressed chunk at offset %1 of file %2 is too "
+                          "large: %3")
+                      .arg(offset)
+                      .arg(info->file_path.c_str())
+                      .arg(size));
+        finishTransfer(handle, TransferOutcome::FAILED);
+        return;
+    }
+
+    runOnDisk(
+        [payload = chunk_msg.getPayload(), size]() {
+            return ChunkCompressor::decompress(*payload, size);
+        },
+        [this, handle, offset, size,
+         arrival](std::optional<std::vector<uint8_t>> data) {
+            TransferInfo* info = findTransfer(handle);
+            if (!info)
+            {
+                return;
+            }
+            if (!data)
+            {
+                LOG_WARNING(QString("Unable to decompress chunk at offset %1 "
+                                    "of file %2, requesting it again")
+                                .arg(offset)
+                                .arg(info->file_path.c_str()));
+                if (chunk_retransmit_callback_)
+                {
+                    chunk_retransmit_callback_(
+                        ChunkRetransmitRequest(info->remote_handle, offset,
+                                               size),
+                        info->peer_id);
+                }
+                return;
+            }
+            writeReceivedData(handle, offset,
+                              std::make_shared<const std::vector<uint8_t>>(
+                                  std::move(*data)),
+                              arrival);
+        });
+}
+
+void FileTransfer::writeReceivedData(TransferHandle        handle,
+                                     size_t                offset,
+                                     ChunkMessage::Payload payload,
+                                     ChunkArrival          arrival)
+{
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
+    {
+        return;
+    }
+
+    size_t size = payload->size();
+    info->streaming_hash.update(offset, payload);
+
+    runOnDisk(
+        [this, file_handle = info->file_handle, bundle = info->bundle,
+         journal = info->journal, offset, payload]() {
+            if (bundle)
+            {
+                return bundle->write(offset, *payload);
+            }
+            bool written =
+                fs_manager_->writeChunk(*file_handle, offset, *payload);
+            if (written && journal)
+            {
+                journal->record(offset, payload->size());
+            }
+            return written;
+        },
+        [this, handle, offset, size, arrival](bool written) {
+            handleChunkWritten(handle, offset, size, written, arrival);
+        });
+}
+
+void FileTransfer::handleChunkMetrics(TransferHandle            handle,
+                                      size_t                    chunk_number,
+                                      size_t                    chunk_size,
+                                      std::chrono::microseconds rtt,
+                                      const std::string&        peer_id)
+{
+    TransferInfo* info = findPeerTransfer(handle, peer_id);
+    if (!info || !info->is_sending)
+    {
+        return;
+    }
+
+    auto unacked_it = info->unacked_chunks.find(chunk_number);
+    if (unacked_it == info->unacked_chunks.end())
+    {
+        LOG_WARNING(QString("Unexpected ack for offset %1 of file ID: %2")
+                        .arg(chunk_number)
+                        .arg(info->file_id.c_str()));
+        return;
+    }
+
+    info->receiver_ready = true;
+    info->bytes_in_flight -= unacked_it->second;
+    auto wire_it = info->wire_sizes.find(chunk_number);
+    if (wire_it != info->wire_sizes.end())
+    {
+        recordAckedWireBytes(wire_it->second);
+        info->wire_sizes.erase(wire_it);
+    }
+    info->unacked_chunks.erase(unacked_it);
+    info->retransmissions.erase(chunk_number);
+    info->chunk_controller->onChunkAcked(chunk_number, chunk_size, rtt,
+                                         std::chrono::steady_clock::now());
+    // Shared with the other transfers to the peer as it improves
+    if (link_estimates_)
+    {
+        if (std::optional<LinkEstimate> estimate =
+                info->chunk_controller->linkEstimate())
+        {
+            link_estimates_->update(peerHost(info->peer_id), *estimate);
+        }
+    }
+    processNextChunk(handle);
+}
+
+void FileTransfer::handleTransferFinalize(const TransferFinalize& finalize,
+                                          const std::string&      peer_id,
+                                          uint32_t connection_id)
+{
+    uint64_t route =
+        makeInboundRoute(connection_id, finalize.getTransferHandle());
+    auto pending_it = pending_receives_.find(route);
+    if (pending_it != pending_receives_.end())
+    {
+        pending_it->second.push_back(
+            [this, finalize, peer_id, connection_id]() {
+                handleTransferFinalize(finalize, peer_id, connection_id);
+            });
+        return;
+    }
+
+    auto route_it = inbound_routes_.find(route);
+    if (route_it == inbound_routes_.end())
+    {
+        LOG_ERROR(QString("No active transfer to finalize for handle: %1")
+                      .arg(finalize.getTransferHandle()));
+        return;
+    }
+
+    TransferHandle handle = route_it->second;
+    TransferInfo*  info = findPeerTransfer(handle, peer_id);
+    if (!info || !info->expected_hash.empty())
+    {
+        LOG_WARNING(QString("Ignoring unexpected finalize for handle: %1")
+                        .arg(finalize.getTransferHandle()));
+        return;
+    }
+
+    info->expected_hash = finalize.getFileHash();
+    checkTransferCompletion(handle);
+}
+
+void FileTransfer::handleChunkRetransmitRequest(TransferHandle     handle,
+                                                size_t             offset,
+                                                size_t             chunk_size,
+                                                const std::string& peer_id)
+{
+    TransferInfo* info = findPeerTransfer(handle, peer_id);
+    if (!info || !info->is_sending)
+    {
+        return;
+    }
+
+    auto unacked_it = info->unacked_chunks.find(offset);
+    if (unacked_it == info->unacked_chunks.end() ||
+        unacked_it->second != chunk_size)
+    {
+        LOG_WARNING(QString("Unexpected retransmit request for offset %1 of "
+                            "file ID: %2")
+                        .arg(offset)
+                        .arg(info->file_id.c_str()));
+        return;
+    }
+
+    if (++info->retransmissions[offset] > MAX_CHUNK_RETRANSMISSIONS)
+    {
+        LOG_ERROR(QString("Chunk at offset %1 of file %2 failed its checksum "
+                          "too many times")
+                      .arg(offset)
+                      .arg(info->file_path.c_str()));
+        finishTransfer(handle, TransferOutcome::FAILED);
+        return;
+    }
+
+    LOG_INFO(QString("Retransmitting chunk at offset %1 of file ID: %2")
+                 .arg(offset)
+                 .arg(info->file_id.c_str()));
+    runOnDisk(
+        [this, file_handle = info->file_handle, bundle = info->bundle, offset,
+         chunk_size, level = compressor_.chooseLevel()]() {
+            ChunkData chunk =
+                bundle ? readChunk(*bundle, offset, chunk_size)
+                       : readChunk(*file_handle, offset, chunk_size);
+            compressChunk(chunk, level);
+            return chunk;
+        },
+        [this, handle, offset, chunk_size](ChunkData chunk) {
+            sendChunk(handle, offset, chunk_size, std::move(chunk), true);
+        });
+}
+
+void FileTransfer::handleTransferResume(
+    TransferHandle handle, const std::vector<ExtentSet::Extent>& extents,
+    const std::string& peer_id)
+{
+    TransferInfo* info = findPeerTransfer(handle, peer_id);
+    if (!info || !info->is_sending)
+    {
+        return;
+    }
+
+    info->receiver_ready = true;
+    info->awaiting_receiver = false;
+    for (const auto& [begin, end] : extents)
+    {
+        info->skipped_extents.add(begin,
+                                  std::min<uint64_t>(end, info->file_size));
+    }
+    // Skipped ranges are never read, so the digest has to come from disk
+    if (info->expected_hash.empty() && !extents.empty())
+    {
+        info->streaming_hash.invalidate();
+    }
+
+    LOG_INFO(QString("Peer already has %1 bytes of file ID: %2")
+                 .arg(info->skipped_extents.coveredBytes())
+                 .arg(info->file_id.c_str()));
+    processNextChunk(handle);
+}
+
+void FileTransfer::handleBlockSignatures(const BlockSignatures& signatures,
+                                         const std::string&     peer_id)
+{
+    TransferHandle handle = signatures.getTransferHandle();
+    TransferInfo*  info = findPeerTransfer(handle, peer_id);
+    if (!info || !info->is_sending || !info->awaiting_receiver)
+    {
+        return;
+    }
+
+    size_t   block_size = signatures.getBlockSize();
+    uint64_t basis_size = signatures.getBasisSize();
+    if (block_size < DeltaSync::MIN_BLOCK_SIZE ||
+        block_size > DeltaSync::MAX_BLOCK_SIZE ||
+        signatures.getSignatures().size() !=
+            (basis_size + block_size - 1) / block_size)
+    {
+        LOG_ERROR(QString("Invalid block signatures for file ID: %1")
+                      .arg(info->file_id.c_str()));
+        info->awaiting_receiver = false;
+        processNextChunk(handle);
+        return;
+    }
+
+    info->receiver_ready = true;
+    runOnDisk(
+        [file_handle = info->file_handle, file_size = info->file_size,
+         algorithm = info->hash_algorithm, block_size, basis_size,
+         signatures]() {
+            return DeltaSync::diff(*file_handle, file_size, block_size,
+                                   basis_size, signatures.getSignatures(),
+                                   algorithm);
+        },
+        [this, handle](std::optional<DeltaSync::Delta> delta) {
+            applyDelta(handle, std::move(delta));
+        });
+}
+
+void FileTransfer::handleDeltaCopy(const DeltaCopy&   delta_copy,
+                                   const std::string& peer_id,
+                                   uint32_t           connection_id)
+{
+    auto route_it = inbound_routes_.find(
+        makeInboundRoute(connection_id, delta_copy.getTransferHandle()));
+    if (route_it == inbound_routes_.end())
+    {
+        LOG_ERROR(QString("No active transfer to copy blocks for handle: %1")
+                      .arg(delta_copy.getTransferHandle()));
+        return;
+    }
+
+    TransferHandle handle = route_it->second;
+    TransferInfo*  info = findPeerTransfer(handle, peer_id);
+    if (!info || !info->basis_handle)
+    {
+        LOG_WARNING(QString("Ignoring block copies without a basis for "
+                            "handle: %1")
+                        .arg(delta_copy.getTransferHandle()));
+        return;
+    }
+
+    for (const DeltaCopy::Copy& copy : delta_copy.getCopies())
+    {
+        if (copy.size == 0 || copy.offset > info->file_size ||
+            copy.size > info->file_size - copy.offset ||
+            copy.basis_offset > info->basis_size ||
+            copy.size > info->basis_size - copy.basis_offset)
+        {
+            LOG_ERROR(QString("Block copy out of range for file: %1")
+                          .arg(info->file_path.c_str()));
+            finishTransfer(handle, TransferOutcome::FAILED);
+            return;
+        }
+        info->pending_copies.push_back(copy);
+    }
+    copyBasisBlocks(handle);
+}
+
+void FileTransfer::handleTransferAbort(const TransferAbort& abort,
+                                       const std::string&   peer_id,
+                                       uint32_t             connection_id)
+{
+    TransferHandle handle = abort.getTransferHandle();
+    if (abort.isFromSender())
+    {
+        uint64_t route = makeInboundRoute(connection_id, handle);
+        auto     pending_it = pending_receives_.find(route);
+        if (pending_it != pending_receives_.end())
+        {
+            pending_it->second.push_back(
+                [this, abort, peer_id, connection_id]() {
+                    handleTransferAbort(abort, peer_id, connection_id);
+                });
+            return;
+        }
+
+        auto route_it = inbound_routes_.find(route);
+        handle = route_it != inbound_routes_.end() ? route_it->second
+                                                   : INVALID_TRANSFER_HANDLE;
+    }
+
+    TransferInfo* info = findPeerTransfer(handle, peer_id);
+    if (!info || info->is_sending != !abort.isFromSender())
+    {
+        return;
+    }
+
+    LOG_WARNING(QString("Peer %1 aborted the transfer of file: %2")
+                    .arg(peer_id.c_str())
+                    .arg(info->file_path.c_str()));
+    finishTransfer(handle, TransferOutcome::ABORTED);
+}
+
+void FileTransfer::cancelPeerTransfers(const std::string& peer_id)
+{
+    ++peer_disconnects_[peer_id];
+    send_batch_done_bytes_ += scheduler_.dropPeer(peer_id);
+
+    std::vector<TransferHandle> handles;
+    for (uint32_t index = 0; index < slots_.size(); ++index)
+    {
+        const TransferSlot& slot = slots_[index];
+        if (slot.info && slot.info->peer_id == peer_id)
+        {
+            handles.push_back(
+                (static_cast<uint32_t>(slot.generation) << SLOT_INDEX_BITS) |
+                index);
+        }
+    }
+
+    if (!handles.empty())
+    {
+        LOG_WARNING(QString("Peer %1 disconnected, failing its %2 transfers")
+                        .arg(peer_id.c_str())
+                        .arg(handles.size()));
+    }
+    for (TransferHandle handle : handles)
+    {
+        finishTransfer(handle, TransferOutcome::FAILED);
+    }
+
+    if (scheduler_.idle())
+    {
+        send_batch_bytes_ = 0;
+        send_batch_done_bytes_ = 0;
+    }
+}
+
+void FileTransfer::pauseTransfer(const std::string& file_id)
+{
+    TransferInfo* info = findTransfer(findHandle(file_id));
+    if (info)
+    {
+        info->is_paused = true;
+        LOG_INFO(
+            QString("Transfer paused for file ID: %1").arg(file_id.c_str()));
+    } else {
+        LOG_ERROR(QString("Non-existent pause to transfer for file ID: %1")
+                      .arg(file_id.c_str()));
+    }
+}
+
+void FileTransfer::resumeTransfer(const std::string& file_id)
+{
+    TransferHandle handle = findHandle(file_id);
+    TransferInfo*  info = findTransfer(handle);
+    if (info)
+    {
+        info->is_paused = false;
+        LOG_INFO(
+            QString("Transfer resumed for file ID: %1").arg(file_id.c_str()));
+        if (info->is_sending)
+        {
+            processNextChunk(handle);
+        }
+    } else {
+        LOG_ERROR(QString("Non-existent resume to transfer for file ID: %1")
+                      .arg(file_id.c_str()));
+    }
+}
+
+void FileTransfer::setInFlightLimits(size_t max_bytes, size_t max_chunks)
+{
+    max_in_flight_bytes_ = max_bytes;
+    max_in_flight_chunks_ = max_chunks;
+}
+
+void FileTransfer::setHashCache(std::shared_ptr<FileHashCache> hash_cache)
+{
+    hash_cache_ = std::move(hash_cache);
+}
+
+void FileTransfer::setHashAlgorithm(HashAlgorithm algorithm)
+{
+    hash_algorithm_ = algorithm;
+}
+
+void FileTransfer::setScheduling(SchedulingPolicy policy, size_t max_active)
+{
+    scheduler_.setPolicy(policy);
+    scheduler_.setMaxActive(max_active);
+    dispatchQueuedTransfers();
+}
+
+void FileTransfer::setInlineThreshold(size_t bytes)
+{
+    inline_threshold_ = bytes;
+}
+
+void FileTransfer::setDeltaTransfers(bool enable)
+{
+    delta_transfers_ = enable;
+}
+
+void FileTransfer::setContentChunking(bool enable)
+{
+    content_chunking_ = enable;
+}
+
+void FileTransfer::setChunkStore(std::shared_ptr<ChunkStore> chunk_store)
+{
+    chunk_store_ = std::move(chunk_store);
+}
+
+void FileTransfer::setLinkEstimates(
+    std::shared_ptr<LinkEstimateStore> link_estimates)
+{
+    link_estimates_ = std::move(link_estimates);
+}
+
+void FileTransfer::setCompression(bool enable)
+{
+    compressor_.setEnabled(enable);
+}
+
+void FileTransfer::setChunkControlPolicy(ChunkControlPolicy policy)
+{
+    chunk_control_policy_ = policy;
+}
+
+void FileTransfer::setPeerWeight(const std::string& peer_id, double weight)
+{
+    scheduler_.setPeerWeight(peer_id, weight);
+}
+
+void FileTransfer::cancelTransfer(const std::string& file_id)
+{
+    finishTransfer(findHandle(file_id), TransferOutcome::CANCELLED);
+}
+
+std::vector<std::string> FileTransfer::getActiveTransfers() const
+{
+    std::vector<std::string> active_transfers;
+    active_transfers.reserve(file_ids_.size());
+
+    std::transform(file_ids_.begin(), file_ids_.end(),
+                   std::back_inserter(active_transfers),
+                   [](const auto& pair) { return pair.first; });
+
+    return active_transfers;
+}
+
+double FileTransfer::getTransferProgress(const std::string& file_id) const
+{
+    return getTransferProgress(findHandle(file_id));
+}
+
+double FileTransfer::getAggregateProgress(bool sending) const
+{
+    size_t total_bytes = sending ? send_batch_bytes_ : receive_batch_bytes_;
+    size_t done_bytes =
+        sending ? send_batch_done_bytes_ : receive_batch_done_bytes_;
+    if (total_bytes == 0)
+    {
+        return 100.0;
+    }
+
+    for (const TransferSlot& slot : slots_)
+    {
+        if (slot.info && slot.info->is_sending == sending)
+        {
+            done_bytes += sending ? slot.info->current_offset
+                                  : slot.info->received_extents.coveredBytes();
+        }
+    }
+    double progress = static_cast<double>(done_bytes) / total_bytes * 100.0;
+    return std::min(progress, 100.0);
+}
+
+double FileTransfer::getTransferProgress(TransferHandle handle) const
+{
+    const TransferInfo* info = findTransfer(handle);
+    if (!info)
+    {
+        return 100.0;
+    }
+
+    if (info->file_size == 0)
+    {
+        LOG_WARNING(QString("File size is 0 for transfer: %1")
+                        .arg(info->file_id.c_str()));
+        return 0.0;
+    }
+
+    size_t done_bytes = info->is_sending
+                            ? info->current_offset
+                            : info->received_extents.coveredBytes();
+    double progress = static_cast<double>(done_bytes) / info->file_size * 100.0;
+    return std::min(progress, 100.0);
+}
+
+size_t FileTransfer::getOptimalChunkSize(TransferHandle handle) const
+{
+    const TransferInfo* info = findTransfer(handle);
+    if (info && info->chunk_controller)
+    {
+        return info->chunk_controller->currentChunkSize();
+    }
+    return MAX_CHUNK_SIZE;
+}
+
+bool FileTransfer::isFileSending(const std::string& file_id) const
+{
+    const TransferInfo* info = findTransfer(findHandle(file_id));
+    if (info)
+    {
+        return info->is_sending;
+    }
+    return false;
+}
+
+bool FileTransfer::isReceiverReady(TransferHandle handle) const
+{
+    const TransferInfo* info = findTransfer(handle);
+    return info && info->receiver_ready;
+}
+
+void FileTransfer::setChunkReadyCallback(ChunkReadyCallback callback)
+{
+    chunk_ready_callback_ = std::move(callback);
+}
+
+void FileTransfer::setFileMetadataCallback(FileMetadataCallback callback)
+{
+    file_metadata_callback_ = std::move(callback);
+}
+
+void FileTransfer::setChunkAckCallback(ChunkAckCallback callback)
+{
+    chunk_ack_callback_ = std::move(callback);
+}
+
+void FileTransfer::setTransferFinalizeCallback(
+    TransferFinalizeCallback callback)
+{
+    transfer_finalize_callback_ = std::move(callback);
+}
+
+void FileTransfer::setChunkRetransmitCallback(
+    ChunkRetransmitCallback callback)
+{
+    chunk_retransmit_callback_ = std::move(callback);
+}
+
+void FileTransfer::setTransferResumeCallback(TransferResumeCallback callback)
+{
+    transfer_resume_callback_ = std::move(callback);
+}
+
+void FileTransfer::setBlockSignaturesCallback(
+    BlockSignaturesCallback callback)
+{
+    block_signatures_callback_ = std::move(callback);
+}
+
+void FileTransfer::setDeltaCopyCallback(DeltaCopyCallback callback)
+{
+    delta_copy_callback_ = std::move(callback);
+}
+
+void FileTransfer::setTransferAbortCallback(TransferAbortCallback callback)
+{
+    transfer_abort_callback_ = std::move(callback);
+}
+
+void FileTransfer::setTransferCompleteCallback(
+    TransferCompleteCallback callback)
+{
+    transfer_complete_callback_ = std::move(callback);
+}
+
+FileTransfer::TransferHandle FileTransfer::allocateTransfer(TransferInfo info)
+{
+    uint32_t index;
+    if (!free_slots_.empty())
+    {
+        index = free_slots_.back();
+        free_slots_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(slots_.size());
+        slots_.emplace_back();
+    }
+
+    TransferSlot&  slot = slots_[index];
+    TransferHandle handle =
+        (static_cast<uint32_t>(slot.generation) << SLOT_INDEX_BITS) | index;
+    file_ids_[info.file_id] = handle;
+    slot.info = std::move(info);
+    return handle;
+}
+
+void FileTransfer::releaseTransfer(TransferHandle handle)
+{
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
+    {
+        return;
+    }
+
+    auto file_id_it = file_ids_.find(info->file_id);
+    if (file_id_it != file_ids_.end() && file_id_it->second == handle)
+    {
+        file_ids_.erase(file_id_it);
+    }
+
+    auto route_it = inbound_routes_.find(info->inbound_route);
+    if (!info->is_sending && route_it != inbound_routes_.end() &&
+        route_it->second == handle)
+    {
+        inbound_routes_.erase(route_it);
+    }
+
+    bool        is_sending = info->is_sending;
+    std::string peer_id = info->peer_id;
+    if (is_sending)
+    {
+        scheduler_.finished(peer_id);
+        send_batch_done_bytes_ += info->file_size;
+    } else {
+        receive_batch_done_bytes_ += info->file_size;
+        --receiving_transfers_;
+    }
+
+    uint32_t      index = handle & SLOT_INDEX_MASK;
+    TransferSlot& slot = slots_[index];
+    slot.info.reset();
+    // Generation 0 is skipped so a valid handle is never 0
+    if (++slot.generation == 0)
+    {
+        slot.generation = 1;
+    }
+    free_slots_.push_back(index);
+
+    // A batch ends once nothing is left, the next one starts from zero
+    if (is_sending && scheduler_.idle())
+    {
+        send_batch_bytes_ = 0;
+        send_batch_done_bytes_ = 0;
+    }
+    if (!is_sending && receiving_transfers_ == 0)
+    {
+        receive_batch_bytes_ = 0;
+        receive_batch_done_bytes_ = 0;
+    }
+
+    if (is_sending)
+    {
+        dispatchQueuedTransfers();
+    }
+}
+
+FileTransfer::TransferInfo* FileTransfer::findTransfer(TransferHandle handle)
+{
+    return const_cast<TransferInfo*>(
+        static_cast<const FileTransfer*>(this)->findTransfer(handle));
+}
+
+const FileTransfer::TransferInfo*
+FileTransfer::findTransfer(TransferHandle handle) const
+{
+    uint32_t index = handle & SLOT_INDEX_MASK;
+    if (handle == INVALID_TRANSFER_HANDLE || index >= slots_.size())
+    {
+        return nullptr;
+    }
+
+    const TransferSlot& slot = slots_[index];
+    if (!slot.info || (handle >> SLOT_INDEX_BITS) != slot.generation)
+    {
+        return nullptr;
+    }
+    return &*slot.info;
+}
+
+FileTransfer::TransferHandle
+FileTransfer::findHandle(const std::string& file_id) const
+{
+    auto it = file_ids_.find(file_id);
+    return it != file_ids_.end() ? it->second : INVALID_TRANSFER_HANDLE;
+}
+
+uint64_t FileTransfer::peerDisconnects(const std::string& peer_id) const
+{
+    auto it = peer_disconnects_.find(peer_id);
+    return it != peer_disconnects_.end() ? it->second : 0;
+}
+
+FileTransfer::TransferInfo*
+FileTransfer::findPeerTransfer(TransferHandle     handle,
+                               const std::string& peer_id)
+{
+    TransferInfo* info = findTransfer(handle);
+    if (info && info->peer_id != peer_id)
+    {
+        LOG_WARNING(QString("Peer %1 sent a message for a transfer of peer "
+                            "%2, ignoring it")
+                        .arg(peer_id.c_str())
+                        .arg(info->peer_id.c_str()));
+        return nullptr;
+    }
+    return info;
+}
+
+FileTransfer::TransferHandle
+FileTransfer::findReceivingTransfer(const std::string& file_path) const
+{
+    for (const auto& [route, handle] : inbound_routes_)
     {
-        LOG_ERROR(QString("File does not exist: %1").arg(file_path.c_str()));
-        return;
+        const TransferInfo* info = findTransfer(handle);
+        if (info && !info->bundle && info->file_path == file_path)
+        {
+            return handle;
+        }
     }
+    return INVALID_TRANSFER_HANDLE;
+}
 
-    std::string file_id = generateFileId(file_path, peer_id);
-    size_t      file_size = fs_manager_->getFileSize(file_path);
-    std::string file_hash = fs_manager_->calculateFileHash(file_path);
+uint64_t FileTransfer::makeInboundRoute(uint32_t       connection_id,
+                                        TransferHandle remote_handle)
+{
+    return (static_cast<uint64_t>(connection_id) << 32) | remote_handle;
+}
 
-    TransferInfo info{
-        file_path,
-        peer_id,
-        0,
-        file_size,
-        true,
-        false,
-        file_hash,
-        std::make_unique<ChunkSizeOptimizer>(generatePossibleChunkSizes())};
-    active_transfers_[file_id] = std::move(info);
+void FileTransfer::processNextChunk(TransferHandle handle)
+{
+    TransferInfo* info = findTransfer(handle);
+    if (!info || info->is_paused || info->awaiting_receiver)
+    {
+        return;
+    }
 
-    FileMetadata metadata(file_id, fs_manager_->getFileName(file_path),
-                          file_size, file_hash);
-    if (file_metadata_callback_)
+    while (info->current_offset < info->file_size && isWindowOpen(*info))
     {
-        file_metadata_callback_(metadata);
+        size_t offset = info->current_offset;
+        size_t resume_offset = info->skipped_extents.coveredUntil(offset);
+        if (resume_offset > offset)
+        {
+            info->bytes_read += resume_offset - offset;
+            info->current_offset = resume_offset;
+            continue;
+        }
+
+        // Chunks stop where the next range the receiver has begins
+        size_t optimal_chunk_size = info->chunk_controller->nextChunkSize();
+        size_t remaining_size =
+            std::min<uint64_t>(info->file_size,
+                               info->skipped_extents.nextExtentAfter(offset)) -
+            offset;
+        size_t chunk_size = std::min(optimal_chunk_size, remaining_size);
+
+        // The chunk occupies the window from the moment its read is queued
+        info->unacked_chunks[offset] = chunk_size;
+        info->bytes_in_flight += chunk_size;
+        info->current_offset += chunk_size;
+
+        runOnDisk(
+            [this, file_handle = info->file_handle, bundle = info->bundle,
+             offset, chunk_size, level = compressor_.chooseLevel()]() {
+                ChunkData chunk =
+                    bundle ? readChunk(*bundle, offset, chunk_size)
+                           : readChunk(*file_handle, offset, chunk_size);
+                compressChunk(chunk, level);
+                return chunk;
+            },
+            [this, handle, offset, chunk_size](ChunkData chunk) {
+                sendChunk(handle, offset, chunk_size, std::move(chunk), false);
+            });
     }
 
-    processNextChunk(file_id);
+    finalizeSentHash(handle);
+    checkTransferCompletion(handle);
 }
 
-void FileTransfer::startReceiving(const FileMetadata& metadata,
-                                  const std::string&  downloadPath)
+FileTransfer::ChunkData FileTransfer::readChunk(const FileHandle& file,
+                                                size_t offset, size_t size) const
 {
-    std::filesystem::path filePath = downloadPath;
-    if (filePath.empty())
+    std::vector<uint8_t> data = fs_manager_->readChunk(file, offset, size);
+    uint32_t             checksum = Digest::crc32c(data.data(), data.size());
+    return ChunkData{std::move(data), checksum, {}};
+}
+
+FileTransfer::ChunkData FileTransfer::readChunk(const FileBundle& bundle,
+                                                size_t offset, size_t size) const
+{
+    const std::vector<uint8_t>& data = bundle.data();
+    if (offset > data.size() || size > data.size() - offset)
     {
-        filePath = std::filesystem::current_path() / metadata.getFileName();
-    } else {
-        if (std::filesystem::is_directory(filePath))
-        {
-            filePath /= metadata.getFileName();
-        }
+        return {};
     }
+    std::vector<uint8_t> chunk(data.begin() + offset,
+                               data.begin() + offset + size);
+    uint32_t             checksum = Digest::crc32c(chunk.data(), chunk.size());
+    return ChunkData{std::move(chunk), checksum, {}};
+}
 
-    std::filesystem::path dir = filePath.parent_path();
-    if (!std::filesystem::exists(dir))
+void FileTransfer::compressChunk(ChunkData& chunk, int level)
+{
+    chunk.compressed = ChunkCompressor::compress(chunk.data, level);
+    if (!chunk.compressed.data.empty())
     {
-        std::filesystem::create_directories(dir);
+        chunk.checksum = Digest::crc32c(chunk.compressed.data.data(),
+                                        chunk.compressed.data.size());
     }
+}
 
-    fs_manager_->createFile(filePath, metadata.getFileSize());
+void FileTransfer::recordAckedWireBytes(size_t wire_size)
+{
+    // Gaps between acks longer than a second are idle time, not the link
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_ack_time_ > std::chrono::seconds(1))
+    {
+        link_sample_start_ = now;
+        link_sample_bytes_ = 0;
+    }
+    last_ack_time_ = now;
 
-    TransferInfo info{
-        filePath.string(),
-        "",
-        0,
-        metadata.getFileSize(),
-        false,
-        false,
-        metadata.getFileHash(),
-        std::make_unique<ChunkSizeOptimizer>(generatePossibleChunkSizes())};
-    active_transfers_[metadata.getFileId()] = std::move(info);
+    link_sample_bytes_ += wire_size;
+    std::chrono::duration<double> elapsed = now - link_sample_start_;
+    if (elapsed >= std::chrono::milliseconds(200))
+    {
+        compressor_.recordLinkRate(link_sample_bytes_ / elapsed.count());
+        link_sample_start_ = now;
+        link_sample_bytes_ = 0;
+    }
+}
 
-    LOG_INFO(QString("Started receiving file: %1, size: %2 bytes, to path: %3")
-                 .arg(metadata.getFileName().c_str())
-                 .arg(metadata.getFileSize())
-                 .arg(filePath.string().c_str()));
+std::string FileTransfer::peerHost(const std::string& peer_id)
+{
+    size_t colon = peer_id.rfind(':');
+    return colon == std::string::npos ? peer_id : peer_id.substr(0, colon);
 }
 
-void FileTransfer::handleIncomingChunk(const ChunkMessage& chunk_msg)
+void FileTransfer::sendChunk(TransferHandle handle, size_t offset,
+                             size_t expected_size, ChunkData chunk,
+                             bool is_retransmission)
 {
-    auto it = active_transfers_.find(chunk_msg.getFileId());
-    if (it == active_transfers_.end())
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
     {
-        LOG_ERROR(QString("No active transfer for file ID: %1")
-                      .arg(chunk_msg.getFileId().c_str()));
         return;
     }
 
-    TransferInfo& info = it->second;
-    if (info.is_sending)
+    if (chunk.data.size() != expected_size)
     {
-        LOG_ERROR(QString("Received chunk for a file being sent: %1")
-                      .arg(chunk_msg.getFileId().c_str()));
+        LOG_ERROR(QString("Failed to read chunk at offset %1 of file: %2")
+                      .arg(offset)
+                      .arg(info->file_path.c_str()));
+        finishTransfer(handle, TransferOutcome::FAILED);
         return;
     }
 
-    fs_manager_->writeChunk(info.file_path, chunk_msg.getOffset(),
-                            chunk_msg.getData());
-    info.current_offset = chunk_msg.getOffset() + chunk_msg.getData().size();
+    auto payload =
+        std::make_shared<const std::vector<uint8_t>>(std::move(chunk.data));
+    if (!is_retransmission)
+    {
+        info->bytes_read += expected_size;
+        if (info->expected_hash.empty())
+        {
+            info->streaming_hash.update(offset, payload);
+        }
+    }
 
-    if (info.current_offset >= info.file_size)
+    bool   is_compressed = !chunk.compressed.data.empty();
+    size_t wire_size =
+        is_compressed ? chunk.compressed.data.size() : expected_size;
+    if (chunk.compressed.level > 0)
     {
-        checkTransferCompletion(chunk_msg.getFileId());
+        compressor_.recordCompression(chunk.compressed.level, expected_size,
+                                      wire_size, chunk.compressed.seconds);
+    }
+    auto now = std::chrono::steady_clock::now();
+    info->wire_sizes[offset] = wire_size;
+    info->chunk_controller->onChunkSent(offset, expected_size, now);
+    if (is_compressed)
+    {
+        payload = std::make_shared<const std::vector<uint8_t>>(
+            std::move(chunk.compressed.data));
     }
-}
 
-void FileTransfer::handleChunkMetrics(const std::string& file_id,
-                                      size_t chunk_number, size_t chunk_size,
-                                      std::chrono::microseconds latency)
-{
-    auto it = active_transfers_.find(file_id);
-    if (it != active_transfers_.end() && it->second.is_sending)
+    ChunkMessage chunk_msg(handle, offset, std::move(payload));
+    chunk_msg.setChecksum(chunk.checksum);
+    chunk_msg.setSendTime(ChunkMessage::timestamp(now));
+    if (is_compressed)
+    {
+        chunk_msg.setCompressed(static_cast<uint32_t>(expected_size));
+    }
+    if (chunk_ready_callback_)
     {
-        it->second.chunk_size_optimizer->recordPerformance(chunk_size, latency);
-        processNextChunk(file_id);
+        chunk_ready_callback_(chunk_msg, info->peer_id);
     }
+
+    finalizeSentHash(handle);
 }
 
-void FileTransfer::pauseTransfer(const std::string& file_id)
+void FileTransfer::handleChunkWritten(TransferHandle handle, size_t offset,
+                                      size_t size, bool written,
+                                      ChunkArrival arrival)
 {
-    auto it = active_transfers_.find(file_id);
-    if (it != active_transfers_.end())
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
     {
-        it->second.is_paused = true;
-        LOG_INFO(
-            QString("Transfer paused for file ID: %1").arg(file_id.c_str()));
-    } else {
-        LOG_ERROR(QString("Non-existent pause to transfer for file ID: %1")
-                      .arg(file_id.c_str()));
+        return;
     }
-}
 
-void FileTransfer::resumeTransfer(const std::string& file_id)
-{
-    auto it = active_transfers_.find(file_id);
-    if (it != active_transfers_.end())
+    if (!written)
     {
-        it->second.is_paused = false;
-        LOG_INFO(
-            QString("Transfer resumed for file ID: %1").arg(file_id.c_str()));
-        if (it->second.is_sending)
-        {
-            processNextChunk(file_id);
-        }
-    } else {
-        LOG_ERROR(QString("Non-existent resume to transfer for file ID: %1")
-                      .arg(file_id.c_str()));
+        LOG_ERROR(QString("Failed to write chunk at offset %1 of file: %2")
+                      .arg(offset)
+                      .arg(info->file_path.c_str()));
+        finishTransfer(handle, TransferOutcome::FAILED);
+        return;
     }
+
+    info->received_extents.add(offset, offset + size);
+    if (chunk_ack_callback_)
+    {
+        ChunkMetrics ack(
+            info->remote_handle, offset, size, arrival.send_time,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - arrival.received_time));
+        chunk_ack_callback_(ack, info->peer_id);
+    }
+
+    checkTransferCompletion(handle);
 }
 
-void FileTransfer::cancelTransfer(const std::string& file_id)
+void FileTransfer::signBasis(TransferHandle handle)
+{
+    TransferInfo* info = findTransfer(handle);
+    size_t        block_size = DeltaSync::blockSize(info->basis_size);
+    runOnDisk(
+        [basis_handle = info->basis_handle, basis_size = info->basis_size,
+         block_size]() {
+            return DeltaSync::sign(*basis_handle, basis_size, block_size);
+        },
+        [this, handle, block_size](
+            std::optional<std::vector<DeltaSync::Signature>> signatures) {
+            TransferInfo* info = findTransfer(handle);
+            if (!info)
+            {
+                return;
+            }
+
+            if (!signatures)
+            {
+                LOG_WARNING(QString("Failed to read the older copy of %1, "
+                                    "receiving it whole")
+                                .arg(info->file_path.c_str()));
+                if (transfer_resume_callback_)
+                {
+                    transfer_resume_callback_(
+                        TransferResume(info->remote_handle, {}),
+                        info->peer_id);
+                }
+                return;
+            }
+
+            LOG_INFO(QString("Signed %1 blocks of the older copy of %2")
+                         .arg(signatures->size())
+                         .arg(info->file_path.c_str()));
+            if (block_signatures_callback_)
+            {
+                block_signatures_callback_(
+                    BlockSignatures(info->remote_handle,
+                                    static_cast<uint32_t>(block_size),
+                                    info->basis_size, std::move(*signatures)),
+                    info->peer_id);
+            }
+        });
+}
+
+void FileTransfer::applyDelta(TransferHandle                  handle,
+                              std::optional<DeltaSync::Delta> delta)
 {
-    auto it = active_transfers_.find(file_id);
-    if (it != active_transfers_.end())
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
+    {
+        return;
+    }
+
+    info->awaiting_receiver = false;
+    if (!delta)
+    {
+        LOG_WARNING(QString("Failed to diff file %1, sending it whole")
+                        .arg(info->file_path.c_str()));
+        processNextChunk(handle);
+        return;
+    }
+
+    LOG_INFO(QString("Peer already has %1 of %2 bytes of file %3 in %4 "
+                     "ranges")
+                 .arg(delta->copied_bytes)
+                 .arg(info->file_size)
+                 .arg(info->file_path.c_str())
+                 .arg(delta->copies.size()));
+
+    // Copied ranges are skipped like resumed ones
+    for (const DeltaCopy::Copy& copy : delta->copies)
+    {
+        info->skipped_extents.add(copy.offset, copy.offset + copy.size);
+    }
+    if (!delta->copies.empty() && delta_copy_callback_)
+    {
+        delta_copy_callback_(DeltaCopy(handle, std::move(delta->copies)),
+                             info->peer_id);
+    }
+
+    // The diff read the whole file, so the digest is already known
+    if (info->expected_hash.empty())
     {
-        active_transfers_.erase(it);
-        if (transfer_complete_callback_)
+        if (hash_cache_ && info->hash_key)
         {
-            transfer_complete_callback_(file_id, false);
+            disk_executor_->submit(
+                [hash_cache = hash_cache_, file_path = info->file_path,
+                 key = *info->hash_key, file_hash = delta->file_hash]() {
+                    hash_cache->store(file_path, key, file_hash);
+                });
         }
+        sendTransferFinalize(handle, delta->file_hash);
     }
+    processNextChunk(handle);
 }
 
-std::vector<std::string> FileTransfer::getActiveTransfers() const
+void FileTransfer::copyBasisBlocks(TransferHandle handle)
 {
-    std::vector<std::string> active_transfers;
-    active_transfers.reserve(active_transfers_.size());
+    TransferInfo* info = findTransfer(handle);
+    if (!info || info->is_copying || info->pending_copies.empty())
+    {
+        return;
+    }
 
-    std::transform(active_transfers_.begin(), active_transfers_.end(),
-                   std::back_inserter(active_transfers),
-                   [](const auto& pair) { return pair.first; });
+    std::vector<DeltaCopy::Copy> batch;
+    size_t                       batch_bytes = 0;
+    while (!info->pending_copies.empty() &&
+           batch_bytes < DeltaSync::COPY_BATCH_SIZE)
+    {
+        DeltaCopy::Copy& copy = info->pending_copies.front();
+        uint64_t         size = std::min<uint64_t>(
+            copy.size, DeltaSync::COPY_BATCH_SIZE - batch_bytes);
+        batch.push_back({copy.offset, copy.basis_offset, size});
+        batch_bytes += size;
+        if (size == copy.size)
+        {
+            info->pending_copies.pop_front();
+        } else {
+            copy.offset += size;
+            copy.basis_offset += size;
+            copy.size -= size;
+        }
+    }
 
-    return active_transfers;
+    info->is_copying = true;
+    runOnDisk(
+        [this, file_handle = info->file_handle,
+         basis_handle = info->basis_handle, journal = info->journal,
+         batch = std::move(batch)]() {
+            CopiedBlocks copied;
+            for (const DeltaCopy::Copy& copy : batch)
+            {
+                std::vector<uint8_t> data =
+                    fs_manager_->readChunk(*basis_handle, copy.basis_offset,
+                                           static_cast<size_t>(copy.size));
+                if (data.size() != copy.size ||
+                    !fs_manager_->writeChunk(*file_handle, copy.offset, data))
+                {
+                    return copied;
+                }
+                if (journal)
+                {
+                    journal->record(copy.offset, copy.size);
+                }
+                copied.blocks.emplace_back(
+                    copy.offset,
+                    std::make_shared<const std::vector<uint8_t>>(
+                        std::move(data)));
+            }
+            copied.copied = true;
+            return copied;
+        },
+        [this, handle](CopiedBlocks copied) {
+            handleBlocksCopied(handle, std::move(copied));
+        });
 }
 
-double FileTransfer::getTransferProgress(const std::string& file_id) const
+void FileTransfer::handleBlocksCopied(TransferHandle handle,
+                                      CopiedBlocks   copied)
 {
-    auto it = active_transfers_.find(file_id);
-    if (it == active_transfers_.end())
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
     {
-        return 100.0;
+        return;
     }
 
-    const TransferInfo& info = it->second;
-    if (info.file_size == 0)
+    info->is_copying = false;
+    if (!copied.copied)
     {
-        LOG_WARNING(
-            QString("File size is 0 for transfer: %1").arg(file_id.c_str()));
-        return 0.0;
+        LOG_ERROR(QString("Failed to copy blocks of the older copy of %1")
+                      .arg(info->file_path.c_str()));
+        finishTransfer(handle, TransferOutcome::FAILED);
+        return;
     }
 
-    double progress =
-        static_cast<double>(info.current_offset) / info.file_size * 100.0;
-    return std::min(progress, 100.0);
+    for (auto& [offset, data] : copied.blocks)
+    {
+        info->received_extents.add(offset, offset + data->size());
+        info->streaming_hash.update(offset, std::move(data));
+    }
+    copyBasisBlocks(handle);
+    checkTransferCompletion(handle);
+}
+
+void FileTransfer::copyStoredChunks(TransferHandle handle)
+{
+    TransferInfo* info = findTransfer(handle);
+    runOnDisk(
+        [this, file_handle = info->file_handle, journal = info->journal,
+         basis_handle = info->basis_handle, basis_size = info->basis_size,
+         chunk_store = chunk_store_, chunks = info->content_chunks]() {
+            // Chunks of the older copy are found like stored ones
+            std::unordered_map<ContentChunker::Chunk, uint64_t,
+                               ChunkStore::ChunkIdHash>
+                basis_chunks;
+            std::optional<std::vector<ContentChunker::Chunk>> basis_list;
+            if (basis_handle)
+            {
+                basis_list = ContentChunker::chunkFile(*basis_handle,
+                                                       basis_size);
+            }
+            if (basis_list)
+            {
+                uint64_t basis_offset = 0;
+                for (const ContentChunker::Chunk& chunk : *basis_list)
+                {
+                    basis_chunks.emplace(chunk, basis_offset);
+                    basis_offset += chunk.size;
+                }
+            }
+
+            ExtentSet copied;
+            std::unordered_map<std::string, std::unique_ptr<FileHandle>>
+                     sources;
+            uint64_t offset = 0;
+            for (const ContentChunker::Chunk& chunk : chunks)
+            {
+                std::vector<uint8_t> data;
+                bool                 from_store = false;
+                auto basis_it = basis_chunks.find(chunk);
+                if (basis_it != basis_chunks.end())
+                {
+                    data = fs_manager_->readChunk(*basis_handle,
+                                                  basis_it->second, chunk.size);
+                } else if (chunk_store)
+                {
+                    std::optional<ChunkStore::Location> location =
+                        chunk_store->lookup(chunk);
+                    if (location)
+                    {
+                        std::unique_ptr<FileHandle>& source =
+                            sources[location->file_path.string()];
+                        if (!source)
+                        {
+                            source = fs_manager_->openFile(
+                                location->file_path, FileHandle::Mode::Read);
+                        }
+                        if (source)
+                        {
+                            data = fs_manager_->readChunk(
+                                *source, location->offset, chunk.size);
+                        }
+                        from_store = true;
+                    }
+                }
+
+                // Files change under the store, so the bytes must still be
+                // the chunk they were indexed as
+                if (!data.empty() &&
+                    ContentChunker::identify(data.data(), data.size()) !=
+                        chunk)
+                {
+                    if (from_store)
+                    {
+                        chunk_store->forget(chunk);
+                    }
+                    data.clear();
+                }
+                if (!data.empty() &&
+                    fs_manager_->writeChunk(*file_handle, offset, data))
+                {
+                    if (journal)
+                    {
+                        journal->record(offset, data.size());
+                    }
+                    copied.add(offset, offset + data.size());
+                }
+                offset += chunk.size;
+            }
+            return copied;
+        },
+        [this, handle](ExtentSet copied) {
+            handleStoredChunksCopied(handle, std::move(copied));
+        });
 }
 
-size_t FileTransfer::getOptimalChunkSize(const std::string& file_id) const
+void FileTransfer::handleStoredChunksCopied(TransferHandle handle,
+                                            ExtentSet      copied)
 {
-    auto it = active_transfers_.find(file_id);
-    if (it != active_transfers_.end() && it->second.chunk_size_optimizer)
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
     {
-        return it->second.chunk_size_optimizer->getOptimalChunkSize();
+        return;
     }
-    return MAX_CHUNK_SIZE;
+
+    LOG_INFO(QString("Found %1 of %2 bytes of file %3 in the chunk store")
+                 .arg(copied.coveredBytes())
+                 .arg(info->file_size)
+                 .arg(info->file_path.c_str()));
+
+    std::vector<ExtentSet::Extent> extents = copied.extents();
+    for (const auto& [begin, end] : extents)
+    {
+        info->received_extents.add(begin, end);
+    }
+    // Copied bytes never reach the streaming digest
+    if (!extents.empty())
+    {
+        info->streaming_hash.invalidate();
+    }
+    // The sender sends whatever is not listed
+    if (transfer_resume_callback_)
+    {
+        transfer_resume_callback_(
+            TransferResume(info->remote_handle, std::move(extents)),
+            info->peer_id);
+    }
+    checkTransferCompletion(handle);
 }
 
-bool FileTransfer::isFileSending(const std::string& file_id) const
+bool FileTransfer::isWindowOpen(const TransferInfo& info) const
 {
-    auto it = active_transfers_.find(file_id);
-    if (it != active_transfers_.end())
+    // Always allow one chunk in flight, so a window smaller than a chunk
+    // degrades to stop-and-wait instead of stalling
+    if (info.unacked_chunks.empty())
     {
-        return it->second.is_sending;
+        return true;
     }
-    return false;
+    if (max_in_flight_chunks_ != 0 &&
+        info.unacked_chunks.size() >= max_in_flight_chunks_)
+    {
+        return false;
+    }
+    // The controller's window, capped by the configured one
+    size_t max_bytes = info.chunk_controller->windowBytes();
+    if (max_in_flight_bytes_ != 0)
+    {
+        max_bytes = max_bytes == 0 ? max_in_flight_bytes_
+                                   : std::min(max_bytes, max_in_flight_bytes_);
+    }
+    if (max_bytes != 0 && info.bytes_in_flight >= max_bytes)
+    {
+        return false;
+    }
+    return true;
 }
 
-void FileTransfer::setChunkReadyCallback(ChunkReadyCallback callback)
+std::string FileTransfer::generateFileId(const std::string& file_key,
+                                         const std::string& peer_id)
 {
-    chunk_ready_callback_ = std::move(callback);
+    return file_key + "_" + peer_id;
 }
 
-void FileTransfer::setFileMetadataCallback(FileMetadataCallback callback)
+void FileTransfer::finalizeSentHash(TransferHandle handle)
 {
-    file_metadata_callback_ = std::move(callback);
+    TransferInfo* info = findTransfer(handle);
+    if (!info || !info->expected_hash.empty() || info->is_verifying ||
+        info->bytes_read < info->file_size)
+    {
+        return;
+    }
+
+    const StreamingHash& streaming_hash = info->streaming_hash;
+    if (streaming_hash.isValid() &&
+        streaming_hash.hashedBytes() == info->file_size)
+    {
+        std::string file_hash = streaming_hash.digest();
+        if (hash_cache_ && info->hash_key)
+        {
+            disk_executor_->submit(
+                [hash_cache = hash_cache_, file_path = info->file_path,
+                 key = *info->hash_key, file_hash]() {
+                    hash_cache->store(file_path, key, file_hash);
+                });
+        }
+        sendTransferFinalize(handle, file_hash);
+        return;
+    }
+
+    LOG_WARNING(QString("Streaming hash unavailable for file %1, re-reading")
+                    .arg(info->file_path.c_str()));
+    info->is_verifying = true;
+    runOnDisk(
+        [this, file_path = info->file_path, algorithm = info->hash_algorithm,
+         hash_key = info->hash_key]() {
+            std::string file_hash =
+                fs_manager_->calculateFileHash(file_path, algorithm);
+            if (hash_key)
+            {
+                hash_cache_->store(file_path, *hash_key, file_hash);
+            }
+            return file_hash;
+        },
+        [this, handle](std::string file_hash) {
+            sendTransferFinalize(handle, file_hash);
+        });
 }
 
-void FileTransfer::setTransferCompleteCallback(
-    TransferCompleteCallback callback)
+void FileTransfer::sendTransferFinalize(TransferHandle     handle,
+                                        const std::string& file_hash)
 {
-    transfer_complete_callback_ = std::move(callback);
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
+    {
+        return;
+    }
+
+    if (file_hash.empty())
+    {
+        LOG_ERROR(
+            QString("Failed to hash file: %1").arg(info->file_path.c_str()));
+        finishTransfer(handle, TransferOutcome::FAILED);
+        return;
+    }
+
+    info->expected_hash = file_hash;
+    if (transfer_finalize_callback_)
+    {
+        transfer_finalize_callback_(TransferFinalize(handle, file_hash),
+                                    info->peer_id);
+    }
+    checkTransferCompletion(handle);
 }
 
-void FileTransfer::processNextChunk(const std::string& file_id)
+void FileTransfer::checkTransferCompletion(TransferHandle handle)
 {
-    auto it = active_transfers_.find(file_id);
-    if (it == active_transfers_.end() || it->second.is_paused)
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
     {
         return;
     }
 
-    TransferInfo& info = it->second;
-    if (info.current_offset >= info.file_size)
+    if (info->is_sending)
     {
-        checkTransferCompletion(file_id);
+        if (info->current_offset >= info->file_size &&
+            info->unacked_chunks.empty() && !info->expected_hash.empty())
+        {
+            finishTransfer(handle, TransferOutcome::COMPLETED);
+        }
         return;
     }
 
-    size_t optimal_chunk_size =
-        info.chunk_size_optimizer->getOptimalChunkSize();
-    size_t remaining_size = info.file_size - info.current_offset;
-    size_t chunk_size = std::min(optimal_chunk_size, remaining_size);
+    if (info->received_extents.coveredBytes() < info->file_size ||
+        info->is_verifying ||
+        info->expected_hash.empty())
+    {
+        return;
+    }
 
-    std::vector<uint8_t> data =
-        fs_manager_->readChunk(info.file_path, info.current_offset, chunk_size);
+    info->is_verifying = true;
 
-    ChunkMessage chunk(file_id, info.current_offset, data);
-    if (chunk_ready_callback_)
+    // Every byte already went through the streaming digest on arrival
+    const StreamingHash& streaming_hash = info->streaming_hash;
+    if (streaming_hash.isValid() &&
+        streaming_hash.hashedBytes() == info->file_size)
     {
-        chunk_ready_callback_(chunk);
+        verifyReceivedFile(handle, streaming_hash.digest());
+        return;
     }
 
-    info.current_offset += chunk_size;
+    LOG_WARNING(QString("Streaming hash unavailable for file %1, re-reading")
+                    .arg(info->file_path.c_str()));
+    runOnDisk(
+        [this, file_path = info->file_path, bundle = info->bundle,
+         algorithm = info->hash_algorithm]() {
+            if (bundle)
+            {
+                std::unique_ptr<Digest> digest = Digest::create(algorithm);
+                digest->update(bundle->data().data(), bundle->data().size());
+                return digest->digest();
+            }
+            return fs_manager_->calculateFileHash(file_path, algorithm);
+        },
+        [this, handle](std::string calculated_hash) {
+            verifyReceivedFile(handle, calculated_hash);
+        });
 }
 
-std::string FileTransfer::generateFileId(const std::string& file_path,
-                                         const std::string& peer_id)
+void FileTransfer::verifyReceivedFile(TransferHandle     handle,
+                                      const std::string& calculated_hash)
 {
-    return fs_manager_->calculateFileHash(file_path) + "_" + peer_id;
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
+    {
+        return;
+    }
+
+    bool success = (calculated_hash == info->expected_hash);
+    if (!success)
+    {
+        LOG_ERROR(QString("Hash mismatch for file %1. Expected: "
+                          "%2, Calculated: %3")
+                      .arg(info->file_path.c_str())
+                      .arg(info->expected_hash.c_str())
+                      .arg(calculated_hash.c_str()));
+    } else {
+        LOG_INFO(QString("Hash verification successful for file %1")
+                     .arg(info->file_path.c_str()));
+    }
+
+    if (success && info->bundle)
+    {
+        runOnDisk(
+            [bundle = info->bundle, base_dir = info->file_path]() {
+                return bundle->unpack(base_dir);
+            },
+            [this, handle](bool unpacked) {
+                finishTransfer(handle, unpacked ? TransferOutcome::COMPLETED
+                                                : TransferOutcome::FAILED);
+            });
+        return;
+    }
+    finishTransfer(handle, success ? TransferOutcome::COMPLETED
+                                   : TransferOutcome::CORRUPTED);
 }
 
-void FileTransfer::checkTransferCompletion(const std::string& file_id)
+void FileTransfer::finishTransfer(TransferHandle  handle,
+                                  TransferOutcome outcome)
 {
-    auto it = active_transfers_.find(file_id);
-    if (it != active_transfers_.end())
+    TransferInfo* info = findTransfer(handle);
+    if (!info)
     {
-        const TransferInfo& info = it->second;
-        if (info.current_offset >= info.file_size)
-        {
-            bool success = true;
-            if (!info.is_sending)
-            {
-                std::string calculated_hash =
-                    fs_manager_->calculateFileHash(info.file_path);
-                success = (calculated_hash == info.expected_hash);
+        return;
+    }
 
-                if (!success)
-                {
-                    LOG_ERROR(QString("Hash mismatch for file %1. Expected: "
-                                      "%2, Calculated: %3")
-                                  .arg(info.file_path.c_str())
-                                  .arg(info.expected_hash.c_str())
-                                  .arg(calculated_hash.c_str()));
-                } else {
-                    LOG_INFO(QString("Hash verification successful for file %1")
-                                 .arg(info.file_path.c_str()));
-                }
-            }
+    bool success = outcome == TransferOutcome::COMPLETED;
+    if (!success && outcome != TransferOutcome::ABORTED &&
+        transfer_abort_callback_)
+    {
+        transfer_abort_callback_(
+            TransferAbort(info->is_sending ? handle : info->remote_handle,
+                          info->is_sending),
+            info->peer_id);
+    }
 
-            if (transfer_complete_callback_)
-            {
-                transfer_complete_callback_(file_id, success);
-            }
+    if (transfer_complete_callback_)
+    {
+        transfer_complete_callback_(info->file_id, success);
+    }
 
-            if (!success && !info.is_sending)
-            {
-                fs_manager_->deleteFile(info.file_path);
-                LOG_INFO(QString("Deleted file %1 due to hash mismatch")
-                             .arg(info.file_path.c_str()));
-            }
+    // The callback may have touched the slot table
+    info = findTransfer(handle);
+    if (!info)
+    {
+        return;
+    }
 
-            active_transfers_.erase(it);
-        }
+    // What is on disk is kept for a resume, the journal says which parts
+    bool keep_partial = (outcome == TransferOutcome::FAILED ||
+                         outcome == TransferOutcome::ABORTED) &&
+                        !info->is_sending && info->journal;
+    if (keep_partial)
+    {
+        LOG_INFO(QString("Kept %1 bytes of file %2 to resume later")
+                     .arg(info->received_extents.coveredBytes())
+                     .arg(info->file_path.c_str()));
     }
-}
 
-std::vector<size_t> FileTransfer::generatePossibleChunkSizes()
-{
-    std::vector<size_t> sizes;
-    for (size_t size = MIN_CHUNK_SIZE; size <= MAX_CHUNK_SIZE; size *= 2)
+    // A failed bundle never wrote anything. The older copy goes once the
+    // new file is in place, or comes back if it never will be. A resume
+    // reopens it where it is
+    bool delete_file =
+        !success && !keep_partial && !info->is_sending && !info->bundle;
+    bool release_basis = info->basis_handle && !keep_partial;
+    if (delete_file)
+    {
+        info->file_handle.reset();
+    }
+    if (release_basis)
     {
-        sizes.push_back(size);
+        info->basis_handle.reset();
     }
-    return sizes;
+
+    // Everything left on disk is tidied by one job, off the network thread
+    disk_executor_->submit(
+        [fs_manager = fs_manager_,
+         journal = keep_partial ? nullptr : info->journal,
+         chunk_store = success ? chunk_store_ : nullptr,
+         chunks = std::move(info->content_chunks),
+         link_estimates = info->is_sending ? link_estimates_ : nullptr,
+         file_path = info->file_path, success, delete_file, release_basis]() {
+            if (journal)
+            {
+                journal->remove();
+            }
+            if (chunk_store && !chunks.empty())
+            {
+                chunk_store->add(file_path, chunks);
+            }
+            if (link_estimates)
+            {
+                link_estimates->save();
+            }
+
+            if (delete_file)
+            {
+                fs_manager->deleteFile(file_path);
+                LOG_INFO(QString("Deleted file %1 after failed transfer")
+                             .arg(file_path.c_str()));
+            }
+            if (release_basis)
+            {
+                std::filesystem::path basis_path =
+                    DeltaSync::basisPath(file_path);
+                std::error_code ec;
+                if (success)
+                {
+                    std::filesystem::remove(basis_path, ec);
+                } else {
+                    std::filesystem::rename(basis_path, file_path, ec);
+                }
+            }
+        });
+
+    releaseTransfer(handle);
 }
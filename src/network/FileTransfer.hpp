@@ -1,55 +1,192 @@
 #ifndef FILE_TRANSFER_HPP
 #define FILE_TRANSFER_HPP
 
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <map>
 #include <memory>
-#include <queue>
+#include <optional>
 #include <string>
 #include <unordered_map>
 
-#include "ChunkSizeOptimizer.hpp"
+#include <boost/asio.hpp>
+
+#include "ChunkCompressor.hpp"
+#include "ChunkController.hpp"
+#include "ChunkStore.hpp"
+#include "ContentChunker.hpp"
+#include "DeltaSync.hpp"
+#include "DiskIoExecutor.hpp"
+#include "ExtentSet.hpp"
+#include "FileBundle.hpp"
+#include "FileHashCache.hpp"
 #include "FileSystemManager.hpp"
+#include "LinkEstimateStore.hpp"
 #include "Logger.hpp"
+#include "Message/BlockSignatures.hpp"
 #include "Message/ChunkMessage.hpp"
+#include "Message/ChunkMetrics.hpp"
+#include "Message/ChunkRetransmitRequest.hpp"
+#include "Message/DeltaCopy.hpp"
 #include "Message/FileMetadata.hpp"
+#include "Message/TransferAbort.hpp"
+#include "Message/TransferFinalize.hpp"
+#include "Message/TransferResume.hpp"
+#include "StreamingHash.hpp"
+#include "TransferJournal.hpp"
+#include "TransferScheduler.hpp"
 
-class FileTransfer
+// Transfer state is only touched on the network executor, which must run
+// one handler at a time, such as a strand. Disk reads, writes and hashing
+// run on the DiskIoExecutor and their completions are posted back to the
+// network executor
+class FileTransfer : public std::enable_shared_from_this<FileTransfer>
 {
   public:
+    // Compact wire id of a transfer: slot index in the low 24 bits and the
+    // slot generation in the high 8 bits, so stale handles are rejected
+    using TransferHandle = uint32_t;
+    static constexpr TransferHandle INVALID_TRANSFER_HANDLE = 0;
+
     static constexpr size_t MIN_CHUNK_SIZE = 1024;     // 1 KB
     static constexpr size_t MAX_CHUNK_SIZE = 10485760; // 10 MB
+    // Failed checksums tolerated per chunk before the transfer is failed
+    static constexpr uint32_t MAX_CHUNK_RETRANSMISSIONS = 5;
 
-    explicit FileTransfer(std::shared_ptr<FileSystemManager> fs_manager);
+    FileTransfer(std::shared_ptr<FileSystemManager> fs_manager,
+                 std::shared_ptr<DiskIoExecutor>    disk_executor,
+                 boost::asio::any_io_executor       network_executor);
 
+    // Queues the file, it starts once the scheduler gives it a slot
     void startSending(const std::string& file_path, const std::string& peer_id);
+    // Queues every file below the directory. Large files go alone, small
+    // ones are packed into FileBundle transfers
+    void startSendingDirectory(const std::string& dir_path,
+                               const std::string& peer_id);
     void startReceiving(const FileMetadata& metadata,
-                        const std::string&  downloadPath = "");
-    void handleIncomingChunk(const ChunkMessage& chunk_msg);
-    void handleChunkMetrics(const std::string& file_id, size_t chunk_number,
+                        const std::string&  downloadPath = "",
+                        const std::string&  peer_id = "",
+                        uint32_t            connection_id = 0);
+    // Messages are dropped unless peer_id is the peer of the transfer
+    void handleIncomingChunk(const ChunkMessage& chunk_msg,
+                             const std::string&  peer_id,
+                             uint32_t            connection_id = 0);
+    // rtt is measured from the send time the ack echoes
+    void handleChunkMetrics(TransferHandle handle, size_t chunk_number,
                             size_t                    chunk_size,
-                            std::chrono::microseconds latency);
+                            std::chrono::microseconds rtt,
+                            const std::string&        peer_id);
+    void handleTransferFinalize(const TransferFinalize& finalize,
+                                const std::string&      peer_id,
+                                uint32_t                connection_id = 0);
+    void handleChunkRetransmitRequest(TransferHandle handle, size_t offset,
+                                      size_t             chunk_size,
+                                      const std::string& peer_id);
+    void handleTransferResume(TransferHandle                        handle,
+                              const std::vector<ExtentSet::Extent>& extents,
+                              const std::string&                    peer_id);
+    void handleBlockSignatures(const BlockSignatures& signatures,
+                               const std::string&     peer_id);
+    void handleDeltaCopy(const DeltaCopy&   delta_copy,
+                         const std::string& peer_id,
+                         uint32_t           connection_id = 0);
+    void handleTransferAbort(const TransferAbort& abort,
+                             const std::string&   peer_id,
+                             uint32_t             connection_id = 0);
+    // Fails every transfer with the peer and drops its queued files, once
+    // its connection is gone. Partial receives are kept for a resume
+    void cancelPeerTransfers(const std::string& peer_id);
     void pauseTransfer(const std::string& file_id);
     void resumeTransfer(const std::string& file_id);
     void cancelTransfer(const std::string& file_id);
 
+    void setInFlightLimits(size_t max_bytes, size_t max_chunks);
+    void setHashCache(std::shared_ptr<FileHashCache> hash_cache);
+    void setHashAlgorithm(HashAlgorithm algorithm);
+    void setScheduling(SchedulingPolicy policy, size_t max_active);
+    // Files up to this size travel inside their FileMetadata
+    void setInlineThreshold(size_t bytes);
+    void setDeltaTransfers(bool enable);
+    // Offers content-defined chunks the receiver may find in its store
+    void setContentChunking(bool enable);
+    void setChunkStore(std::shared_ptr<ChunkStore> chunk_store);
+    // Per-peer estimates new transfers warm-start their controller from
+    void setLinkEstimates(std::shared_ptr<LinkEstimateStore> link_estimates);
+    void setCompression(bool enable);
+    // Controller of chunk size and window for transfers started from now
+    void setChunkControlPolicy(ChunkControlPolicy policy);
+    void setPeerWeight(const std::string& peer_id, double weight);
+
     std::vector<std::string> getActiveTransfers() const;
     double getTransferProgress(const std::string& file_id) const;
-    size_t getOptimalChunkSize(const std::string& file_id) const;
+    double getTransferProgress(TransferHandle handle) const;
+    // Progress of every file sent (or received) since that side was last
+    // idle, including queued files
+    double getAggregateProgress(bool sending) const;
+    size_t getOptimalChunkSize(TransferHandle handle) const;
 
     bool isFileSending(const std::string& file_id) const;
+    // True once the peer has answered for an outgoing transfer, so chunks
+    // may take any stream without overtaking the metadata
+    bool isReceiverReady(TransferHandle handle) const;
 
-    using ChunkReadyCallback = std::function<void(const ChunkMessage&)>;
+    using ChunkReadyCallback = std::function<void(
+        const ChunkMessage& chunk, const std::string& peer_id)>;
     void setChunkReadyCallback(ChunkReadyCallback callback);
 
-    using FileMetadataCallback = std::function<void(const FileMetadata&)>;
+    using FileMetadataCallback = std::function<void(
+        const FileMetadata& metadata, const std::string& peer_id)>;
     void setFileMetadataCallback(FileMetadataCallback callback);
 
+    // Called once a received chunk is on disk, with the ack for the sender
+    using ChunkAckCallback = std::function<void(
+        const ChunkMetrics& ack, const std::string& peer_id)>;
+    void setChunkAckCallback(ChunkAckCallback callback);
+
+    // Sends the digest of a file whose metadata went out before hashing
+    using TransferFinalizeCallback = std::function<void(
+        const TransferFinalize& finalize, const std::string& peer_id)>;
+    void setTransferFinalizeCallback(TransferFinalizeCallback callback);
+
+    // Asks the sender again for a chunk that failed its checksum
+    using ChunkRetransmitCallback = std::function<void(
+        const ChunkRetransmitRequest& request, const std::string& peer_id)>;
+    void setChunkRetransmitCallback(ChunkRetransmitCallback callback);
+
+    // Tells the sender which ranges a resumed file already has on disk
+    using TransferResumeCallback = std::function<void(
+        const TransferResume& resume, const std::string& peer_id)>;
+    void setTransferResumeCallback(TransferResumeCallback callback);
+
+    // Signs the receiver's older copy of a file offered as a delta
+    using BlockSignaturesCallback = std::function<void(
+        const BlockSignatures& signatures, const std::string& peer_id)>;
+    void setBlockSignaturesCallback(BlockSignaturesCallback callback);
+
+    // Tells the receiver which ranges to take from its older copy
+    using DeltaCopyCallback = std::function<void(
+        const DeltaCopy& delta_copy, const std::string& peer_id)>;
+    void setDeltaCopyCallback(DeltaCopyCallback callback);
+
+    // Tells the peer this side gave up on a transfer
+    using TransferAbortCallback = std::function<void(
+        const TransferAbort& abort, const std::string& peer_id)>;
+    void setTransferAbortCallback(TransferAbortCallback callback);
+
     using TransferCompleteCallback =
         std::function<void(const std::string& file_id, bool success)>;
     void setTransferCompleteCallback(TransferCompleteCallback callback);
 
   private:
+    // Carried from a received chunk to its ack: the send time to echo and
+    // when the chunk arrived, to report how long it took to write
+    struct ChunkArrival
+    {
+        uint64_t                              send_time = 0;
+        std::chrono::steady_clock::time_point received_time;
+    };
+
     struct TransferInfo
     {
         std::string file_path;
@@ -58,24 +195,229 @@ class FileTransfer
         size_t      file_size;
         bool        is_sending;
         bool        is_paused;
+        // Empty until the digest is known: the sender streams chunks while
+        // hashing them and the receiver waits for the TransferFinalize
         std::string expected_hash;
 
-        std::unique_ptr<ChunkSizeOptimizer> chunk_size_optimizer;
+        std::unique_ptr<ChunkController> chunk_controller;
+
+        // Sent but not yet acknowledged chunks, offset -> size
+        std::map<size_t, size_t> unacked_chunks{};
+        size_t                   bytes_in_flight = 0;
+        // Offset -> bytes the chunk took on the wire after compression
+        std::unordered_map<size_t, size_t> wire_sizes{};
+        // Offset -> times the chunk was sent again after a failed checksum
+        std::unordered_map<size_t, uint32_t> retransmissions{};
+
+        std::string file_id{};
+        // Open for the lifetime of the transfer and shared with in-flight
+        // disk jobs, closed once the slot and the last job release it
+        std::shared_ptr<FileHandle> file_handle{};
+        // Set instead of file_handle for a bundle of small files
+        std::shared_ptr<FileBundle> bundle{};
+        // Sending side: the file as it was opened, which its digest is
+        // cached under
+        std::optional<FileHashCache::Key> hash_key{};
+        // Sending side: bytes read from disk so far, hashed as they arrive,
+        // plus ranges the receiver already had, which are never read
+        size_t    bytes_read = 0;
+        ExtentSet skipped_extents{};
+        bool      receiver_ready = false;
+        // Chunks wait until the receiver answers a delta or chunk offer
+        bool      awaiting_receiver = false;
+        // Receiving side: key of this transfer in inbound_routes_ and the
+        // sender's handle echoed in acks
+        uint64_t       inbound_route = 0;
+        TransferHandle remote_handle = INVALID_TRANSFER_HANDLE;
+        // Ranges on disk, mirrored by the journal so they survive restarts
+        ExtentSet                        received_extents{};
+        std::shared_ptr<TransferJournal> journal{};
+        // Older copy of the file moved aside for a delta, and the ranges
+        // still to be copied from it, one disk job at a time
+        std::shared_ptr<FileHandle> basis_handle{};
+        uint64_t                    basis_size = 0;
+        std::deque<DeltaCopy::Copy> pending_copies{};
+        bool                        is_copying = false;
+        // Chunks offered by the sender, indexed once the file is verified
+        std::vector<ContentChunker::Chunk> content_chunks{};
+        // Final digest being computed (sender) or checked (receiver)
+        bool           is_verifying = false;
+        // Digest of the bytes read (sender) or received (receiver)
+        HashAlgorithm hash_algorithm = HashAlgorithm::CRC32;
+        StreamingHash streaming_hash{};
+    };
+
+    // A chunk read from disk with the CRC32C carried in its frame, which
+    // covers the compressed bytes when there are any
+    struct ChunkData
+    {
+        std::vector<uint8_t>    data;
+        uint32_t                checksum = 0;
+        ChunkCompressor::Result compressed;
     };
 
-    std::shared_ptr<FileSystemManager>            fs_manager_;
-    std::unordered_map<std::string, TransferInfo> active_transfers_;
-    std::queue<std::string>                       transfer_queue_;
-    ChunkReadyCallback                            chunk_ready_callback_;
-    FileMetadataCallback                          file_metadata_callback_;
-    TransferCompleteCallback                      transfer_complete_callback_;
+    // Ranges of the new file filled from the basis by one disk job, with
+    // their data for the streaming digest
+    struct CopiedBlocks
+    {
+        bool                                                 copied = false;
+        std::vector<std::pair<uint64_t, ChunkMessage::Payload>> blocks;
+    };
 
-    void        processNextChunk(const std::string& file_id);
-    std::string generateFileId(const std::string& file_path,
-                               const std::string& peer_id);
-    void        checkTransferCompletion(const std::string& file_id);
+    // How a transfer ended. A receive that failed midway keeps its file and
+    // journal so the next attempt resumes from them, a cancelled or
+    // corrupted one is deleted
+    enum class TransferOutcome : uint8_t {
+        COMPLETED,
+        FAILED,
+        CANCELLED,
+        CORRUPTED, // the received file does not match the sender's digest
+        ABORTED,   // the peer gave up, kept like FAILED but not echoed back
+    };
+
+    struct TransferSlot
+    {
+        uint8_t                     generation = 1;
+        std::optional<TransferInfo> info;
+    };
 
-    std::vector<size_t> generatePossibleChunkSizes();
+    static constexpr uint32_t SLOT_INDEX_BITS = 24;
+    static constexpr uint32_t SLOT_INDEX_MASK = (1u << SLOT_INDEX_BITS) - 1;
+
+    std::shared_ptr<FileSystemManager> fs_manager_;
+    std::shared_ptr<DiskIoExecutor>    disk_executor_;
+    std::shared_ptr<FileHashCache>     hash_cache_;
+    std::shared_ptr<ChunkStore>        chunk_store_;
+    std::shared_ptr<LinkEstimateStore> link_estimates_;
+    boost::asio::any_io_executor       network_executor_;
+    std::vector<TransferSlot>          slots_;
+    std::vector<uint32_t>              free_slots_;
+    ChunkCompressor                    compressor_;
+    // Wire bytes acknowledged since link_sample_start_, for the compressor
+    size_t                                link_sample_bytes_ = 0;
+    std::chrono::steady_clock::time_point link_sample_start_;
+    std::chrono::steady_clock::time_point last_ack_time_;
+    std::unordered_map<std::string, TransferHandle> file_ids_;
+    // (connection id, sender handle) -> local handle of incoming transfers
+    std::unordered_map<uint64_t, TransferHandle> inbound_routes_;
+    // Inbound routes whose files are still being set up on the disk
+    // workers, with the messages for them that arrived meanwhile
+    std::unordered_map<uint64_t, std::vector<std::function<void()>>>
+                                                 pending_receives_;
+    // Times each peer was disconnected, so transfers still being set up
+    // on the disk workers notice their peer left meanwhile
+    std::unordered_map<std::string, uint64_t>    peer_disconnects_;
+    TransferScheduler                            scheduler_;
+    uint64_t                                     next_request_sequence_ = 0;
+    size_t                                       send_batch_bytes_ = 0;
+    size_t                                       send_batch_done_bytes_ = 0;
+    size_t                                       receive_batch_bytes_ = 0;
+    size_t                                       receive_batch_done_bytes_ = 0;
+    size_t                                       receiving_transfers_ = 0;
+    ChunkReadyCallback                           chunk_ready_callback_;
+    FileMetadataCallback                         file_metadata_callback_;
+    ChunkAckCallback                             chunk_ack_callback_;
+    TransferFinalizeCallback                     transfer_finalize_callback_;
+    ChunkRetransmitCallback                      chunk_retransmit_callback_;
+    TransferResumeCallback                       transfer_resume_callback_;
+    BlockSignaturesCallback                      block_signatures_callback_;
+    DeltaCopyCallback                            delta_copy_callback_;
+    TransferAbortCallback                        transfer_abort_callback_;
+    TransferCompleteCallback                     transfer_complete_callback_;
+    size_t                                       max_in_flight_bytes_;
+    size_t                                       max_in_flight_chunks_;
+    size_t                                       inline_threshold_;
+    bool                                         delta_transfers_;
+    bool                                         content_chunking_;
+    ChunkControlPolicy                           chunk_control_policy_;
+    HashAlgorithm                                hash_algorithm_;
+
+    TransferHandle      allocateTransfer(TransferInfo info);
+    void                releaseTransfer(TransferHandle handle);
+    TransferInfo*       findTransfer(TransferHandle handle);
+    const TransferInfo* findTransfer(TransferHandle handle) const;
+    TransferHandle      findHandle(const std::string& file_id) const;
+    // Null unless the transfer exists and belongs to peer_id
+    TransferInfo* findPeerTransfer(TransferHandle     handle,
+                                   const std::string& peer_id);
+    uint64_t      peerDisconnects(const std::string& peer_id) const;
+    TransferHandle      findReceivingTransfer(const std::string& file_path) const;
+
+    static uint64_t makeInboundRoute(uint32_t       connection_id,
+                                     TransferHandle remote_handle);
+
+    // Runs work on the disk executor and done(result) on the network
+    // executor, dropping the completion if FileTransfer is gone by then
+    template <typename Work, typename Done>
+    void runOnDisk(Work work, Done done);
+
+    void        dispatchQueuedTransfers();
+    void        beginSending(const TransferScheduler::Request& request);
+    void        processNextChunk(TransferHandle handle);
+    ChunkData   readChunk(const FileHandle& file, size_t offset,
+                          size_t size) const;
+    ChunkData   readChunk(const FileBundle& bundle, size_t offset,
+                          size_t size) const;
+    static void compressChunk(ChunkData& chunk, int level);
+    void        recordAckedWireBytes(size_t wire_size);
+    // Link estimates are kept per host, the port changes between
+    // connections
+    static std::string peerHost(const std::string& peer_id);
+    void        sendChunk(TransferHandle handle, size_t offset,
+                          size_t expected_size, ChunkData chunk,
+                          bool is_retransmission);
+    // Hashes received data and writes it to the file or bundle
+    void        writeReceivedData(TransferHandle handle, size_t offset,
+                                  ChunkMessage::Payload payload,
+                                  ChunkArrival          arrival);
+    void        handleChunkWritten(TransferHandle handle, size_t offset,
+                                   size_t size, bool written,
+                                   ChunkArrival arrival);
+    void        signBasis(TransferHandle handle);
+    void        applyDelta(TransferHandle                  handle,
+                           std::optional<DeltaSync::Delta> delta);
+    void        copyBasisBlocks(TransferHandle handle);
+    void        handleBlocksCopied(TransferHandle handle, CopiedBlocks copied);
+    // Fills offered chunks from the chunk store and the older copy
+    void        copyStoredChunks(TransferHandle handle);
+    void        handleStoredChunksCopied(TransferHandle handle,
+                                         ExtentSet      copied);
+    bool        isWindowOpen(const TransferInfo& info) const;
+    std::string generateFileId(const std::string& file_key,
+                               const std::string& peer_id);
+    void        finalizeSentHash(TransferHandle handle);
+    void        sendTransferFinalize(TransferHandle     handle,
+                                     const std::string& file_hash);
+    void        checkTransferCompletion(TransferHandle handle);
+    void        verifyReceivedFile(TransferHandle     handle,
+                                   const std::string& calculated_hash);
+    void        finishTransfer(TransferHandle handle, TransferOutcome outcome);
 };
 
+template <typename Work, typename Done>
+void FileTransfer::runOnDisk(Work work, Done done)
+{
+    disk_executor_->submit([work = std::move(work), done = std::move(done),
+                            executor = network_executor_,
+                            self = weak_from_this()]() mutable {
+        // A job that throws completes with an empty result, which every
+        // completion takes as its work having failed
+        decltype(work()) result{};
+        try
+        {
+            result = work();
+        } catch (const std::exception& e)
+        {
+            LOG_ERROR(QString("Disk job failed: %1").arg(e.what()));
+        }
+        boost::asio::post(executor, [self, done = std::move(done),
+                                     result = std::move(result)]() mutable {
+            if (auto transfer = self.lock())
+            {
+                done(std::move(result));
+            }
+        });
+    });
+}
+
 #endif // FILE_TRANSFER_HPP
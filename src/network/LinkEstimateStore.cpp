@@ -0,0 +1,185 @@
+#include "LinkEstimateStore.hpp"
+
+#include <vector>
+
+#include "Logger.hpp"
+#include "Message/WireFormat.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr uint32_t INDEX_MAGIC = 0x314c5351; // "QSL1"
+// bandwidth u64, min RTT u64, chunk size u64, window u64, updated i64,
+// then the host length
+constexpr size_t   RECORD_VALUE_SIZE = 40;
+constexpr int64_t  MAX_AGE_SECONDS =
+    std::chrono::seconds(LinkEstimateStore::MAX_AGE).count();
+
+} // namespace
+
+LinkEstimateStore::LinkEstimateStore(fs::path index_path) :
+    index_path_(std::move(index_path))
+{
+    load();
+}
+
+std::optional<LinkEstimate> LinkEstimateStore::lookup(const std::string& host)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto                        it = entries_.find(host);
+    if (it == entries_.end() || now() - it->second.updated > MAX_AGE_SECONDS)
+    {
+        return std::nullopt;
+    }
+    return it->second.estimate;
+}
+
+void LinkEstimateStore::update(const std::string&  host,
+                               const LinkEstimate& estimate)
+{
+    if (host.empty() || host.size() > MAX_HOST_SIZE)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.insert_or_assign(host, Entry{estimate, now(), false});
+}
+
+void LinkEstimateStore::save()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& [host, entry] : entries_)
+    {
+        if (!entry.saved)
+        {
+            appendRecord(host, entry);
+            entry.saved = true;
+        }
+    }
+}
+
+int64_t LinkEstimateStore::now()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void LinkEstimateStore::load()
+{
+    size_t record_count = 0;
+    bool   valid_index = false;
+    {
+        std::ifstream file(index_path_, std::ios::binary);
+        uint8_t       magic[4];
+        valid_index =
+            file.read(reinterpret_cast<char*>(magic), sizeof(magic)) &&
+            wire::getLE<uint32_t>(magic) == INDEX_MAGIC;
+        if (valid_index)
+        {
+            uint8_t record[RECORD_VALUE_SIZE + 1];
+            while (file.read(reinterpret_cast<char*>(record), sizeof(record)))
+            {
+                Entry entry;
+                entry.estimate.bandwidth =
+                    static_cast<double>(wire::getLE<uint64_t>(record));
+                entry.estimate.min_rtt = std::chrono::microseconds(
+                    wire::getLE<uint64_t>(record + 8));
+                entry.estimate.chunk_size =
+                    static_cast<size_t>(wire::getLE<uint64_t>(record + 16));
+                entry.estimate.window =
+                    static_cast<size_t>(wire::getLE<uint64_t>(record + 24));
+                entry.updated =
+                    static_cast<int64_t>(wire::getLE<uint64_t>(record + 32));
+                entry.saved = true;
+
+                std::string host(record[RECORD_VALUE_SIZE], '\0');
+                if (!file.read(host.data(), host.size()))
+                {
+                    break;
+                }
+                entries_.insert_or_assign(std::move(host), entry);
+                ++record_count;
+            }
+        }
+    }
+
+    // Expired estimates are dropped when the index is rewritten
+    int64_t oldest = now() - MAX_AGE_SECONDS;
+    std::erase_if(entries_, [oldest](const auto& item) {
+        return item.second.updated < oldest;
+    });
+
+    // Rewrite the index when superseded records dominate it
+    if (!valid_index || record_count > 2 * entries_.size())
+    {
+        compact();
+    } else {
+        index_.open(index_path_, std::ios::binary | std::ios::app);
+    }
+
+    LOG_INFO(
+        QString("Loaded link estimates for %1 peers").arg(entries_.size()));
+}
+
+void LinkEstimateStore::compact()
+{
+    fs::path tmp_path = index_path_;
+    tmp_path += ".tmp";
+
+    index_.close();
+    index_.open(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!index_)
+    {
+        LOG_WARNING(QString("Unable to write link estimate index: %1")
+                        .arg(tmp_path.string().c_str()));
+        return;
+    }
+
+    uint8_t magic[4];
+    wire::putLE<uint32_t>(magic, INDEX_MAGIC);
+    index_.write(reinterpret_cast<const char*>(magic), sizeof(magic));
+    for (const auto& [host, entry] : entries_)
+    {
+        appendRecord(host, entry);
+    }
+    index_.close();
+
+    std::error_code ec;
+    fs::rename(tmp_path, index_path_, ec);
+    if (ec)
+    {
+        LOG_WARNING(QString("Unable to replace link estimate index: %1")
+                        .arg(ec.message().c_str()));
+    }
+    index_.open(index_path_, std::ios::binary | std::ios::app);
+}
+
+void LinkEstimateStore::appendRecord(const std::string& host,
+                                     const Entry&       entry)
+{
+    if (!index_.is_open())
+    {
+        return;
+    }
+
+    std::vector<uint8_t> record(RECORD_VALUE_SIZE + 1 + host.size());
+    wire::putLE<uint64_t>(record.data(),
+                          static_cast<uint64_t>(entry.estimate.bandwidth));
+    wire::putLE<uint64_t>(
+        record.data() + 8,
+        static_cast<uint64_t>(entry.estimate.min_rtt.count()));
+    wire::putLE<uint64_t>(record.data() + 16, entry.estimate.chunk_size);
+    wire::putLE<uint64_t>(record.data() + 24, entry.estimate.window);
+    wire::putLE<uint64_t>(record.data() + 32,
+                          static_cast<uint64_t>(entry.updated));
+    record[RECORD_VALUE_SIZE] = static_cast<uint8_t>(host.size());
+    std::copy(host.begin(), host.end(),
+              record.begin() + RECORD_VALUE_SIZE + 1);
+
+    index_.write(reinterpret_cast<const char*>(record.data()), record.size());
+    index_.flush();
+}
@@ -0,0 +1,54 @@
+#ifndef LINK_ESTIMATE_STORE_HPP
+#define LINK_ESTIMATE_STORE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "ChunkController.hpp"
+
+// The last link estimate per peer host, so transfers to a peer start at
+// the operating point earlier ones found instead of probing for it again.
+// Transfers running at the same time share one entry. Updates stay in
+// memory until save(), which appends them to a binary index reloaded on
+// the next start, like FileHashCache. Safe to use from several threads
+class LinkEstimateStore
+{
+  public:
+    // Older estimates describe a network the peer may have left
+    static constexpr std::chrono::hours MAX_AGE{24 * 7};
+    static constexpr size_t             MAX_HOST_SIZE = 255;
+
+    explicit LinkEstimateStore(std::filesystem::path index_path);
+
+    std::optional<LinkEstimate> lookup(const std::string& host);
+    void update(const std::string& host, const LinkEstimate& estimate);
+    // Persists the hosts updated since the last save
+    void save();
+
+  private:
+    struct Entry
+    {
+        LinkEstimate estimate;
+        int64_t      updated = 0; // seconds since the Unix epoch
+        bool         saved = false;
+    };
+
+    static int64_t now();
+
+    void load();
+    void compact();
+    void appendRecord(const std::string& host, const Entry& entry);
+
+    std::filesystem::path                  index_path_;
+    std::mutex                             mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::ofstream                          index_;
+};
+
+#endif // LINK_ESTIMATE_STORE_HPP
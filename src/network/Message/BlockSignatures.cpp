@@ -0,0 +1,29 @@
+#include "BlockSignatures.hpp"
+
+BlockSignatures::BlockSignatures(uint32_t transfer_handle, uint32_t block_size,
+                                 uint64_t               basis_size,
+                                 std::vector<Signature> signatures) :
+    transfer_handle_(transfer_handle),
+    block_size_(block_size), basis_size_(basis_size),
+    signatures_(std::move(signatures))
+{}
+
+std::vector<uint8_t> BlockSignatures::serialize() const
+{
+    std::ostringstream              oss;
+    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
+    oa << *this;
+    const std::string& str = oss.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+BlockSignatures
+BlockSignatures::deserialize(const std::vector<uint8_t>& serialized)
+{
+    BlockSignatures                 signatures;
+    std::string                     str(serialized.begin(), serialized.end());
+    std::istringstream              iss(str);
+    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
+    ia >> signatures;
+    return signatures;
+}
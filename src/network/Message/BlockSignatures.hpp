@@ -0,0 +1,66 @@
+#ifndef BLOCK_SIGNATURES_HPP
+#define BLOCK_SIGNATURES_HPP
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/vector.hpp>
+#include <sstream>
+#include <vector>
+
+#include "Message.hpp"
+
+// Sent by the receiver of a delta transfer, signing each block of the older
+// copy it already has. The last block may be shorter than the others
+class BlockSignatures : public Message
+{
+  public:
+    struct Signature
+    {
+        uint32_t weak = 0;   // rolling checksum
+        uint64_t strong = 0; // xxHash64
+
+        template <class Archive>
+        void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & weak;
+            ar & strong;
+        }
+    };
+
+    BlockSignatures() = default;
+    BlockSignatures(uint32_t transfer_handle, uint32_t block_size,
+                    uint64_t basis_size, std::vector<Signature> signatures);
+
+    MessageType getType() const override
+    {
+        return MessageType::BLOCK_SIGNATURES;
+    }
+
+    uint32_t getTransferHandle() const { return transfer_handle_; }
+    uint32_t getBlockSize() const { return block_size_; }
+    uint64_t getBasisSize() const { return basis_size_; }
+    const std::vector<Signature>& getSignatures() const { return signatures_; }
+
+    std::vector<uint8_t>   serialize() const override;
+    static BlockSignatures deserialize(const std::vector<uint8_t>& serialized);
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & transfer_handle_;
+        ar & block_size_;
+        ar & basis_size_;
+        ar & signatures_;
+    }
+
+    uint32_t               transfer_handle_;
+    uint32_t               block_size_;
+    uint64_t               basis_size_;
+    std::vector<Signature> signatures_;
+};
+
+#endif // BLOCK_SIGNATURES_HPP
@@ -1,26 +1,109 @@
 #include "ChunkMessage.hpp"
 
-ChunkMessage::ChunkMessage(const std::string& file_id, size_t offset,
-                           const std::vector<uint8_t>& data) :
-    file_id_(file_id),
-    offset_(offset), data_(data)
+ChunkMessage::ChunkMessage() :
+    transfer_handle_(0), offset_(0),
+    data_(std::make_shared<const std::vector<uint8_t>>()), flags_(0),
+    checksum_(0), data_size_(0), send_time_(0)
 {}
 
+ChunkMessage::ChunkMessage(uint32_t transfer_handle, size_t offset,
+                           std::vector<uint8_t> data) :
+    transfer_handle_(transfer_handle),
+    offset_(offset),
+    data_(std::make_shared<const std::vector<uint8_t>>(std::move(data))),
+    flags_(0), checksum_(0), data_size_(0), send_time_(0)
+{}
+
+ChunkMessage::ChunkMessage(uint32_t transfer_handle, size_t offset,
+                           Payload data) :
+    transfer_handle_(transfer_handle),
+    offset_(offset), data_(std::move(data)), flags_(0), checksum_(0),
+    data_size_(0), send_time_(0)
+{}
+
+void ChunkMessage::setChecksum(uint32_t checksum)
+{
+    flags_ |= FLAG_CHECKSUM;
+    checksum_ = checksum;
+}
+
+uint32_t ChunkMessage::getDataSize() const
+{
+    return isCompressed() ? data_size_ : static_cast<uint32_t>(data_->size());
+}
+
+void ChunkMessage::setCompressed(uint32_t data_size)
+{
+    flags_ |= FLAG_COMPRESSED;
+    data_size_ = data_size;
+}
+
+uint64_t ChunkMessage::timestamp(std::chrono::steady_clock::time_point time)
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            time.time_since_epoch())
+            .count());
+}
+
+std::vector<uint8_t> ChunkMessage::serializeHeader() const
+{
+    std::vector<uint8_t> header(HEADER_SIZE);
+    wire::putLE<uint64_t>(header.data(), offset_);
+    wire::putLE<uint32_t>(header.data() + 8,
+                          static_cast<uint32_t>(data_->size()));
+    wire::putLE<uint32_t>(header.data() + 12, transfer_handle_);
+    wire::putLE<uint32_t>(header.data() + 16, flags_);
+    wire::putLE<uint32_t>(header.data() + 20, checksum_);
+    wire::putLE<uint32_t>(header.data() + 24, getDataSize());
+    wire::putLE<uint64_t>(header.data() + 28, send_time_);
+    return header;
+}
+
+ChunkMessage::Header ChunkMessage::parseHeader(const uint8_t* data)
+{
+    Header header;
+    header.offset = wire::getLE<uint64_t>(data);
+    header.payload_size = wire::getLE<uint32_t>(data + 8);
+    header.transfer_handle = wire::getLE<uint32_t>(data + 12);
+    header.flags = wire::getLE<uint32_t>(data + 16);
+    header.checksum = wire::getLE<uint32_t>(data + 20);
+    header.data_size = wire::getLE<uint32_t>(data + 24);
+    header.send_time = wire::getLE<uint64_t>(data + 28);
+    return header;
+}
+
 std::vector<uint8_t> ChunkMessage::serialize() const
 {
-    std::ostringstream              oss;
-    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
-    oa << *this;
-    const std::string& str = oss.str();
-    return std::vector<uint8_t>(str.begin(), str.end());
+    std::vector<uint8_t> serialized = serializeHeader();
+    serialized.insert(serialized.end(), data_->begin(), data_->end());
+    return serialized;
 }
 
 ChunkMessage ChunkMessage::deserialize(const std::vector<uint8_t>& serialized)
 {
-    ChunkMessage                    chunk;
-    std::string                     str(serialized.begin(), serialized.end());
-    std::istringstream              iss(str);
-    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
-    ia >> chunk;
+    if (serialized.size() < HEADER_SIZE)
+    {
+        throw std::runtime_error("Chunk message is too short");
+    }
+
+    Header header = parseHeader(serialized.data());
+    if (serialized.size() != HEADER_SIZE + header.payload_size)
+    {
+        throw std::runtime_error("Chunk message size mismatch");
+    }
+
+    ChunkMessage chunk(header.transfer_handle, header.offset,
+                       std::vector<uint8_t>(serialized.begin() + HEADER_SIZE,
+                                            serialized.end()));
+    if (header.flags & FLAG_CHECKSUM)
+    {
+        chunk.setChecksum(header.checksum);
+    }
+    if (header.flags & FLAG_COMPRESSED)
+    {
+        chunk.setCompressed(header.data_size);
+    }
+    chunk.setSendTime(header.send_time);
     return chunk;
 }
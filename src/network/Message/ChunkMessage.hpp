@@ -1,46 +1,93 @@
 #ifndef CHUNK_MESSAGE_HPP
 #define CHUNK_MESSAGE_HPP
 
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
-#include <boost/serialization/access.hpp>
-#include <boost/serialization/string.hpp>
-#include <boost/serialization/vector.hpp>
-#include <sstream>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "Message.hpp"
+#include "WireFormat.hpp"
 
+// Chunks bypass boost::archive: the body is a fixed little-endian header
+// followed by the payload, so the payload can be written and read as a
+// separate buffer without being copied
+//
+//   offset          u64
+//   payload size    u32
+//   transfer handle u32 (assigned by the sender in FileMetadata)
+//   flags           u32 (FLAG_* bits)
+//   checksum        u32 (CRC32C of the payload when FLAG_CHECKSUM is set)
+//   data size       u32 (payload size before compression)
+//   send time       u64 (sender's steady clock in microseconds, echoed in
+//                        ChunkMetrics)
+//   payload         payload size bytes, raw deflate when FLAG_COMPRESSED
 class ChunkMessage : public Message
 {
   public:
-    ChunkMessage() = default;
-    ChunkMessage(const std::string& file_id, size_t offset,
-                 const std::vector<uint8_t>& data);
+    using Payload = std::shared_ptr<const std::vector<uint8_t>>;
+
+    static constexpr size_t HEADER_SIZE = 36;
+
+    static constexpr uint32_t FLAG_CHECKSUM = 1u << 0;
+    static constexpr uint32_t FLAG_COMPRESSED = 1u << 1;
+
+    struct Header
+    {
+        uint64_t offset = 0;
+        uint32_t payload_size = 0;
+        uint32_t transfer_handle = 0;
+        uint32_t flags = 0;
+        uint32_t checksum = 0;
+        uint32_t data_size = 0;
+        uint64_t send_time = 0;
+    };
+
+    ChunkMessage();
+    ChunkMessage(uint32_t transfer_handle, size_t offset,
+                 std::vector<uint8_t> data);
+    ChunkMessage(uint32_t transfer_handle, size_t offset, Payload data);
 
     MessageType getType() const override { return MessageType::CHUNK; }
 
-    const std::string&          getFileId() const { return file_id_; }
-    size_t                      getOffset() const { return offset_; }
-    const std::vector<uint8_t>& getData() const { return data_; }
+    uint32_t getTransferHandle() const { return transfer_handle_; }
+    size_t   getOffset() const { return offset_; }
+
+    const std::vector<uint8_t>& getData() const { return *data_; }
+    const Payload&              getPayload() const { return data_; }
+
+    bool     hasChecksum() const { return (flags_ & FLAG_CHECKSUM) != 0; }
+    uint32_t getChecksum() const { return checksum_; }
+    void     setChecksum(uint32_t checksum);
+
+    // The payload is compressed data that inflates to data_size bytes
+    bool     isCompressed() const { return (flags_ & FLAG_COMPRESSED) != 0; }
+    uint32_t getDataSize() const;
+    void     setCompressed(uint32_t data_size);
+
+    // Opaque to the receiver, which only echoes it back, so the sender
+    // measures the round trip on its own monotonic clock
+    uint64_t getSendTime() const { return send_time_; }
+    void     setSendTime(uint64_t send_time) { send_time_ = send_time; }
+    // Send time encoding of a steady clock reading
+    static uint64_t timestamp(std::chrono::steady_clock::time_point time);
+
+    // Header only, the payload is sent from getPayload()
+    std::vector<uint8_t> serializeHeader() const;
+    static Header        parseHeader(const uint8_t* data);
 
     std::vector<uint8_t> serialize() const override;
     static ChunkMessage  deserialize(const std::vector<uint8_t>& serialized);
 
   private:
-    friend class boost::serialization::access;
-
-    template <class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & file_id_;
-        ar & offset_;
-        ar & data_;
-    }
-
-    std::string          file_id_;
-    size_t               offset_;
-    std::vector<uint8_t> data_;
+    uint32_t transfer_handle_;
+    size_t   offset_;
+    Payload  data_;
+    uint32_t flags_;
+    uint32_t checksum_;
+    uint32_t data_size_;
+    uint64_t send_time_;
 };
 
 #endif // CHUNK_MESSAGE_HPP
@@ -1,20 +1,26 @@
 #include "ChunkMetrics.hpp"
 
-ChunkMetrics::ChunkMetrics(
-    const std::string& file_id, size_t offset, size_t chunk_size,
-    std::chrono::system_clock::time_point received_time) :
-    file_id_(file_id),
-    offset_(offset), chunk_size_(chunk_size)
+ChunkMetrics::ChunkMetrics(uint32_t transfer_handle, size_t offset,
+                           size_t chunk_size, uint64_t send_time,
+                           std::chrono::microseconds processing_time) :
+    transfer_handle_(transfer_handle),
+    offset_(offset), chunk_size_(chunk_size), send_time_(send_time),
+    processing_time_(processing_time.count())
+{}
+
+std::chrono::microseconds ChunkMetrics::getProcessingTime() const
 {
-    received_time_ = std::chrono::duration_cast<std::chrono::microseconds>(
-                         received_time.time_since_epoch())
-                         .count();
+    return std::chrono::microseconds(processing_time_);
 }
 
-std::chrono::system_clock::time_point ChunkMetrics::getReceivedTime() const
+std::chrono::microseconds ChunkMetrics::getRoundTripTime() const
 {
-    return std::chrono::system_clock::time_point(
-        std::chrono::microseconds(received_time_));
+    uint64_t now = ChunkMessage::timestamp(std::chrono::steady_clock::now());
+    if (send_time_ == 0 || send_time_ > now)
+    {
+        return std::chrono::microseconds(0);
+    }
+    return std::chrono::microseconds(now - send_time_);
 }
 
 std::vector<uint8_t> ChunkMetrics::serialize() const
@@ -9,21 +9,29 @@
 #include <sstream>
 #include <vector>
 
+#include "ChunkMessage.hpp"
 #include "Message.hpp"
 
 class ChunkMetrics : public Message
 {
   public:
     ChunkMetrics() = default;
-    ChunkMetrics(const std::string& file_id, size_t offset, size_t chunk_size,
-                 std::chrono::system_clock::time_point received_time);
+    ChunkMetrics(uint32_t transfer_handle, size_t offset, size_t chunk_size,
+                 uint64_t                  send_time,
+                 std::chrono::microseconds processing_time);
 
     MessageType getType() const override { return MessageType::CHUNK_METRICS; }
 
-    const std::string& getFileId() const { return file_id_; }
-    size_t             getOffset() const { return offset_; }
-    size_t             getChunkSize() const { return chunk_size_; }
-    std::chrono::system_clock::time_point getReceivedTime() const;
+    uint32_t getTransferHandle() const { return transfer_handle_; }
+    size_t   getOffset() const { return offset_; }
+    size_t   getChunkSize() const { return chunk_size_; }
+    // The chunk's send time, echoed back unchanged
+    uint64_t getSendTime() const { return send_time_; }
+    // From the chunk arriving to it being written, on the receiver
+    std::chrono::microseconds getProcessingTime() const;
+    // From sending the chunk to now, on the sender's clock. Zero when the
+    // chunk carried no send time
+    std::chrono::microseconds getRoundTripTime() const;
 
     std::vector<uint8_t> serialize() const override;
     static ChunkMetrics  deserialize(const std::vector<uint8_t>& serialized);
@@ -34,16 +42,18 @@ class ChunkMetrics : public Message
     template <class Archive>
     void serialize(Archive& ar, const unsigned int version)
     {
-        ar & file_id_;
+        ar & transfer_handle_;
         ar & offset_;
         ar & chunk_size_;
-        ar & received_time_;
+        ar & send_time_;
+        ar & processing_time_;
     }
 
-    std::string file_id_;
-    size_t      offset_;
-    size_t      chunk_size_;
-    int64_t     received_time_;
+    uint32_t transfer_handle_;
+    size_t   offset_;
+    size_t   chunk_size_;
+    uint64_t send_time_;
+    int64_t  processing_time_;
 };
 
 #endif // CHUNK_ACKNOWLEDGEMENT_HPP
@@ -0,0 +1,28 @@
+#include "ChunkRetransmitRequest.hpp"
+
+ChunkRetransmitRequest::ChunkRetransmitRequest(uint32_t transfer_handle,
+                                               size_t   offset,
+                                               size_t   chunk_size) :
+    transfer_handle_(transfer_handle),
+    offset_(offset), chunk_size_(chunk_size)
+{}
+
+std::vector<uint8_t> ChunkRetransmitRequest::serialize() const
+{
+    std::ostringstream              oss;
+    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
+    oa << *this;
+    const std::string& str = oss.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+ChunkRetransmitRequest
+ChunkRetransmitRequest::deserialize(const std::vector<uint8_t>& serialized)
+{
+    ChunkRetransmitRequest          request;
+    std::string                     str(serialized.begin(), serialized.end());
+    std::istringstream              iss(str);
+    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
+    ia >> request;
+    return request;
+}
@@ -0,0 +1,50 @@
+#ifndef CHUNK_RETRANSMIT_REQUEST_HPP
+#define CHUNK_RETRANSMIT_REQUEST_HPP
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <sstream>
+#include <vector>
+
+#include "Message.hpp"
+
+// Sent by the receiver when a chunk fails its checksum, asking the sender to
+// send that chunk again
+class ChunkRetransmitRequest : public Message
+{
+  public:
+    ChunkRetransmitRequest() = default;
+    ChunkRetransmitRequest(uint32_t transfer_handle, size_t offset,
+                           size_t chunk_size);
+
+    MessageType getType() const override
+    {
+        return MessageType::CHUNK_RETRANSMIT;
+    }
+
+    uint32_t getTransferHandle() const { return transfer_handle_; }
+    size_t   getOffset() const { return offset_; }
+    size_t   getChunkSize() const { return chunk_size_; }
+
+    std::vector<uint8_t> serialize() const override;
+    static ChunkRetransmitRequest
+    deserialize(const std::vector<uint8_t>& serialized);
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & transfer_handle_;
+        ar & offset_;
+        ar & chunk_size_;
+    }
+
+    uint32_t transfer_handle_;
+    size_t   offset_;
+    size_t   chunk_size_;
+};
+
+#endif // CHUNK_RETRANSMIT_REQUEST_HPP
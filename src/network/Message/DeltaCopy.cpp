@@ -0,0 +1,24 @@
+#include "DeltaCopy.hpp"
+
+DeltaCopy::DeltaCopy(uint32_t transfer_handle, std::vector<Copy> copies) :
+    transfer_handle_(transfer_handle), copies_(std::move(copies))
+{}
+
+std::vector<uint8_t> DeltaCopy::serialize() const
+{
+    std::ostringstream              oss;
+    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
+    oa << *this;
+    const std::string& str = oss.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+DeltaCopy DeltaCopy::deserialize(const std::vector<uint8_t>& serialized)
+{
+    DeltaCopy                       delta_copy;
+    std::string                     str(serialized.begin(), serialized.end());
+    std::istringstream              iss(str);
+    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
+    ia >> delta_copy;
+    return delta_copy;
+}
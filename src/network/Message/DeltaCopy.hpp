@@ -0,0 +1,58 @@
+#ifndef DELTA_COPY_HPP
+#define DELTA_COPY_HPP
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/vector.hpp>
+#include <sstream>
+#include <vector>
+
+#include "Message.hpp"
+
+// Sent by the sender of a delta transfer, listing the ranges the receiver
+// copies from its older copy. Everything else arrives as chunks
+class DeltaCopy : public Message
+{
+  public:
+    struct Copy
+    {
+        uint64_t offset = 0;       // in the new file
+        uint64_t basis_offset = 0; // in the receiver's older copy
+        uint64_t size = 0;
+
+        template <class Archive>
+        void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & offset;
+            ar & basis_offset;
+            ar & size;
+        }
+    };
+
+    DeltaCopy() = default;
+    DeltaCopy(uint32_t transfer_handle, std::vector<Copy> copies);
+
+    MessageType getType() const override { return MessageType::DELTA_COPY; }
+
+    uint32_t getTransferHandle() const { return transfer_handle_; }
+    const std::vector<Copy>& getCopies() const { return copies_; }
+
+    std::vector<uint8_t> serialize() const override;
+    static DeltaCopy     deserialize(const std::vector<uint8_t>& serialized);
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & transfer_handle_;
+        ar & copies_;
+    }
+
+    uint32_t          transfer_handle_;
+    std::vector<Copy> copies_;
+};
+
+#endif // DELTA_COPY_HPP
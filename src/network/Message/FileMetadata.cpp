@@ -1,10 +1,14 @@
 #include "FileMetadata.hpp"
 
-FileMetadata::FileMetadata(const std::string& file_id,
+FileMetadata::FileMetadata(const std::string& file_id, uint32_t transfer_handle,
                            const std::string& file_name, size_t file_size,
-                           const std::string& file_hash) :
+                           const std::string& file_hash,
+                           uint8_t            hash_algorithm,
+                           uint64_t           file_version) :
     file_id_(file_id),
-    file_name_(file_name), file_size_(file_size), file_hash_(file_hash)
+    transfer_handle_(transfer_handle), file_name_(file_name),
+    file_size_(file_size), file_hash_(file_hash),
+    hash_algorithm_(hash_algorithm), file_version_(file_version)
 {}
 
 std::vector<uint8_t> FileMetadata::serialize() const
@@ -4,6 +4,7 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
 #include <sstream>
 #include <vector>
 
@@ -12,16 +13,98 @@
 class FileMetadata : public Message
 {
   public:
+    // Small file packed into a bundle transfer. Its bytes follow those of
+    // the previous entry and its name is relative to the bundle's file name
+    struct BundleEntry
+    {
+        std::string name;
+        uint64_t    size = 0;
+
+        template <class Archive>
+        void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & name;
+            ar & size;
+        }
+    };
+
+    // Content-defined chunk of the file, identified by its contents. The
+    // chunks follow each other from offset 0
+    struct ContentChunk
+    {
+        uint32_t size = 0;
+        uint64_t hash = 0;     // xxHash64
+        uint32_t checksum = 0; // CRC32C
+
+        bool operator==(const ContentChunk& other) const = default;
+
+        template <class Archive>
+        void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & size;
+            ar & hash;
+            ar & checksum;
+        }
+    };
+
     FileMetadata() = default;
-    FileMetadata(const std::string& file_id, const std::string& file_name,
-                 size_t file_size, const std::string& file_hash);
+    FileMetadata(const std::string& file_id, uint32_t transfer_handle,
+                 const std::string& file_name, size_t file_size,
+                 const std::string& file_hash, uint8_t hash_algorithm,
+                 uint64_t file_version);
 
     MessageType getType() const override { return MessageType::FILE_METADATA; }
 
     const std::string& getFileId() const { return file_id_; }
+    uint32_t           getTransferHandle() const { return transfer_handle_; }
     const std::string& getFileName() const { return file_name_; }
     size_t             getFileSize() const { return file_size_; }
+    // Empty when the sender streams before hashing; the digest then arrives
+    // in a TransferFinalize
     const std::string& getFileHash() const { return file_hash_; }
+    // HashAlgorithm chosen by the sender, a receiver that does not know it
+    // refuses the transfer
+    uint8_t getHashAlgorithm() const { return hash_algorithm_; }
+    // Modification time of the source, tells a resumable partial file of
+    // the same version apart from a stale one
+    uint64_t getFileVersion() const { return file_version_; }
+
+    // A bundle names a directory and carries the files to unpack into it
+    bool isBundle() const { return !bundle_entries_.empty(); }
+    const std::vector<BundleEntry>& getBundleEntries() const
+    {
+        return bundle_entries_;
+    }
+    void setBundleEntries(std::vector<BundleEntry> entries)
+    {
+        bundle_entries_ = std::move(entries);
+    }
+
+    // Whole contents of a small file, sent instead of chunks
+    bool hasInlineData() const { return has_inline_data_; }
+    const std::vector<uint8_t>& getInlineData() const { return inline_data_; }
+    void setInlineData(std::vector<uint8_t> data)
+    {
+        inline_data_ = std::move(data);
+        has_inline_data_ = true;
+    }
+
+    // The sender holds its chunks until the receiver answers with
+    // BlockSignatures of an older copy, or with a TransferResume
+    bool isDeltaOffered() const { return delta_offered_; }
+    void setDeltaOffered(bool offered) { delta_offered_ = offered; }
+
+    // Chunks the receiver may already have in its chunk store. The sender
+    // holds its chunks until a TransferResume lists the ranges it found
+    bool hasChunkOffer() const { return !offered_chunks_.empty(); }
+    const std::vector<ContentChunk>& getOfferedChunks() const
+    {
+        return offered_chunks_;
+    }
+    void setOfferedChunks(std::vector<ContentChunk> chunks)
+    {
+        offered_chunks_ = std::move(chunks);
+    }
 
     std::vector<uint8_t> serialize() const override;
     static FileMetadata  deserialize(const std::vector<uint8_t>& serialized);
@@ -33,15 +116,32 @@ class FileMetadata : public Message
     void serialize(Archive& ar, const unsigned int version)
     {
         ar & file_id_;
+        ar & transfer_handle_;
         ar & file_name_;
         ar & file_size_;
         ar & file_hash_;
+        ar & hash_algorithm_;
+        ar & file_version_;
+        ar & bundle_entries_;
+        ar & has_inline_data_;
+        ar & inline_data_;
+        ar & delta_offered_;
+        ar & offered_chunks_;
     }
 
     std::string file_id_;
+    uint32_t    transfer_handle_;
     std::string file_name_;
     size_t      file_size_;
     std::string file_hash_;
+    uint8_t     hash_algorithm_;
+    uint64_t    file_version_;
+
+    std::vector<BundleEntry>  bundle_entries_;
+    bool                      has_inline_data_ = false;
+    std::vector<uint8_t>      inline_data_;
+    bool                      delta_offered_ = false;
+    std::vector<ContentChunk> offered_chunks_;
 };
 
 #endif // FILE_METADATA_HPP
@@ -12,6 +12,16 @@ enum class MessageType : uint8_t {
     FILE_METADATA,
     CHUNK,
     CHUNK_METRICS,
+    TRANSFER_FINALIZE,
+    CHUNK_RETRANSMIT,
+    TRANSFER_RESUME,
+    STREAM_HELLO,
+    BLOCK_SIGNATURES,
+    DELTA_COPY,
+    TRANSFER_ABORT,
+    // More payload of the chunk the connection is receiving, written by
+    // PeerConnection between other messages and never handed out
+    CHUNK_FRAME,
 };
 
 class Message
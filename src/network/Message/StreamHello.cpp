@@ -0,0 +1,26 @@
+#include "StreamHello.hpp"
+
+StreamHello::StreamHello(uint64_t session_id, uint32_t stream_index,
+                         uint32_t stream_count) :
+    session_id_(session_id), stream_index_(stream_index),
+    stream_count_(stream_count)
+{}
+
+std::vector<uint8_t> StreamHello::serialize() const
+{
+    std::ostringstream              oss;
+    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
+    oa << *this;
+    const std::string& str = oss.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+StreamHello StreamHello::deserialize(const std::vector<uint8_t>& serialized)
+{
+    StreamHello                     hello;
+    std::string                     str(serialized.begin(), serialized.end());
+    std::istringstream              iss(str);
+    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
+    ia >> hello;
+    return hello;
+}
@@ -0,0 +1,47 @@
+#ifndef STREAM_HELLO_HPP
+#define STREAM_HELLO_HPP
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <sstream>
+#include <vector>
+
+#include "Message.hpp"
+
+// First message on every connection the connecting side opens to a peer.
+// Stream 0 is the control connection, the others carry only chunks and are
+// grouped with it through the shared session id
+class StreamHello : public Message
+{
+  public:
+    StreamHello() = default;
+    StreamHello(uint64_t session_id, uint32_t stream_index,
+                uint32_t stream_count);
+
+    MessageType getType() const override { return MessageType::STREAM_HELLO; }
+
+    uint64_t getSessionId() const { return session_id_; }
+    uint32_t getStreamIndex() const { return stream_index_; }
+    uint32_t getStreamCount() const { return stream_count_; }
+
+    std::vector<uint8_t> serialize() const override;
+    static StreamHello   deserialize(const std::vector<uint8_t>& serialized);
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & session_id_;
+        ar & stream_index_;
+        ar & stream_count_;
+    }
+
+    uint64_t session_id_;
+    uint32_t stream_index_;
+    uint32_t stream_count_;
+};
+
+#endif // STREAM_HELLO_HPP
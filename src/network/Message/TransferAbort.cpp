@@ -0,0 +1,25 @@
+#include "TransferAbort.hpp"
+
+TransferAbort::TransferAbort(uint32_t transfer_handle, bool from_sender) :
+    transfer_handle_(transfer_handle),
+    from_sender_(from_sender)
+{}
+
+std::vector<uint8_t> TransferAbort::serialize() const
+{
+    std::ostringstream              oss;
+    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
+    oa << *this;
+    const std::string& str = oss.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+TransferAbort TransferAbort::deserialize(const std::vector<uint8_t>& serialized)
+{
+    TransferAbort                   abort;
+    std::string                     str(serialized.begin(), serialized.end());
+    std::istringstream              iss(str);
+    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
+    ia >> abort;
+    return abort;
+}
@@ -0,0 +1,46 @@
+#ifndef TRANSFER_ABORT_HPP
+#define TRANSFER_ABORT_HPP
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <sstream>
+#include <vector>
+
+#include "Message.hpp"
+
+// Sent by either side when it gives up on a transfer, so the other side
+// stops waiting for it. The handle is always the sender's, which the
+// receiver maps through its inbound routes
+class TransferAbort : public Message
+{
+  public:
+    TransferAbort() = default;
+    TransferAbort(uint32_t transfer_handle, bool from_sender);
+
+    MessageType getType() const override
+    {
+        return MessageType::TRANSFER_ABORT;
+    }
+
+    uint32_t getTransferHandle() const { return transfer_handle_; }
+    bool     isFromSender() const { return from_sender_; }
+
+    std::vector<uint8_t> serialize() const override;
+    static TransferAbort deserialize(const std::vector<uint8_t>& serialized);
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & transfer_handle_;
+        ar & from_sender_;
+    }
+
+    uint32_t transfer_handle_;
+    bool     from_sender_;
+};
+
+#endif // TRANSFER_ABORT_HPP
@@ -0,0 +1,27 @@
+#include "TransferFinalize.hpp"
+
+TransferFinalize::TransferFinalize(uint32_t           transfer_handle,
+                                   const std::string& file_hash) :
+    transfer_handle_(transfer_handle),
+    file_hash_(file_hash)
+{}
+
+std::vector<uint8_t> TransferFinalize::serialize() const
+{
+    std::ostringstream              oss;
+    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
+    oa << *this;
+    const std::string& str = oss.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+TransferFinalize
+TransferFinalize::deserialize(const std::vector<uint8_t>& serialized)
+{
+    TransferFinalize                finalize;
+    std::string                     str(serialized.begin(), serialized.end());
+    std::istringstream              iss(str);
+    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
+    ia >> finalize;
+    return finalize;
+}
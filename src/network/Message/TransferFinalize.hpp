@@ -0,0 +1,45 @@
+#ifndef TRANSFER_FINALIZE_HPP
+#define TRANSFER_FINALIZE_HPP
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <sstream>
+#include <vector>
+
+#include "Message.hpp"
+
+// Trails a transfer whose FileMetadata went out before the sender finished
+// hashing the file, carrying the whole-file digest the receiver verifies
+class TransferFinalize : public Message
+{
+  public:
+    TransferFinalize() = default;
+    TransferFinalize(uint32_t transfer_handle, const std::string& file_hash);
+
+    MessageType getType() const override
+    {
+        return MessageType::TRANSFER_FINALIZE;
+    }
+
+    uint32_t           getTransferHandle() const { return transfer_handle_; }
+    const std::string& getFileHash() const { return file_hash_; }
+
+    std::vector<uint8_t>    serialize() const override;
+    static TransferFinalize deserialize(const std::vector<uint8_t>& serialized);
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & transfer_handle_;
+        ar & file_hash_;
+    }
+
+    uint32_t    transfer_handle_;
+    std::string file_hash_;
+};
+
+#endif // TRANSFER_FINALIZE_HPP
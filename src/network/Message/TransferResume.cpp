@@ -0,0 +1,27 @@
+#include "TransferResume.hpp"
+
+TransferResume::TransferResume(uint32_t            transfer_handle,
+                               std::vector<Extent> extents) :
+    transfer_handle_(transfer_handle),
+    extents_(std::move(extents))
+{}
+
+std::vector<uint8_t> TransferResume::serialize() const
+{
+    std::ostringstream              oss;
+    boost::archive::binary_oarchive oa(oss, boost::archive::no_header);
+    oa << *this;
+    const std::string& str = oss.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+TransferResume
+TransferResume::deserialize(const std::vector<uint8_t>& serialized)
+{
+    TransferResume                  resume;
+    std::string                     str(serialized.begin(), serialized.end());
+    std::istringstream              iss(str);
+    boost::archive::binary_iarchive ia(iss, boost::archive::no_header);
+    ia >> resume;
+    return resume;
+}
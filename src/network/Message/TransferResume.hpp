@@ -0,0 +1,50 @@
+#ifndef TRANSFER_RESUME_HPP
+#define TRANSFER_RESUME_HPP
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/vector.hpp>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "Message.hpp"
+
+// Sent by the receiver when a journal shows part of the file is already on
+// disk, listing the [begin, end) ranges the sender can skip
+class TransferResume : public Message
+{
+  public:
+    using Extent = std::pair<uint64_t, uint64_t>;
+
+    TransferResume() = default;
+    TransferResume(uint32_t transfer_handle, std::vector<Extent> extents);
+
+    MessageType getType() const override
+    {
+        return MessageType::TRANSFER_RESUME;
+    }
+
+    uint32_t getTransferHandle() const { return transfer_handle_; }
+    const std::vector<Extent>& getReceivedExtents() const { return extents_; }
+
+    std::vector<uint8_t>  serialize() const override;
+    static TransferResume deserialize(const std::vector<uint8_t>& serialized);
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & transfer_handle_;
+        ar & extents_;
+    }
+
+    uint32_t            transfer_handle_;
+    std::vector<Extent> extents_;
+};
+
+#endif // TRANSFER_RESUME_HPP
@@ -0,0 +1,36 @@
+#ifndef WIRE_FORMAT_HPP
+#define WIRE_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Fixed-width little-endian encoding helpers for binary message headers
+namespace wire
+{
+
+template <typename T>
+inline void putLE(uint8_t* dst, T value)
+{
+    static_assert(std::is_unsigned_v<T>, "T must be an unsigned integer");
+    for (size_t i = 0; i < sizeof(T); ++i)
+    {
+        dst[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+template <typename T>
+inline T getLE(const uint8_t* src)
+{
+    static_assert(std::is_unsigned_v<T>, "T must be an unsigned integer");
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+    {
+        value |= static_cast<T>(src[i]) << (8 * i);
+    }
+    return value;
+}
+
+} // namespace wire
+
+#endif // WIRE_FORMAT_HPP
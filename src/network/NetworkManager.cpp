@@ -1,32 +1,114 @@
 #include "NetworkManager.hpp"
 
+#include <algorithm>
+#include <random>
+
 std::shared_ptr<NetworkManager> NetworkManager::create()
 {
     return std::shared_ptr<NetworkManager>(new NetworkManager());
 }
 
 NetworkManager::NetworkManager() :
-    QObject(), work_(std::make_shared<io_context::work>(io_context_)),
-    file_transfer_(
-        std::make_shared<FileTransfer>(std::make_shared<FileSystemManager>())),
-    network_settings_(), current_port_(8080),
+    QObject(), control_strand_(boost::asio::make_strand(io_context_)),
+    io_thread_count_(0),
+    work_(std::make_shared<io_context::work>(io_context_)),
+    file_transfer_(std::make_shared<FileTransfer>(
+        std::make_shared<FileSystemManager>(),
+        std::make_shared<DiskIoExecutor>(), control_strand_)),
+    network_settings_(), global_limiter_(std::make_shared<TokenBucket>()),
+    rate_limit_timer_(control_strand_), current_port_(8080),
     m_downloadDirectory(QDir::currentPath())
 {
-    file_transfer_->setChunkReadyCallback([this](const ChunkMessage& chunk) {
-        auto it = findPeerByFileId(chunk.getFileId());
-        if (it != peers_.end())
-        {
-            it->second->sendMessage(chunk);
-        }
-        updateFileTransferProgress(chunk.getFileId());
-    });
+    file_transfer_->setChunkReadyCallback(
+        [this](const ChunkMessage& chunk, const std::string& peer_id) {
+            // Until the receiver has the metadata, chunks stay behind it on
+            // the control connection
+            std::shared_ptr<PeerConnection> connection;
+            if (file_transfer_->isReceiverReady(chunk.getTransferHandle()))
+            {
+                connection = selectStream(peer_id);
+            } else {
+                connection = findPeer(peer_id);
+            }
+            if (connection)
+            {
+                connection->sendMessage(chunk);
+            }
+            updateFileTransferProgress();
+        });
 
     file_transfer_->setFileMetadataCallback(
-        [this](const FileMetadata& metadata) {
-            auto it = findPeerByFileId(metadata.getFileId());
-            if (it != peers_.end())
+        [this](const FileMetadata& metadata, const std::string& peer_id) {
+            if (auto peer = findPeer(peer_id))
             {
-                it->second->sendMessage(metadata);
+                peer->sendMessage(metadata);
+            }
+        });
+
+    file_transfer_->setChunkAckCallback(
+        [this](const ChunkMetrics& ack, const std::string& peer_id) {
+            if (auto peer = findPeer(peer_id))
+            {
+                peer->sendMessage(ack);
+            } else {
+                LOG_ERROR("Peer not found for sending chunk metrics");
+            }
+
+            if (m_receiveProgressUpdateTimer.elapsed() >=
+                m_progressUpdateInterval)
+            {
+                double progress = file_transfer_->getAggregateProgress(false);
+                emit fileReceiveProgressUpdated(static_cast<int>(progress));
+                m_receiveProgressUpdateTimer.restart();
+            }
+        });
+
+    file_transfer_->setTransferFinalizeCallback(
+        [this](const TransferFinalize& finalize, const std::string& peer_id) {
+            if (auto peer = findPeer(peer_id))
+            {
+                peer->sendMessage(finalize);
+            }
+        });
+
+    file_transfer_->setChunkRetransmitCallback(
+        [this](const ChunkRetransmitRequest& request,
+               const std::string&            peer_id) {
+            if (auto peer = findPeer(peer_id))
+            {
+                peer->sendMessage(request);
+            }
+        });
+
+    file_transfer_->setTransferResumeCallback(
+        [this](const TransferResume& resume, const std::string& peer_id) {
+            if (auto peer = findPeer(peer_id))
+            {
+                peer->sendMessage(resume);
+            }
+        });
+
+    file_transfer_->setBlockSignaturesCallback(
+        [this](const BlockSignatures& signatures, const std::string& peer_id) {
+            if (auto peer = findPeer(peer_id))
+            {
+                peer->sendMessage(signatures);
+            }
+        });
+
+    file_transfer_->setDeltaCopyCallback(
+        [this](const DeltaCopy& delta_copy, const std::string& peer_id) {
+            if (auto peer = findPeer(peer_id))
+            {
+                peer->sendMessage(delta_copy);
+            }
+        });
+
+    file_transfer_->setTransferAbortCallback(
+        [this](const TransferAbort& abort, const std::string& peer_id) {
+            if (auto peer = findPeer(peer_id))
+            {
+                peer->sendMessage(abort);
             }
         });
 
@@ -38,21 +120,64 @@ NetworkManager::NetworkManager() :
             handleTransferComplete(file_id, success);
         });
 
+    file_transfer_->setInFlightLimits(
+        network_settings_.getMaxInFlightBytes(),
+        network_settings_.getMaxInFlightChunks());
+    file_transfer_->setHashAlgorithm(network_settings_.getHashAlgorithm());
+    file_transfer_->setScheduling(
+        network_settings_.getSchedulingPolicy(),
+        network_settings_.getMaxConcurrentTransfers());
+    file_transfer_->setInlineThreshold(network_settings_.getInlineThreshold());
+    file_transfer_->setDeltaTransfers(network_settings_.getDeltaTransfers());
+    file_transfer_->setContentChunking(network_settings_.getContentChunking());
+    file_transfer_->setCompression(network_settings_.getCompression());
+    file_transfer_->setChunkControlPolicy(
+        network_settings_.getChunkControlPolicy());
+    file_transfer_->setHashCache(
+        std::make_shared<FileHashCache>("QuickShare.hashcache"));
+    file_transfer_->setChunkStore(
+        std::make_shared<ChunkStore>("QuickShare.chunkstore"));
+    file_transfer_->setLinkEstimates(
+        std::make_shared<LinkEstimateStore>("QuickShare.linkestimates"));
+
+    io_thread_count_ = network_settings_.getIoThreads();
+
     m_sendProgressUpdateTimer.start();
     m_receiveProgressUpdateTimer.start();
 }
 
+NetworkManager::~NetworkManager()
+{
+    stop();
+}
+
 void NetworkManager::start(uint16_t port)
 {
     current_port_ = port;
     try
     {
+        // No thread of the pool runs yet, so this needs no strand
         acceptor_ = std::make_unique<tcp::acceptor>(
-            io_context_, tcp::endpoint(tcp::v4(), port));
+            control_strand_, tcp::endpoint(tcp::v4(), port));
         doAccept();
+        applyRateLimits();
+        scheduleRateLimitCheck();
+
+        size_t thread_count = io_thread_count_;
+        if (thread_count == 0)
+        {
+            thread_count = std::clamp<size_t>(
+                std::thread::hardware_concurrency(), 1, MAX_DEFAULT_IO_THREADS);
+        }
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            io_threads_.emplace_back([this]() { io_context_.run(); });
+        }
 
-        LOG_INFO(QString("NetworkManager started on port: %1").arg(port));
-        std::thread([this]() { io_context_.run(); }).detach();
+        LOG_INFO(QString("NetworkManager started on port: %1 with %2 I/O "
+                         "threads")
+                     .arg(port)
+                     .arg(thread_count));
     } catch (const std::exception& e)
     {
         LOG_ERROR(QString("Error starting NetworkManager: %1").arg(e.what()));
@@ -62,7 +187,27 @@ void NetworkManager::start(uint16_t port)
 void NetworkManager::stop()
 {
     work_.reset();
+    io_context_.stop();
+    for (auto& thread : io_threads_)
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+    io_threads_.clear();
+
+    // With the pool joined, the closing and the handlers it completes run
+    // on this thread, still through their strands
+    io_context_.restart();
+    boost::asio::post(control_strand_, [this]() { closeConnections(); });
+    io_context_.poll();
 
+    LOG_INFO("NetworkManager stopped");
+}
+
+void NetworkManager::closeConnections()
+{
     if (acceptor_ && acceptor_->is_open())
     {
         boost::system::error_code ec;
@@ -74,15 +219,50 @@ void NetworkManager::stop()
         }
     }
 
-    for (auto& peer : peers_)
+    for (auto& connection : connections())
     {
-        peer.second->stop();
+        connection->stop();
+    }
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        peers_.clear();
+        data_streams_.clear();
     }
-    peers_.clear();
 
-    io_context_.stop();
+    for (auto& session : stream_sessions_)
+    {
+        for (auto& pending : session.second.pending_streams)
+        {
+            pending.first->stop();
+        }
+    }
+    stream_sessions_.clear();
+    rate_limit_timer_.cancel();
+}
 
-    LOG_INFO("NetworkManager stopped");
+std::shared_ptr<PeerConnection>
+NetworkManager::findPeer(const std::string& peer_key) const
+{
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    auto                        it = peers_.find(peer_key);
+    return it != peers_.end() ? it->second : nullptr;
+}
+
+std::vector<std::shared_ptr<PeerConnection>>
+NetworkManager::connections() const
+{
+    std::lock_guard<std::mutex>                  lock(peers_mutex_);
+    std::vector<std::shared_ptr<PeerConnection>> result;
+    for (const auto& peer : peers_)
+    {
+        result.push_back(peer.second);
+    }
+    for (const auto& streams : data_streams_)
+    {
+        result.insert(result.end(), streams.second.begin(),
+                      streams.second.end());
+    }
+    return result;
 }
 
 bool NetworkManager::changePort(uint16_t newPort)
@@ -115,36 +295,49 @@ bool NetworkManager::changePort(uint16_t newPort)
 
 void NetworkManager::connectToPeer(const std::string& address, uint16_t port)
 {
-    auto new_connection = PeerConnection::create(io_context_);
-    new_connection->setNetworkSettings(network_settings_);
-
-    new_connection->socket().async_connect(
-        tcp::endpoint(boost::asio::ip::address::from_string(address), port),
-        [this, new_connection, address, port](const error_code& error) {
-            handleConnect(new_connection, error);
+    tcp::endpoint endpoint(boost::asio::ip::address::from_string(address),
+                           port);
+    boost::asio::post(control_strand_, [this, endpoint, address, port]() {
+        auto new_connection = PeerConnection::create(io_context_);
+        new_connection->setNetworkSettings(network_settings_);
 
-            QString peerKey =
-                QString::fromStdString(address + ":" + std::to_string(port));
-            emit peerConnectionResult(peerKey, !error);
-        });
+        new_connection->socket().async_connect(
+            endpoint,
+            boost::asio::bind_executor(
+                control_strand_, [this, new_connection, address,
+                                  port](const error_code& error) {
+                    handleConnect(new_connection, error);
+
+                    QString peerKey = QString::fromStdString(
+                        address + ":" + std::to_string(port));
+                    emit peerConnectionResult(peerKey, !error);
+                }));
+    });
 }
 
 void NetworkManager::broadcastMessage(const Message& message)
 {
-    for (auto& peer : peers_)
+    std::vector<std::shared_ptr<PeerConnection>> peers;
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        for (const auto& peer : peers_)
+        {
+            peers.push_back(peer.second);
+        }
+    }
+    for (auto& peer : peers)
     {
-        peer.second->sendMessage(message);
+        peer->sendMessage(message);
     }
 }
 
 void NetworkManager::sendMessage(const Message&     message,
                                  const std::string& peer_key)
 {
-    auto it = peers_.find(peer_key);
-    if (it != peers_.end())
+    if (auto peer = findPeer(peer_key))
     {
         LOG_INFO(QString("Sending message to peer: %1").arg(peer_key.c_str()));
-        it->second->sendMessage(message);
+        peer->sendMessage(message);
     } else {
         LOG_ERROR(QString("Peer: %1, not found").arg(peer_key.c_str()));
     }
@@ -156,33 +349,57 @@ void NetworkManager::startSendingFile(const QString& filePath,
     QFileInfo fileInfo(filePath);
     emit      fileSendStarted(fileInfo.fileName(), fileInfo.filePath(),
                               fileInfo.size());
-    file_transfer_->startSending(filePath.toStdString(), peerKey.toStdString());
+    boost::asio::post(control_strand_,
+                      [this, file_path = filePath.toStdString(),
+                       peer_key = peerKey.toStdString(),
+                       is_dir = fileInfo.isDir()]() {
+        if (is_dir)
+        {
+            file_transfer_->startSendingDirectory(file_path, peer_key);
+        } else {
+            file_transfer_->startSending(file_path, peer_key);
+        }
+    });
     m_sendProgressUpdateTimer.start();
 }
 
 void NetworkManager::cancelFileTransfer(const QString& file_id)
 {
     LOG_INFO(QString("Cancelling file transfer for file ID: %1").arg(file_id));
-    file_transfer_->cancelTransfer(file_id.toStdString());
+    boost::asio::post(control_strand_, [this, id = file_id.toStdString()]() {
+        file_transfer_->cancelTransfer(id);
+    });
 }
 
 void NetworkManager::pauseFileTransfer(const QString& file_id)
 {
     LOG_INFO(QString("Pausing file transfer for file ID: %1").arg(file_id));
-    file_transfer_->pauseTransfer(file_id.toStdString());
+    boost::asio::post(control_strand_, [this, id = file_id.toStdString()]() {
+        file_transfer_->pauseTransfer(id);
+    });
 }
 
 void NetworkManager::resumeFileTransfer(const QString& file_id)
 {
     LOG_INFO(QString("Resuming file transfer for file ID: %1").arg(file_id));
-    file_transfer_->resumeTransfer(file_id.toStdString());
+    boost::asio::post(control_strand_, [this, id = file_id.toStdString()]() {
+        file_transfer_->resumeTransfer(id);
+    });
 }
 
-void NetworkManager::updateFileTransferProgress(const std::string& file_id)
+void NetworkManager::setPeerWeight(const QString& peerKey, double weight)
+{
+    boost::asio::post(control_strand_,
+                      [this, peer_key = peerKey.toStdString(), weight]() {
+                          file_transfer_->setPeerWeight(peer_key, weight);
+                      });
+}
+
+void NetworkManager::updateFileTransferProgress()
 {
     if (m_sendProgressUpdateTimer.elapsed() >= m_progressUpdateInterval)
     {
-        double progress = file_transfer_->getTransferProgress(file_id);
+        double progress = file_transfer_->getAggregateProgress(true);
         emit   fileSendProgressUpdated(static_cast<int>(progress));
         m_sendProgressUpdateTimer.restart();
     }
@@ -191,25 +408,46 @@ void NetworkManager::updateFileTransferProgress(const std::string& file_id)
 void NetworkManager::setMessageHandler(
     const MessageHandler::MessageCallback& handler)
 {
-    message_handler_.registerHandler(MessageType::TEXT, handler);
+    boost::asio::post(control_strand_, [this, handler]() {
+        message_handler_.registerHandler(MessageType::TEXT, handler);
 
-    for (const auto& peer : peers_)
-    {
-        peer.second->setMessageHandler(
-            [this, peer_key = peer.first](const Message& msg) {
-                this->handleIncomingMessage(msg, peer_key);
-            });
-    }
+        std::vector<std::pair<std::string, std::shared_ptr<PeerConnection>>>
+            peers;
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex_);
+            peers.assign(peers_.begin(), peers_.end());
+        }
+        for (const auto& [peer_key, connection] : peers)
+        {
+            bindConnection(connection, peer_key, connection->getId());
+        }
+    });
 }
 
 void NetworkManager::updateNetworkSettings(const NetworkSettings& settings)
 {
-    network_settings_ = settings;
-
-    for (auto& peer : peers_)
-    {
-        peer.second->setNetworkSettings(network_settings_);
-    }
+    io_thread_count_ = settings.getIoThreads();
+    boost::asio::post(control_strand_, [this, settings]() {
+        network_settings_ = settings;
+        file_transfer_->setInFlightLimits(
+            network_settings_.getMaxInFlightBytes(),
+            network_settings_.getMaxInFlightChunks());
+        file_transfer_->setHashAlgorithm(network_settings_.getHashAlgorithm());
+        file_transfer_->setScheduling(
+            network_settings_.getSchedulingPolicy(),
+            network_settings_.getMaxConcurrentTransfers());
+        file_transfer_->setInlineThreshold(
+            network_settings_.getInlineThreshold());
+        file_transfer_->setDeltaTransfers(
+            network_settings_.getDeltaTransfers());
+        file_transfer_->setContentChunking(
+            network_settings_.getContentChunking());
+        file_transfer_->setCompression(network_settings_.getCompression());
+        file_transfer_->setChunkControlPolicy(
+            network_settings_.getChunkControlPolicy());
+        applyRateLimits();
+        applyNetworkSettingsToPeers();
+    });
 }
 
 void NetworkManager::setDownloadDirectory(const QString& directory)
@@ -261,11 +499,11 @@ void NetworkManager::handleAccept(
 
         std::string peer_key =
             getPeerKey(new_connection->socket().remote_endpoint());
-        peers_[peer_key] = new_connection;
-
-        new_connection->setMessageHandler([this, peer_key](const Message& msg) {
-            this->handleIncomingMessage(msg, peer_key);
-        });
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex_);
+            peers_[peer_key] = new_connection;
+        }
+        bindConnection(new_connection, peer_key, new_connection->getId());
 
         new_connection->setNetworkSettings(network_settings_);
         new_connection->start();
@@ -288,50 +526,341 @@ void NetworkManager::handleConnect(
                               .to_string()
                               .c_str()));
 
-        std::string peer_key =
-            getPeerKey(new_connection->socket().remote_endpoint());
-        peers_[peer_key] = new_connection;
-
-        new_connection->setMessageHandler([this, peer_key](const Message& msg) {
-            this->handleIncomingMessage(msg, peer_key);
-        });
+        // The socket belongs to the connection's strand once started
+        tcp::endpoint endpoint = new_connection->socket().remote_endpoint();
+        std::string   peer_key = getPeerKey(endpoint);
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex_);
+            peers_[peer_key] = new_connection;
+        }
+        bindConnection(new_connection, peer_key, new_connection->getId());
 
         new_connection->start();
+
+        uint32_t stream_count =
+            static_cast<uint32_t>(network_settings_.getStreamsPerPeer());
+        if (stream_count > 1)
+        {
+            std::random_device rd;
+            uint64_t session_id = (static_cast<uint64_t>(rd()) << 32) | rd();
+
+            new_connection->sendMessage(
+                StreamHello(session_id, 0, stream_count));
+            for (uint32_t index = 1; index < stream_count; ++index)
+            {
+                openDataStream(endpoint, peer_key, new_connection->getId(),
+                               StreamHello(session_id, index, stream_count));
+            }
+        }
     } else {
         LOG_ERROR(QString("Error connecting to peer: %1")
                       .arg(error.message().c_str()));
     }
 }
 
+void NetworkManager::bindConnection(std::shared_ptr<PeerConnection> connection,
+                                    const std::string&              peer_key,
+                                    uint32_t connection_id)
+{
+    auto binding = std::make_shared<ConnectionBinding>(
+        ConnectionBinding{peer_key, connection_id});
+    std::weak_ptr<PeerConnection> weak_connection = connection;
+    connection->setRateLimiters(peerLimiter(peer_key), global_limiter_);
+
+    // Called on the connection's strand, handled on the control strand
+    connection->setMessageHandler([this, binding, weak_connection](
+                                      std::shared_ptr<Message> msg) {
+        boost::asio::post(control_strand_, [this, binding, weak_connection,
+                                            msg = std::move(msg)]() {
+            if (msg->getType() == MessageType::STREAM_HELLO)
+            {
+                if (auto connection = weak_connection.lock())
+                {
+                    handleStreamHello(static_cast<const StreamHello&>(*msg),
+                                      connection, binding);
+                }
+                return;
+            }
+            this->handleIncomingMessage(*msg, binding->peer_key,
+                                        binding->connection_id);
+        });
+    });
+
+    connection->setCloseHandler([this, binding, weak_connection]() {
+        if (auto connection = weak_connection.lock())
+        {
+            boost::asio::post(control_strand_, [this, binding, connection]() {
+                handleConnectionClosed(connection, binding);
+            });
+        }
+    });
+}
+
+void NetworkManager::openDataStream(const tcp::endpoint& endpoint,
+                                    const std::string&   peer_key,
+                                    uint32_t             connection_id,
+                                    const StreamHello&   hello)
+{
+    auto stream = PeerConnection::create(io_context_);
+    stream->setNetworkSettings(network_settings_);
+
+    stream->socket().async_connect(
+        endpoint,
+        boost::asio::bind_executor(
+            control_strand_, [this, stream, peer_key, connection_id,
+                              hello](const error_code& error) {
+                if (error)
+                {
+                    LOG_WARNING(
+                        QString("Failed to open stream %1 to peer %2: %3")
+                            .arg(hello.getStreamIndex())
+                            .arg(peer_key.c_str())
+                            .arg(error.message().c_str()));
+                    return;
+                }
+
+                bindConnection(stream, peer_key, connection_id);
+                stream->start();
+                stream->sendMessage(hello);
+                std::lock_guard<std::mutex> lock(peers_mutex_);
+                data_streams_[peer_key].push_back(stream);
+            }));
+}
+
+void NetworkManager::handleStreamHello(
+    const StreamHello& hello, std::shared_ptr<PeerConnection> connection,
+    std::shared_ptr<ConnectionBinding> binding)
+{
+    LOG_INFO(QString("Peer %1 opened stream %2 of %3")
+                 .arg(binding->peer_key.c_str())
+                 .arg(hello.getStreamIndex())
+                 .arg(hello.getStreamCount()));
+
+    auto&    session = stream_sessions_[hello.getSessionId()];
+    uint32_t data_stream_count =
+        hello.getStreamCount() > 0 ? hello.getStreamCount() - 1 : 0;
+
+    if (hello.getStreamIndex() == 0)
+    {
+        session.peer_key = binding->peer_key;
+        session.connection_id = binding->connection_id;
+        session.has_control_stream = true;
+        for (auto& [stream, stream_binding] : session.pending_streams)
+        {
+            attachDataStream(session, stream, stream_binding);
+        }
+        session.attached_streams += session.pending_streams.size();
+        session.pending_streams.clear();
+    } else {
+        // A data stream is not a peer of its own
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex_);
+            auto peer_it = peers_.find(binding->peer_key);
+            if (peer_it != peers_.end() && peer_it->second == connection)
+            {
+                peers_.erase(peer_it);
+            }
+        }
+
+        if (session.has_control_stream)
+        {
+            attachDataStream(session, connection, binding);
+            ++session.attached_streams;
+        } else {
+            session.pending_streams.emplace_back(connection, binding);
+        }
+    }
+
+    if (session.has_control_stream &&
+        session.attached_streams >= data_stream_count)
+    {
+        stream_sessions_.erase(hello.getSessionId());
+    }
+}
+
+void NetworkManager::handleConnectionClosed(
+    std::shared_ptr<PeerConnection>    connection,
+    std::shared_ptr<ConnectionBinding> binding)
+{
+    std::vector<std::shared_ptr<PeerConnection>> streams;
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        auto streams_it = data_streams_.find(binding->peer_key);
+        auto peer_it = peers_.find(binding->peer_key);
+        if (peer_it == peers_.end() || peer_it->second != connection)
+        {
+            // A data stream, or a connection already replaced or dropped.
+            // The peer keeps its other streams
+            if (streams_it != data_streams_.end())
+            {
+                std::erase(streams_it->second, connection);
+            }
+            return;
+        }
+
+        peers_.erase(peer_it);
+        if (streams_it != data_streams_.end())
+        {
+            streams = std::move(streams_it->second);
+            data_streams_.erase(streams_it);
+        }
+    }
+
+    LOG_INFO(QString("Peer %1 disconnected").arg(binding->peer_key.c_str()));
+    for (auto& stream : streams)
+    {
+        stream->stop();
+    }
+    file_transfer_->cancelPeerTransfers(binding->peer_key);
+}
+
+void NetworkManager::attachDataStream(
+    const StreamSession& session, std::shared_ptr<PeerConnection> stream,
+    std::shared_ptr<ConnectionBinding> binding)
+{
+    // The stream was accepted as a peer of its own until now
+    if (binding->peer_key != session.peer_key)
+    {
+        peer_limiters_.erase(binding->peer_key);
+    }
+    binding->peer_key = session.peer_key;
+    binding->connection_id = session.connection_id;
+    stream->setRateLimiters(peerLimiter(session.peer_key), global_limiter_);
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    data_streams_[session.peer_key].push_back(std::move(stream));
+}
+
+std::shared_ptr<PeerConnection>
+NetworkManager::selectStream(const std::string& peer_key)
+{
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    auto                        peer_it = peers_.find(peer_key);
+    if (peer_it == peers_.end())
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<PeerConnection> best = peer_it->second;
+    double best_drain_time = best->getQueueDrainTime();
+
+    auto streams_it = data_streams_.find(peer_key);
+    if (streams_it != data_streams_.end())
+    {
+        for (const auto& stream : streams_it->second)
+        {
+            if (!stream->isConnected())
+            {
+                continue;
+            }
+            double drain_time = stream->getQueueDrainTime();
+            if (drain_time < best_drain_time)
+            {
+                best = stream;
+                best_drain_time = drain_time;
+            }
+        }
+    }
+    return best;
+}
+
+void NetworkManager::applyNetworkSettingsToPeers()
+{
+    for (auto& connection : connections())
+    {
+        connection->setNetworkSettings(network_settings_);
+    }
+}
+
+std::shared_ptr<TokenBucket>
+NetworkManager::peerLimiter(const std::string& peer_key)
+{
+    auto& limiter = peer_limiters_[peer_key];
+    if (!limiter)
+    {
+        limiter = std::make_shared<TokenBucket>(
+            network_settings_.getPeerRateLimit(
+                peer_key, network_settings_.getActiveRateLimits()));
+    }
+    return limiter;
+}
+
+void NetworkManager::applyRateLimits()
+{
+    RateLimits limits = network_settings_.getActiveRateLimits();
+    global_limiter_->setRate(limits.global);
+    for (auto& [peer_key, limiter] : peer_limiters_)
+    {
+        limiter->setRate(network_settings_.getPeerRateLimit(peer_key, limits));
+    }
+}
+
+void NetworkManager::scheduleRateLimitCheck()
+{
+    rate_limit_timer_.expires_after(RATE_SCHEDULE_CHECK_INTERVAL);
+    rate_limit_timer_.async_wait([this](const error_code& error) {
+        if (!error)
+        {
+            applyRateLimits();
+            scheduleRateLimitCheck();
+        }
+    });
+}
+
 void NetworkManager::handleIncomingMessage(const Message&     message,
-                                           const std::string& peer_key)
+                                           const std::string& peer_key,
+                                           uint32_t           connection_id)
 {
     switch (message.getType())
     {
         case MessageType::TEXT: message_handler_.handleMessage(message); break;
         case MessageType::FILE_METADATA:
             handleFileMetadata(static_cast<const FileMetadata&>(message),
-                               peer_key);
+                               peer_key, connection_id);
             break;
         case MessageType::CHUNK:
         {
             handleChunkMessage(static_cast<const ChunkMessage&>(message),
-                               peer_key);
+                               peer_key, connection_id);
             // TODO:
-            // updateFileTransferProgress(
-            //     static_cast<const ChunkMessage&>(message).getFileId());
+            // updateFileTransferProgress();
             break;
         }
         case MessageType::CHUNK_METRICS:
             handleChunkMetrics(static_cast<const ChunkMetrics&>(message),
                                peer_key);
             break;
+        case MessageType::TRANSFER_FINALIZE:
+            handleTransferFinalize(
+                static_cast<const TransferFinalize&>(message), peer_key,
+                connection_id);
+            break;
+        case MessageType::CHUNK_RETRANSMIT:
+            handleChunkRetransmitRequest(
+                static_cast<const ChunkRetransmitRequest&>(message), peer_key);
+            break;
+        case MessageType::TRANSFER_RESUME:
+            handleTransferResume(static_cast<const TransferResume&>(message),
+                                 peer_key);
+            break;
+        case MessageType::BLOCK_SIGNATURES:
+            handleBlockSignatures(static_cast<const BlockSignatures&>(message),
+                                  peer_key);
+            break;
+        case MessageType::DELTA_COPY:
+            handleDeltaCopy(static_cast<const DeltaCopy&>(message), peer_key,
+                            connection_id);
+            break;
+        case MessageType::TRANSFER_ABORT:
+            handleTransferAbort(static_cast<const TransferAbort&>(message),
+                                peer_key, connection_id);
+            break;
         default: LOG_ERROR("Unknown message type received");
     }
 }
 
 void NetworkManager::handleFileMetadata(const FileMetadata& metadata,
-                                        const std::string&  peer_key)
+                                        const std::string&  peer_key,
+                                        uint32_t            connection_id)
 {
     LOG_INFO(QString("Received file metadata for file: %1 from peer: %2")
                  .arg(metadata.getFileName().c_str())
@@ -339,7 +868,8 @@ void NetworkManager::handleFileMetadata(const FileMetadata& metadata,
 
     QString filePath = m_downloadDirectory + "/" +
                        QString::fromStdString(metadata.getFileName());
-    file_transfer_->startReceiving(metadata, filePath.toStdString());
+    file_transfer_->startReceiving(metadata, filePath.toStdString(), peer_key,
+                                   connection_id);
 
     QString fileName = QString::fromStdString(metadata.getFileName());
     qint64  fileSize = metadata.getFileSize();
@@ -349,66 +879,119 @@ void NetworkManager::handleFileMetadata(const FileMetadata& metadata,
 }
 
 void NetworkManager::handleChunkMessage(const ChunkMessage& chunk_msg,
-                                        const std::string&  peer_key)
+                                        const std::string&  peer_key,
+                                        uint32_t            connection_id)
 {
-    LOG_INFO(QString("Received chunk with offset %1 for file ID: %2")
+    LOG_INFO(QString("Received chunk with offset %1 for transfer handle: %2")
                  .arg(chunk_msg.getOffset())
-                 .arg(chunk_msg.getFileId().c_str()));
-    file_transfer_->handleIncomingChunk(chunk_msg);
-
-    if (m_receiveProgressUpdateTimer.elapsed() >= m_progressUpdateInterval)
-    {
-        double progress =
-            file_transfer_->getTransferProgress(chunk_msg.getFileId());
-        emit fileReceiveProgressUpdated(static_cast<int>(progress));
-        m_receiveProgressUpdateTimer.restart();
-    }
-
-    ChunkMetrics metrics(chunk_msg.getFileId(), chunk_msg.getOffset(),
-                         chunk_msg.getData().size(),
-                         std::chrono::system_clock::now());
-    auto         it = peers_.find(peer_key);
-    if (it != peers_.end())
-    {
-        it->second->sendMessage(metrics);
-    } else {
-        LOG_ERROR("Peer not found for sending chunk metrics");
-    }
+                 .arg(chunk_msg.getTransferHandle()));
+    file_transfer_->handleIncomingChunk(chunk_msg, peer_key, connection_id);
 }
 
 void NetworkManager::handleChunkMetrics(const ChunkMetrics& metrics,
                                         const std::string&  peer_key)
 {
-    auto received_time = metrics.getReceivedTime();
-    auto current_time = std::chrono::system_clock::now();
-    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
-        current_time - received_time);
-
-    LOG_INFO(QString("Received metrics for chunk with offset %1 of file ID: "
-                     "%2, size: %3 bytes, latency: %4 microseconds")
+    // Both ends of the round trip are on this host's monotonic clock. The
+    // receiver's share of it is reported apart from the network's
+    auto rtt = metrics.getRoundTripTime();
+    auto processing_time = metrics.getProcessingTime();
+
+    LOG_INFO(QString("Received metrics for chunk with offset %1 of transfer "
+                     "handle: %2, size: %3 bytes, round trip: %4 "
+                     "microseconds, receiver processing: %5 microseconds")
                  .arg(metrics.getOffset())
-                 .arg(metrics.getFileId().c_str())
+                 .arg(metrics.getTransferHandle())
                  .arg(metrics.getChunkSize())
-                 .arg(latency.count()));
+                 .arg(rtt.count())
+                 .arg(processing_time.count()));
 
-    file_transfer_->handleChunkMetrics(metrics.getFileId(), metrics.getOffset(),
-                                       metrics.getChunkSize(), latency);
+    file_transfer_->handleChunkMetrics(metrics.getTransferHandle(),
+                                       metrics.getOffset(),
+                                       metrics.getChunkSize(), rtt,
+                                       peer_key);
 
     size_t optimal_chunk_size =
-        file_transfer_->getOptimalChunkSize(metrics.getFileId());
+        file_transfer_->getOptimalChunkSize(metrics.getTransferHandle());
     network_settings_.updateBufferSizes(optimal_chunk_size);
-    for (auto& peer : peers_)
-    {
-        peer.second->setNetworkSettings(network_settings_);
-    }
+    applyNetworkSettingsToPeers();
+}
+
+void NetworkManager::handleTransferFinalize(const TransferFinalize& finalize,
+                                            const std::string&      peer_key,
+                                            uint32_t connection_id)
+{
+    LOG_INFO(QString("Received final hash for transfer handle: %1 from peer: "
+                     "%2")
+                 .arg(finalize.getTransferHandle())
+                 .arg(peer_key.c_str()));
+    file_transfer_->handleTransferFinalize(finalize, peer_key,
+                                           connection_id);
+}
+
+void NetworkManager::handleChunkRetransmitRequest(
+    const ChunkRetransmitRequest& request, const std::string& peer_key)
+{
+    LOG_WARNING(QString("Peer %1 requested chunk at offset %2 of transfer "
+                        "handle %3 again")
+                    .arg(peer_key.c_str())
+                    .arg(request.getOffset())
+                    .arg(request.getTransferHandle()));
+    file_transfer_->handleChunkRetransmitRequest(request.getTransferHandle(),
+                                                 request.getOffset(),
+                                                 request.getChunkSize(),
+                                                 peer_key);
+}
+
+void NetworkManager::handleTransferResume(const TransferResume& resume,
+                                          const std::string&    peer_key)
+{
+    LOG_INFO(QString("Peer %1 resumes transfer handle %2 from %3 ranges")
+                 .arg(peer_key.c_str())
+                 .arg(resume.getTransferHandle())
+                 .arg(resume.getReceivedExtents().size()));
+    file_transfer_->handleTransferResume(resume.getTransferHandle(),
+                                         resume.getReceivedExtents(),
+                                         peer_key);
+}
+
+void NetworkManager::handleBlockSignatures(const BlockSignatures& signatures,
+                                           const std::string&     peer_key)
+{
+    LOG_INFO(QString("Peer %1 sent %2 block signatures for transfer handle %3")
+                 .arg(peer_key.c_str())
+                 .arg(signatures.getSignatures().size())
+                 .arg(signatures.getTransferHandle()));
+    file_transfer_->handleBlockSignatures(signatures, peer_key);
+}
+
+void NetworkManager::handleDeltaCopy(const DeltaCopy&   delta_copy,
+                                     const std::string& peer_key,
+                                     uint32_t           connection_id)
+{
+    LOG_INFO(QString("Peer %1 sent %2 block copies for transfer handle %3")
+                 .arg(peer_key.c_str())
+                 .arg(delta_copy.getCopies().size())
+                 .arg(delta_copy.getTransferHandle()));
+    file_transfer_->handleDeltaCopy(delta_copy, peer_key, connection_id);
+}
+
+void NetworkManager::handleTransferAbort(const TransferAbort& abort,
+                                         const std::string&   peer_key,
+                                         uint32_t             connection_id)
+{
+    LOG_INFO(QString("Peer %1 aborted transfer handle %2")
+                 .arg(peer_key.c_str())
+                 .arg(abort.getTransferHandle()));
+    file_transfer_->handleTransferAbort(abort, peer_key, connection_id);
 }
 
 void NetworkManager::handleTransferComplete(const std::string& file_id,
                                             bool               success)
 {
-    int finalProgress = success ? 100 : 0;
-
+    // Other files of the batch may still be running, so report the batch
     bool isSending = file_transfer_->isFileSending(file_id);
+    int  finalProgress =
+        static_cast<int>(file_transfer_->getAggregateProgress(isSending));
     if (isSending)
     {
         emit fileSendProgressUpdated(finalProgress);
@@ -422,10 +1005,3 @@ std::string NetworkManager::getPeerKey(const tcp::endpoint& endpoint) const
     return endpoint.address().to_string() + ":" +
            std::to_string(endpoint.port());
 }
-
-std::unordered_map<std::string, std::shared_ptr<PeerConnection>>::iterator
-NetworkManager::findPeerByFileId(const std::string& file_id)
-{
-    std::string peer_key = file_id.substr(file_id.find('_') + 1);
-    return peers_.find(peer_key);
-}
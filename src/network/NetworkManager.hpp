@@ -5,9 +5,11 @@
 #include <QObject>
 #include <boost/asio.hpp>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "FileTransfer.hpp"
 #include "Logger.hpp"
@@ -26,8 +28,12 @@ class NetworkManager : public QObject,
     using io_context = boost::asio::io_context;
 
     static std::shared_ptr<NetworkManager> create();
+    ~NetworkManager();
 
+    // Runs the io_context on a pool of NetworkSettings::getIoThreads()
+    // threads
     void start(uint16_t port);
+    // Closes every connection and joins the pool. Not from a handler
     void stop();
     bool changePort(uint16_t newPort);
 
@@ -48,6 +54,8 @@ class NetworkManager : public QObject,
     void cancelFileTransfer(const QString& file_id);
     void pauseFileTransfer(const QString& file_id);
     void resumeFileTransfer(const QString& file_id);
+    // Share of the upload a peer gets under SchedulingPolicy::FAIR_SHARE
+    void setPeerWeight(const QString& peerKey, double weight);
 
   signals:
     void peerConnectionResult(const QString& peerKey, bool success);
@@ -61,38 +69,131 @@ class NetworkManager : public QObject,
                          qint64 fileSize);
 
   private:
+    // Who a connection's messages belong to. Extra streams start out as
+    // their own peer and are rebound to the control connection by their
+    // StreamHello, so chunks on them reach the same inbound transfers
+    struct ConnectionBinding
+    {
+        std::string peer_key;
+        uint32_t    connection_id;
+    };
+
+    // Streams of one connecting peer, grouped until all of them said hello
+    struct StreamSession
+    {
+        std::string peer_key;
+        uint32_t    connection_id = 0;
+        bool        has_control_stream = false;
+        uint32_t    attached_streams = 0;
+        std::vector<std::pair<std::shared_ptr<PeerConnection>,
+                              std::shared_ptr<ConnectionBinding>>>
+            pending_streams;
+    };
+
     NetworkManager();
 
+    // Closes the acceptor and every connection, on the control strand
+    void closeConnections();
+    // Control connection of the peer, null when there is none
+    std::shared_ptr<PeerConnection> findPeer(const std::string& peer_key) const;
+    // Control connections and data streams of every peer
+    std::vector<std::shared_ptr<PeerConnection>> connections() const;
+
     void doAccept();
     void handleAccept(std::shared_ptr<PeerConnection> new_connection,
                       const error_code&               error);
     void handleConnect(std::shared_ptr<PeerConnection> new_connection,
                        const error_code&               error);
 
+    void bindConnection(std::shared_ptr<PeerConnection> connection,
+                        const std::string&              peer_key,
+                        uint32_t                        connection_id);
+    void openDataStream(const tcp::endpoint& endpoint,
+                        const std::string& peer_key, uint32_t connection_id,
+                        const StreamHello& hello);
+    void handleStreamHello(const StreamHello&                 hello,
+                           std::shared_ptr<PeerConnection>    connection,
+                           std::shared_ptr<ConnectionBinding> binding);
+    // Drops a closed connection. Losing the control connection drops the
+    // peer, its data streams and its transfers
+    void handleConnectionClosed(std::shared_ptr<PeerConnection>    connection,
+                                std::shared_ptr<ConnectionBinding> binding);
+    void attachDataStream(const StreamSession&               session,
+                          std::shared_ptr<PeerConnection>    stream,
+                          std::shared_ptr<ConnectionBinding> binding);
+    // Control connection or data stream of the peer that drains soonest
+    std::shared_ptr<PeerConnection> selectStream(const std::string& peer_key);
+    void                            applyNetworkSettingsToPeers();
+    // Rate limiter shared by every stream of the peer
+    std::shared_ptr<TokenBucket> peerLimiter(const std::string& peer_key);
+    // Sets the limiters to the limits in force now, and again at the next
+    // schedule check
+    void                         applyRateLimits();
+    void                         scheduleRateLimitCheck();
+
     void handleIncomingMessage(const Message&     message,
-                               const std::string& peer_key);
+                               const std::string& peer_key,
+                               uint32_t           connection_id);
     void handleFileMetadata(const FileMetadata& metadata,
-                            const std::string&  peer_key);
+                            const std::string&  peer_key,
+                            uint32_t            connection_id);
     void handleChunkMessage(const ChunkMessage& chunk_msg,
-                            const std::string&  peer_key);
+                            const std::string&  peer_key,
+                            uint32_t            connection_id);
     void handleChunkMetrics(const ChunkMetrics& metrics,
                             const std::string&  peer_key);
+    void handleTransferFinalize(const TransferFinalize& finalize,
+                                const std::string&      peer_key,
+                                uint32_t                connection_id);
+    void handleChunkRetransmitRequest(const ChunkRetransmitRequest& request,
+                                      const std::string&            peer_key);
+    void handleTransferResume(const TransferResume& resume,
+                              const std::string&    peer_key);
+    void handleBlockSignatures(const BlockSignatures& signatures,
+                               const std::string&     peer_key);
+    void handleDeltaCopy(const DeltaCopy&   delta_copy,
+                         const std::string& peer_key, uint32_t connection_id);
+    void handleTransferAbort(const TransferAbort& abort,
+                             const std::string&   peer_key,
+                             uint32_t             connection_id);
     void handleTransferComplete(const std::string& file_id, bool success);
 
     std::string getPeerKey(const tcp::endpoint& endpoint) const;
-    std::unordered_map<std::string, std::shared_ptr<PeerConnection>>::iterator
-    findPeerByFileId(const std::string& file_id);
 
-    void updateFileTransferProgress(const std::string& file_id);
+    static constexpr std::chrono::seconds RATE_SCHEDULE_CHECK_INTERVAL{30};
+    // I/O threads when the settings leave it open. Connections mostly wait,
+    // so more than the default streams per peer would mostly sit idle
+    static constexpr size_t MAX_DEFAULT_IO_THREADS = 4;
+
+    void updateFileTransferProgress();
 
-    io_context                        io_context_;
-    std::unique_ptr<tcp::acceptor>    acceptor_;
-    std::shared_ptr<io_context::work> work_;
+    io_context io_context_;
+    // Connections decode and write on strands of their own and hand every
+    // message here. The rest of the manager's state, FileTransfer included,
+    // is only touched on this strand
+    boost::asio::strand<io_context::executor_type> control_strand_;
+    std::vector<std::thread>                       io_threads_;
+    // Set by updateNetworkSettings() for the next start()
+    size_t                                         io_thread_count_;
+    std::unique_ptr<tcp::acceptor>                 acceptor_;
+    std::shared_ptr<io_context::work>              work_;
 
     MessageHandler message_handler_;
+    // Guards peers_ and data_streams_, which are changed on the control
+    // strand and also read from the caller of sendMessage()
+    mutable std::mutex peers_mutex_;
     std::unordered_map<std::string, std::shared_ptr<PeerConnection>> peers_;
+    // Extra chunk-only connections per peer key, next to peers_ entries
+    std::unordered_map<std::string,
+                       std::vector<std::shared_ptr<PeerConnection>>>
+                                                 data_streams_;
+    std::unordered_map<uint64_t, StreamSession> stream_sessions_;
     std::shared_ptr<FileTransfer> file_transfer_;
     NetworkSettings               network_settings_;
+    std::shared_ptr<TokenBucket>  global_limiter_;
+    std::unordered_map<std::string, std::shared_ptr<TokenBucket>>
+                              peer_limiters_;
+    boost::asio::steady_timer rate_limit_timer_;
 
     uint16_t current_port_;
     QString  m_downloadDirectory;
@@ -2,23 +2,55 @@
 #define NETWORK_SETTINGS_HPP
 
 #include <boost/asio.hpp>
+#include <chrono>
 #include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "ChunkController.hpp"
+#include "Digest.hpp"
 #include "Logger.hpp"
+#include "TransferScheduler.hpp"
 
 using socket_base = boost::asio::socket_base;
 using tcp = boost::asio::ip::tcp;
 
+// Upload caps in bytes per second, 0 means unlimited
+struct RateLimits
+{
+    size_t global = 0;
+    size_t per_peer = 0;
+};
+
+// Limits that replace the default ones on some days between two local
+// times, such as business hours. An end before the start wraps past
+// midnight
+struct RateSchedule
+{
+    uint8_t    days = 0x7f; // bit 0 is Sunday
+    int        start_minute = 0;
+    int        end_minute = 0;
+    RateLimits limits;
+};
+
 class NetworkSettings
 {
   public:
     NetworkSettings() :
         window_size_(65536), // 64KB
         disable_nagle_(true), keep_alive_(true), reuse_address_(true),
-        send_buffer_size_(1048576),    // 1MB
-        receive_buffer_size_(1048576), // 1MB
-        min_buffer_size_(8192),        // 8KB
-        max_buffer_size_(16777216)     // 16MB
+        send_buffer_size_(1048576),     // 1MB
+        receive_buffer_size_(0),        // kernel autotuning
+        min_buffer_size_(8192),         // 8KB
+        max_buffer_size_(16777216),     // 16MB
+        max_in_flight_bytes_(33554432), // 32MB
+        max_in_flight_chunks_(32), hash_algorithm_(HashAlgorithm::CRC32C),
+        streams_per_peer_(4), scheduling_policy_(SchedulingPolicy::FIFO),
+        max_concurrent_transfers_(4), inline_threshold_(65536), // 64KB
+        delta_transfers_(true), content_chunking_(false), compression_(true),
+        chunk_control_policy_(ChunkControlPolicy::BBR), io_threads_(0)
     {}
 
     void setWindowSize(int size) { window_size_ = size; }
@@ -36,9 +68,149 @@ class NetworkSettings
     void setSendBufferSize(int size) { send_buffer_size_ = size; }
     int  getSendBufferSize() const { return send_buffer_size_; }
 
+    // 0 leaves the receive buffer to kernel autotuning. A fixed one locks
+    // the window, and a stream the reader falls behind on gets pruned and
+    // crawls at retransmission timeouts
     void setReceiveBufferSize(int size) { receive_buffer_size_ = size; }
     int  getReceiveBufferSize() const { return receive_buffer_size_; }
 
+    // Limits on unacknowledged chunk data per transfer, 0 means unlimited
+    void   setMaxInFlightBytes(size_t bytes) { max_in_flight_bytes_ = bytes; }
+    size_t getMaxInFlightBytes() const { return max_in_flight_bytes_; }
+
+    void   setMaxInFlightChunks(size_t count) { max_in_flight_chunks_ = count; }
+    size_t getMaxInFlightChunks() const { return max_in_flight_chunks_; }
+
+    // Digest announced in FileMetadata of outgoing files
+    void setHashAlgorithm(HashAlgorithm algorithm)
+    {
+        hash_algorithm_ = algorithm;
+    }
+    HashAlgorithm getHashAlgorithm() const { return hash_algorithm_; }
+
+    // TCP connections opened to each peer. Control messages use the first
+    // one, chunks are spread over all of them
+    void   setStreamsPerPeer(size_t count) { streams_per_peer_ = count; }
+    size_t getStreamsPerPeer() const { return streams_per_peer_; }
+
+    // Order and number of outgoing files sent at once, 0 means unlimited
+    void setSchedulingPolicy(SchedulingPolicy policy)
+    {
+        scheduling_policy_ = policy;
+    }
+    SchedulingPolicy getSchedulingPolicy() const { return scheduling_policy_; }
+
+    void setMaxConcurrentTransfers(size_t count)
+    {
+        max_concurrent_transfers_ = count;
+    }
+    size_t getMaxConcurrentTransfers() const
+    {
+        return max_concurrent_transfers_;
+    }
+
+    // Files up to this size are sent inside their metadata instead of as
+    // chunks, 0 disables it
+    void   setInlineThreshold(size_t bytes) { inline_threshold_ = bytes; }
+    size_t getInlineThreshold() const { return inline_threshold_; }
+
+    // Large files are sent as a delta against an older copy the receiver
+    // already has under the same name
+    void setDeltaTransfers(bool enable) { delta_transfers_ = enable; }
+    bool getDeltaTransfers() const { return delta_transfers_; }
+
+    // Large files offer their content-defined chunks first, so the receiver
+    // only asks for those missing from its chunk store. Replaces the delta
+    void setContentChunking(bool enable) { content_chunking_ = enable; }
+    bool getContentChunking() const { return content_chunking_; }
+
+    // Chunks are deflated when the link is slower than compressing them
+    void setCompression(bool enable) { compression_ = enable; }
+    bool getCompression() const { return compression_; }
+
+    // Sizes chunks and the window of outgoing transfers started afterwards.
+    // The in-flight limits above still cap the window
+    void setChunkControlPolicy(ChunkControlPolicy policy)
+    {
+        chunk_control_policy_ = policy;
+    }
+    ChunkControlPolicy getChunkControlPolicy() const
+    {
+        return chunk_control_policy_;
+    }
+
+    // Threads running network I/O from the next start, 0 picks them by the
+    // hardware threads
+    void   setIoThreads(size_t count) { io_threads_ = count; }
+    size_t getIoThreads() const { return io_threads_; }
+
+    // Caps outside of any schedule
+    void setRateLimits(const RateLimits& limits) { rate_limits_ = limits; }
+    RateLimits getRateLimits() const { return rate_limits_; }
+
+    // The first schedule covering the current time wins
+    void setRateSchedules(std::vector<RateSchedule> schedules)
+    {
+        rate_schedules_ = std::move(schedules);
+    }
+    const std::vector<RateSchedule>& getRateSchedules() const
+    {
+        return rate_schedules_;
+    }
+
+    // Cap of one peer in place of the per-peer one, 0 means unlimited
+    void setPeerRateLimit(const std::string& peer_key, size_t bytes_per_second)
+    {
+        peer_rate_limits_[peer_key] = bytes_per_second;
+    }
+    void clearPeerRateLimit(const std::string& peer_key)
+    {
+        peer_rate_limits_.erase(peer_key);
+    }
+
+    RateLimits getActiveRateLimits(std::chrono::system_clock::time_point now =
+                                       std::chrono::system_clock::now()) const
+    {
+        std::time_t time = std::chrono::system_clock::to_time_t(now);
+        std::tm     local{};
+#ifdef _WIN32
+        localtime_s(&local, &time);
+#else
+        localtime_r(&time, &local);
+#endif
+        int minute = local.tm_hour * 60 + local.tm_min;
+        int yesterday = (local.tm_wday + 6) % 7;
+        for (const RateSchedule& schedule : rate_schedules_)
+        {
+            // Past midnight the window belongs to the day it started on
+            bool in_window = false;
+            if (schedule.start_minute <= schedule.end_minute)
+            {
+                in_window = (schedule.days & (1u << local.tm_wday)) &&
+                            minute >= schedule.start_minute &&
+                            minute < schedule.end_minute;
+            } else {
+                in_window = ((schedule.days & (1u << local.tm_wday)) &&
+                             minute >= schedule.start_minute) ||
+                            ((schedule.days & (1u << yesterday)) &&
+                             minute < schedule.end_minute);
+            }
+            if (in_window)
+            {
+                return schedule.limits;
+            }
+        }
+        return rate_limits_;
+    }
+
+    size_t getPeerRateLimit(const std::string& peer_key,
+                            const RateLimits&  active_limits) const
+    {
+        auto it = peer_rate_limits_.find(peer_key);
+        return it != peer_rate_limits_.end() ? it->second
+                                             : active_limits.per_peer;
+    }
+
     void updateBufferSizes(size_t current_chunk_size)
     {
         size_t optimal_buffer_size = current_chunk_size * 2;
@@ -46,7 +218,6 @@ class NetworkSettings
             std::clamp(optimal_buffer_size, min_buffer_size_, max_buffer_size_);
 
         setSendBufferSize(optimal_buffer_size);
-        setReceiveBufferSize(optimal_buffer_size);
     }
 
     template <typename SocketType>
@@ -61,12 +232,15 @@ class NetworkSettings
                             .arg(ec.message().c_str()));
         }
 
-        socket.set_option(
-            socket_base::receive_buffer_size(receive_buffer_size_), ec);
-        if (ec)
+        if (receive_buffer_size_ > 0)
         {
-            LOG_WARNING(QString("Failed to set receive buffer size: %1")
-                            .arg(ec.message().c_str()));
+            socket.set_option(
+                socket_base::receive_buffer_size(receive_buffer_size_), ec);
+            if (ec)
+            {
+                LOG_WARNING(QString("Failed to set receive buffer size: %1")
+                                .arg(ec.message().c_str()));
+            }
         }
 
         socket.set_option(tcp::no_delay(disable_nagle_), ec);
@@ -100,6 +274,24 @@ class NetworkSettings
     int    receive_buffer_size_;
     size_t min_buffer_size_;
     size_t max_buffer_size_;
+    size_t max_in_flight_bytes_;
+    size_t max_in_flight_chunks_;
+
+    HashAlgorithm hash_algorithm_;
+    size_t        streams_per_peer_;
+
+    SchedulingPolicy   scheduling_policy_;
+    size_t             max_concurrent_transfers_;
+    size_t             inline_threshold_;
+    bool               delta_transfers_;
+    bool               content_chunking_;
+    bool               compression_;
+    ChunkControlPolicy chunk_control_policy_;
+    size_t             io_threads_;
+
+    RateLimits                              rate_limits_;
+    std::vector<RateSchedule>               rate_schedules_;
+    std::unordered_map<std::string, size_t> peer_rate_limits_;
 };
 
 #endif // NETWORK_SETTINGS_HPP
@@ -1,13 +1,18 @@
 #include "PeerConnection.hpp"
 
+std::atomic<uint32_t> PeerConnection::next_id_{1};
+
 std::shared_ptr<PeerConnection> PeerConnection::create(io_context& io_context)
 {
     return std::shared_ptr<PeerConnection>(new PeerConnection(io_context));
 }
 
 PeerConnection::PeerConnection(io_context& io_context) :
-    socket_(io_context), is_writing_(false), message_length_(0),
-    is_connected_(false)
+    id_(next_id_++), strand_(boost::asio::make_strand(io_context)),
+    socket_(strand_), throttle_timer_(strand_), is_writing_(false),
+    chunk_received_(0), is_connected_(false), queued_bytes_(0),
+    write_rate_(0.0),
+    message_length_(0)
 {
     read_buffer_.resize(1024);
 }
@@ -15,13 +20,23 @@ PeerConnection::PeerConnection(io_context& io_context) :
 void PeerConnection::start()
 {
     is_connected_ = true;
-    applyNetworkSettings();
-    doRead();
+    auto self(shared_from_this());
+    boost::asio::dispatch(strand_, [this, self]() {
+        applyNetworkSettings();
+        doRead();
+    });
 }
 
 void PeerConnection::stop()
 {
     is_connected_ = false;
+    auto self(shared_from_this());
+    boost::asio::dispatch(strand_, [this, self]() { close(); });
+}
+
+void PeerConnection::close()
+{
+    throttle_timer_.cancel();
     error_code ec;
     socket_.close(ec);
 
@@ -30,11 +45,19 @@ void PeerConnection::stop()
         LOG_ERROR(
             QString("Error closing socket: %1").arg(ec.message().c_str()));
     }
+
+    // Both a read and a write error may lead here, the handler runs once
+    if (CloseHandler handler = std::exchange(close_handler_, nullptr))
+    {
+        handler();
+    }
 }
 
 void PeerConnection::sendMessage(const Message& message)
 {
-    std::vector<uint8_t> data_to_send;
+    // Serialized on the calling thread, queued on the strand
+    OutgoingMessage data_to_send;
+    size_t          chunk_size = 0;
 
     switch (message.getType())
     {
@@ -48,43 +71,114 @@ void PeerConnection::sendMessage(const Message& message)
             break;
         case MessageType::CHUNK:
         {
-            data_to_send =
-                serializeMessage(static_cast<const ChunkMessage&>(message));
-            network_settings_.updateBufferSizes(data_to_send.size());
-            applyNetworkSettings();
+            const auto& chunk = static_cast<const ChunkMessage&>(message);
+            data_to_send = serializeChunkMessage(chunk);
+            chunk_size = chunk.getData().size();
             break;
         }
         case MessageType::CHUNK_METRICS:
             data_to_send =
                 serializeMessage(static_cast<const ChunkMetrics&>(message));
             break;
+        case MessageType::TRANSFER_FINALIZE:
+            data_to_send =
+                serializeMessage(static_cast<const TransferFinalize&>(message));
+            break;
+        case MessageType::CHUNK_RETRANSMIT:
+            data_to_send = serializeMessage(
+                static_cast<const ChunkRetransmitRequest&>(message));
+            break;
+        case MessageType::TRANSFER_RESUME:
+            data_to_send =
+                serializeMessage(static_cast<const TransferResume&>(message));
+            break;
+        case MessageType::STREAM_HELLO:
+            data_to_send =
+                serializeMessage(static_cast<const StreamHello&>(message));
+            break;
+        case MessageType::BLOCK_SIGNATURES:
+            data_to_send =
+                serializeMessage(static_cast<const BlockSignatures&>(message));
+            break;
+        case MessageType::DELTA_COPY:
+            data_to_send =
+                serializeMessage(static_cast<const DeltaCopy&>(message));
+            break;
+        case MessageType::TRANSFER_ABORT:
+            data_to_send =
+                serializeMessage(static_cast<const TransferAbort&>(message));
+            break;
         default: LOG_ERROR("Unknown message type"); return;
     }
 
     LOG_INFO(QString("Sending message of type: %1, size: %2")
                  .arg(static_cast<int>(message.getType()))
-                 .arg(data_to_send.size()));
+                 .arg(data_to_send.header.size() +
+                      (data_to_send.payload ? data_to_send.payload->size()
+                                            : 0)));
 
-    bool write_in_progress = !write_queue_.empty();
-    write_queue_.push(std::move(data_to_send));
-    if (!write_in_progress)
-    {
-        doWrite();
-    }
+    queued_bytes_ += data_to_send.size();
+    auto self(shared_from_this());
+    boost::asio::dispatch(
+        strand_, [this, self, chunk_size, lane = laneOf(message.getType()),
+                  data_to_send = std::move(data_to_send)]() mutable {
+            if (chunk_size > 0)
+            {
+                network_settings_.updateBufferSizes(chunk_size);
+                applyNetworkSettings();
+            }
+            write_queues_[lane].push(std::move(data_to_send));
+            if (!is_writing_)
+            {
+                doWrite();
+            }
+        });
 }
 
 void PeerConnection::setMessageHandler(MessageHandler handler)
 {
-    message_handler_ = std::move(handler);
+    auto self(shared_from_this());
+    boost::asio::dispatch(strand_,
+                          [this, self, handler = std::move(handler)]() mutable {
+                              message_handler_ = std::move(handler);
+                          });
+}
+
+void PeerConnection::setCloseHandler(CloseHandler handler)
+{
+    auto self(shared_from_this());
+    boost::asio::dispatch(strand_,
+                          [this, self, handler = std::move(handler)]() mutable {
+                              close_handler_ = std::move(handler);
+                          });
 }
 
 void PeerConnection::setNetworkSettings(const NetworkSettings& settings)
 {
-    network_settings_ = settings;
-    if (is_connected_)
-    {
-        applyNetworkSettings();
-    }
+    auto self(shared_from_this());
+    boost::asio::dispatch(strand_, [this, self, settings]() {
+        network_settings_ = settings;
+        if (is_connected_)
+        {
+            applyNetworkSettings();
+        }
+    });
+}
+
+void PeerConnection::setRateLimiters(
+    std::shared_ptr<TokenBucket> peer_limiter,
+    std::shared_ptr<TokenBucket> global_limiter)
+{
+    std::lock_guard<std::mutex> lock(limiters_mutex_);
+    peer_limiter_ = std::move(peer_limiter);
+    global_limiter_ = std::move(global_limiter);
+}
+
+std::array<std::shared_ptr<TokenBucket>, 2>
+PeerConnection::rateLimiters() const
+{
+    std::lock_guard<std::mutex> lock(limiters_mutex_);
+    return {peer_limiter_, global_limiter_};
 }
 
 boost::asio::ip::tcp::socket& PeerConnection::socket()
@@ -92,6 +186,24 @@ boost::asio::ip::tcp::socket& PeerConnection::socket()
     return socket_;
 }
 
+double PeerConnection::getQueueDrainTime() const
+{
+    if (queued_bytes_ == 0)
+    {
+        return 0.0;
+    }
+    // Until a write completes there is no rate, so order by queued bytes
+    double rate = std::max(write_rate_.load(), 1.0);
+    for (const auto& limiter : rateLimiters())
+    {
+        if (limiter && limiter->isLimited())
+        {
+            rate = std::min(rate, static_cast<double>(limiter->getRate()));
+        }
+    }
+    return queued_bytes_ / rate;
+}
+
 void PeerConnection::doRead()
 {
     readMessageType();
@@ -129,6 +241,17 @@ void PeerConnection::readMessageLength()
 
 void PeerConnection::readMessageBody()
 {
+    if (current_message_type_ == MessageType::CHUNK)
+    {
+        readChunkHeader();
+        return;
+    }
+    if (current_message_type_ == MessageType::CHUNK_FRAME)
+    {
+        readChunkFrame();
+        return;
+    }
+
     read_buffer_.resize(message_length_);
     auto self(shared_from_this());
     boost::asio::async_read(
@@ -138,6 +261,124 @@ void PeerConnection::readMessageBody()
         });
 }
 
+void PeerConnection::readChunkHeader()
+{
+    if (message_length_ < ChunkMessage::HEADER_SIZE || pending_chunk_)
+    {
+        LOG_ERROR(QString("Unexpected chunk message of size: %1")
+                      .arg(message_length_));
+        stop();
+        return;
+    }
+
+    auto self(shared_from_this());
+    boost::asio::async_read(
+        socket_, boost::asio::buffer(chunk_header_buffer_),
+        [this, self](const error_code& error, std::size_t bytes_transferred) {
+            if (error)
+            {
+                handleRead(error, bytes_transferred);
+                return;
+            }
+
+            // Payload beyond this message follows in CHUNK_FRAME messages
+            ChunkMessage::Header header =
+                ChunkMessage::parseHeader(chunk_header_buffer_.data());
+            size_t size = message_length_ - ChunkMessage::HEADER_SIZE;
+            if (size > header.payload_size)
+            {
+                LOG_ERROR("Chunk message size mismatch");
+                stop();
+                return;
+            }
+            readChunkPayload(header, size);
+        });
+}
+
+void PeerConnection::readChunkPayload(const ChunkMessage::Header& header,
+                                      size_t                      size)
+{
+    chunk_payload_.resize(header.payload_size);
+
+    auto self(shared_from_this());
+    boost::asio::async_read(
+        socket_, boost::asio::buffer(chunk_payload_.data(), size),
+        [this, self, header](const error_code& error,
+                             std::size_t       bytes_transferred) {
+            if (error)
+            {
+                handleRead(error, bytes_transferred);
+                return;
+            }
+
+            if (bytes_transferred < header.payload_size)
+            {
+                pending_chunk_ = header;
+                chunk_received_ = bytes_transferred;
+            } else {
+                dispatchChunk(header);
+            }
+            doRead();
+        });
+}
+
+void PeerConnection::readChunkFrame()
+{
+    if (!pending_chunk_ ||
+        message_length_ > pending_chunk_->payload_size - chunk_received_)
+    {
+        LOG_ERROR(QString("Unexpected chunk frame of size: %1")
+                      .arg(message_length_));
+        stop();
+        return;
+    }
+
+    auto self(shared_from_this());
+    boost::asio::async_read(
+        socket_,
+        boost::asio::buffer(chunk_payload_.data() + chunk_received_,
+                            message_length_),
+        [this, self](const error_code& error, std::size_t bytes_transferred) {
+            if (error)
+            {
+                handleRead(error, bytes_transferred);
+                return;
+            }
+
+            chunk_received_ += bytes_transferred;
+            if (chunk_received_ == pending_chunk_->payload_size)
+            {
+                ChunkMessage::Header header = *pending_chunk_;
+                pending_chunk_.reset();
+                dispatchChunk(header);
+            }
+            doRead();
+        });
+}
+
+void PeerConnection::dispatchChunk(const ChunkMessage::Header& header)
+{
+    network_settings_.updateBufferSizes(header.payload_size);
+    applyNetworkSettings();
+
+    if (message_handler_)
+    {
+        auto chunk_message = std::make_shared<ChunkMessage>(
+            header.transfer_handle, header.offset, std::move(chunk_payload_));
+        chunk_payload_ = {};
+        if (header.flags & ChunkMessage::FLAG_CHECKSUM)
+        {
+            chunk_message->setChecksum(header.checksum);
+        }
+        if (header.flags & ChunkMessage::FLAG_COMPRESSED)
+        {
+            chunk_message->setCompressed(header.data_size);
+        }
+        chunk_message->setSendTime(header.send_time);
+        message_handler_(std::move(chunk_message));
+    }
+}
+
 void PeerConnection::handleRead(const error_code& error,
                                 size_t            bytes_transferred)
 {
@@ -147,12 +388,6 @@ void PeerConnection::handleRead(const error_code& error,
                      .arg(static_cast<int>(current_message_type_))
                      .arg(bytes_transferred));
 
-        if (current_message_type_ == MessageType::CHUNK)
-        {
-            network_settings_.updateBufferSizes(bytes_transferred);
-            applyNetworkSettings();
-        }
-
         if (message_handler_)
         {
             processReceivedMessage();
@@ -166,64 +401,131 @@ void PeerConnection::handleRead(const error_code& error,
 
 void PeerConnection::processReceivedMessage()
 {
+    std::shared_ptr<Message> message;
     switch (current_message_type_)
     {
         case MessageType::TEXT:
-        {
-            TextMessage text_message = TextMessage::deserialize(read_buffer_);
-            message_handler_(text_message);
+            message = std::make_shared<TextMessage>(
+                TextMessage::deserialize(read_buffer_));
             break;
-        }
         case MessageType::FILE_METADATA:
-        {
-            FileMetadata file_metadata =
-                FileMetadata::deserialize(read_buffer_);
-            message_handler_(file_metadata);
+            message = std::make_shared<FileMetadata>(
+                FileMetadata::deserialize(read_buffer_));
             break;
-        }
-        case MessageType::CHUNK:
-        {
-            ChunkMessage chunk_message =
-                ChunkMessage::deserialize(read_buffer_);
-            message_handler_(chunk_message);
-            break;
-        }
         case MessageType::CHUNK_METRICS:
-        {
-            ChunkMetrics chunk_metrics =
-                ChunkMetrics::deserialize(read_buffer_);
-            message_handler_(chunk_metrics);
+            message = std::make_shared<ChunkMetrics>(
+                ChunkMetrics::deserialize(read_buffer_));
+            break;
+        case MessageType::TRANSFER_FINALIZE:
+            message = std::make_shared<TransferFinalize>(
+                TransferFinalize::deserialize(read_buffer_));
+            break;
+        case MessageType::CHUNK_RETRANSMIT:
+            message = std::make_shared<ChunkRetransmitRequest>(
+                ChunkRetransmitRequest::deserialize(read_buffer_));
+            break;
+        case MessageType::TRANSFER_RESUME:
+            message = std::make_shared<TransferResume>(
+                TransferResume::deserialize(read_buffer_));
+            break;
+        case MessageType::STREAM_HELLO:
+            message = std::make_shared<StreamHello>(
+                StreamHello::deserialize(read_buffer_));
+            break;
+        case MessageType::BLOCK_SIGNATURES:
+            message = std::make_shared<BlockSignatures>(
+                BlockSignatures::deserialize(read_buffer_));
+            break;
+        case MessageType::DELTA_COPY:
+            message = std::make_shared<DeltaCopy>(
+                DeltaCopy::deserialize(read_buffer_));
+            break;
+        case MessageType::TRANSFER_ABORT:
+            message = std::make_shared<TransferAbort>(
+                TransferAbort::deserialize(read_buffer_));
             break;
-        }
         default:
             LOG_ERROR(QString("Unknown message type received: %1")
                           .arg(static_cast<int>(current_message_type_)));
-            break;
+            return;
     }
+    message_handler_(std::move(message));
 }
 
 void PeerConnection::doWrite()
 {
-    if (write_queue_.empty())
+    if (!current_frame_)
     {
-        is_writing_ = false;
-        return;
+        bool queued = false;
+        for (const auto& queue : write_queues_)
+        {
+            queued = queued || !queue.empty();
+        }
+        if (!queued)
+        {
+            is_writing_ = false;
+            return;
+        }
+        current_frame_ = nextFrame();
     }
 
     is_writing_ = true;
+    const OutgoingFrame& frame = *current_frame_;
+    size_t size = takeWriteAllowance(frame.size() - frame.written);
+    if (size == 0)
+    {
+        return;
+    }
+
+    write_start_ = std::chrono::steady_clock::now();
     auto self(shared_from_this());
-    boost::asio::async_write(socket_, boost::asio::buffer(write_queue_.front()),
+
+    // The part of header and payload between written and written + size
+    size_t header_offset = std::min(frame.written, frame.header.size());
+    size_t header_size = std::min(frame.header.size() - header_offset, size);
+    size_t payload_offset =
+        frame.payload_offset + (frame.written - header_offset);
+    size_t payload_size = size - header_size;
+    std::array<boost::asio::const_buffer, 2> buffers = {
+        boost::asio::buffer(frame.header.data() + header_offset, header_size),
+        frame.payload
+            ? boost::asio::buffer(frame.payload->data() + payload_offset,
+                                  payload_size)
+            : boost::asio::const_buffer()};
+
+    boost::asio::async_write(socket_, buffers,
                              [this, self](const error_code& error,
-                                          std::size_t /*bytes_transferred*/) {
-                                 handleWrite(error);
+                                          std::size_t bytes_transferred) {
+                                 handleWrite(error, bytes_transferred);
                              });
 }
 
-void PeerConnection::handleWrite(const error_code& error)
+void PeerConnection::handleWrite(const error_code& error,
+                                 size_t            bytes_transferred)
 {
     if (!error)
     {
-        write_queue_.pop();
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - write_start_;
+        if (elapsed.count() > 0.0)
+        {
+            double rate = bytes_transferred / elapsed.count();
+            double previous = write_rate_;
+            write_rate_ =
+                previous == 0.0 ? rate : 0.8 * previous + 0.2 * rate;
+        }
+
+        queued_bytes_ -= bytes_transferred;
+        OutgoingFrame& frame = *current_frame_;
+        frame.written += bytes_transferred;
+        if (frame.written == frame.size())
+        {
+            if (frame.last)
+            {
+                write_queues_[frame.lane].pop();
+            }
+            current_frame_.reset();
+        }
         doWrite();
     } else {
         LOG_ERROR(QString("Write error: %1").arg(error.message().c_str()));
@@ -231,6 +533,134 @@ void PeerConnection::handleWrite(const error_code& error)
     }
 }
 
+PeerConnection::OutgoingFrame PeerConnection::nextFrame()
+{
+    OutgoingFrame frame;
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        if (write_queues_[lane].empty())
+        {
+            continue;
+        }
+
+        OutgoingMessage& message = write_queues_[lane].front();
+        size_t payload_size = message.payload ? message.payload->size() : 0;
+        frame.lane = static_cast<Lane>(lane);
+        frame.payload = message.payload;
+        frame.payload_offset = message.framed;
+        frame.payload_size =
+            std::min(payload_size - message.framed, MAX_FRAME_PAYLOAD);
+        if (!message.header_sent)
+        {
+            frame.header = std::move(message.header);
+            message.header_sent = true;
+        } else {
+            frame.header = makeEnvelope(
+                MessageType::CHUNK_FRAME,
+                static_cast<uint32_t>(frame.payload_size), 0);
+            queued_bytes_ += frame.header.size();
+        }
+        message.framed += frame.payload_size;
+        frame.last = message.framed == payload_size;
+        break;
+    }
+    return frame;
+}
+
+PeerConnection::Lane PeerConnection::laneOf(MessageType type)
+{
+    switch (type)
+    {
+        case MessageType::CHUNK: return DATA_LANE;
+        case MessageType::FILE_METADATA:
+        case MessageType::TRANSFER_FINALIZE:
+        case MessageType::TRANSFER_RESUME:
+        case MessageType::BLOCK_SIGNATURES:
+        case MessageType::DELTA_COPY:
+        // Behind the metadata it cancels, which may still be queued
+        case MessageType::TRANSFER_ABORT: return TRANSFER_LANE;
+        default: return URGENT_LANE;
+    }
+}
+
+size_t PeerConnection::takeWriteAllowance(size_t remaining)
+{
+    std::array<std::shared_ptr<TokenBucket>, 2> limiters = rateLimiters();
+    bool                                        limited = false;
+    for (const auto& limiter : limiters)
+    {
+        limited = limited || (limiter && limiter->isLimited());
+    }
+    if (!limited)
+    {
+        return remaining;
+    }
+
+    size_t size = std::min(remaining, MAX_WRITE_SLICE);
+    size_t min_size = std::min(size, MIN_WRITE_SLICE);
+    TokenBucket::Clock::duration wait = TokenBucket::Clock::duration::zero();
+    for (const auto& limiter : limiters)
+    {
+        if (limiter && limiter->isLimited())
+        {
+            size = std::min(size, limiter->available());
+            wait = std::max(wait, limiter->waitTime(min_size));
+        }
+    }
+
+    if (size < min_size)
+    {
+        auto self(shared_from_this());
+        throttle_timer_.expires_after(std::clamp<TokenBucket::Clock::duration>(
+            wait, std::chrono::milliseconds(1), MAX_THROTTLE_WAIT));
+        throttle_timer_.async_wait([this, self](const error_code& error) {
+            if (!error && is_connected_)
+            {
+                doWrite();
+            }
+        });
+        return 0;
+    }
+
+    for (const auto& limiter : limiters)
+    {
+        if (limiter)
+        {
+            limiter->consume(size);
+        }
+    }
+    return size;
+}
+
+PeerConnection::OutgoingMessage
+PeerConnection::serializeChunkMessage(const ChunkMessage& chunk)
+{
+    std::vector<uint8_t> chunk_header = chunk.serializeHeader();
+    uint32_t             length = static_cast<uint32_t>(
+        chunk_header.size() +
+        std::min(chunk.getData().size(), MAX_FRAME_PAYLOAD));
+
+    std::vector<uint8_t> header =
+        makeEnvelope(MessageType::CHUNK, length, chunk_header.size());
+    header.insert(header.end(), chunk_header.begin(), chunk_header.end());
+
+    return {std::move(header), chunk.getPayload()};
+}
+
+std::vector<uint8_t> PeerConnection::makeEnvelope(MessageType type,
+                                                  uint32_t    length,
+                                                  size_t      body_capacity)
+{
+    std::vector<uint8_t> envelope(MESSAGE_TYPE_SIZE + MESSAGE_LENGTH_SIZE);
+    envelope.reserve(envelope.size() + body_capacity);
+
+    std::memcpy(envelope.data(), &type, MESSAGE_TYPE_SIZE);
+    std::memcpy(envelope.data() + MESSAGE_TYPE_SIZE, &length,
+                MESSAGE_LENGTH_SIZE);
+
+    return envelope;
+}
+
 void PeerConnection::applyNetworkSettings()
 {
     if (!is_connected_)
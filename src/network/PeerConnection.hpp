@@ -1,26 +1,46 @@
 #ifndef PEER_CONNECTION_HPP
 #define PEER_CONNECTION_HPP
 
+#include <array>
+#include <atomic>
 #include <boost/asio.hpp>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
 
 #include "Logger.hpp"
+#include "Message/BlockSignatures.hpp"
 #include "Message/ChunkMessage.hpp"
 #include "Message/ChunkMetrics.hpp"
+#include "Message/ChunkRetransmitRequest.hpp"
+#include "Message/DeltaCopy.hpp"
 #include "Message/FileMetadata.hpp"
 #include "Message/Message.hpp"
+#include "Message/StreamHello.hpp"
 #include "Message/TextMessage.hpp"
+#include "Message/TransferAbort.hpp"
+#include "Message/TransferFinalize.hpp"
+#include "Message/TransferResume.hpp"
 #include "NetworkSettings.hpp"
+#include "TokenBucket.hpp"
 
+// One TCP connection. Its socket, timer and queues live on a strand of its
+// own, so connections read and write on any thread of the io_context pool
+// without waiting on each other. The public calls are safe from any thread
+// and run on the strand, or are queued to it. The message handler is called
+// on the strand and owns the message it gets
 class PeerConnection : public std::enable_shared_from_this<PeerConnection>
 {
   public:
     using tcp = boost::asio::ip::tcp;
     using error_code = boost::system::error_code;
     using io_context = boost::asio::io_context;
-    using MessageHandler = std::function<void(const Message&)>;
+    using Strand = boost::asio::strand<io_context::executor_type>;
+    using MessageHandler = std::function<void(std::shared_ptr<Message>)>;
+    using CloseHandler = std::function<void()>;
 
     static std::shared_ptr<PeerConnection> create(io_context& io_context);
 
@@ -29,59 +49,166 @@ class PeerConnection : public std::enable_shared_from_this<PeerConnection>
 
     void sendMessage(const Message& message);
     void setMessageHandler(MessageHandler handler);
+    // Called on the strand once the socket is closed, by stop() or after
+    // a read or write error
+    void setCloseHandler(CloseHandler handler);
     void setNetworkSettings(const NetworkSettings& settings);
+    // Buckets of the peer and of all peers, writes wait on both. Either
+    // may be null
+    void setRateLimiters(std::shared_ptr<TokenBucket> peer_limiter,
+                         std::shared_ptr<TokenBucket> global_limiter);
 
+    // Only to connect or accept, before start()
     tcp::socket& socket();
+    uint32_t     getId() const { return id_; }
+    bool         isConnected() const { return is_connected_; }
+
+    // Seconds until everything queued now is written at the recent write
+    // rate, used to pick the least loaded stream for the next chunk
+    double getQueueDrainTime() const;
 
   private:
+    // Write queues, drained highest first. Acks and other small replies
+    // must not wait behind transfer setup, and nothing waits behind chunk
+    // data for longer than one frame. Each lane keeps its own order, so
+    // metadata still goes out before the chunks of its file
+    enum Lane : size_t
+    {
+        URGENT_LANE,   // acks, retransmit requests, text, stream hello
+        TRANSFER_LANE, // metadata, finalize, resume and delta messages
+        DATA_LANE,     // chunks
+        LANE_COUNT,
+    };
+
+    // Envelope plus inline body, with an optional payload written from its
+    // own buffer so large chunk data is never copied into the queue
+    struct OutgoingMessage
+    {
+        std::vector<uint8_t>  header;
+        ChunkMessage::Payload payload;
+        // Payload bytes handed to frames so far
+        size_t                framed = 0;
+        bool                  header_sent = false;
+
+        size_t size() const
+        {
+            return header.size() + (payload ? payload->size() : 0);
+        }
+    };
+
+    using WriteQueue = std::queue<OutgoingMessage>;
+
+    // Unit of writing: the message header with the first part of its
+    // payload, or a CHUNK_FRAME with the next part. Frames of different
+    // lanes interleave, bytes within a frame never do
+    struct OutgoingFrame
+    {
+        std::vector<uint8_t>  header;
+        ChunkMessage::Payload payload;
+        size_t                payload_offset = 0;
+        size_t                payload_size = 0;
+        Lane                  lane = URGENT_LANE;
+        // Completes its message, which then leaves the queue
+        bool                  last = false;
+        // Bytes already written when rate limits split the frame
+        size_t                written = 0;
+
+        size_t size() const { return header.size() + payload_size; }
+    };
+
+    // Chunk payload carried in the frame that holds the chunk header, the
+    // rest follows in CHUNK_FRAME messages of up to this size
+    static constexpr size_t MAX_FRAME_PAYLOAD = 65536; // 64KB
+
+    // Slices a rate-limited message is written in, so the limit holds
+    // within large chunks and a slice waits at most briefly for tokens
+    static constexpr size_t MAX_WRITE_SLICE = 65536; // 64KB
+    static constexpr size_t MIN_WRITE_SLICE = 4096;  // 4KB
+    // Waits are re-checked this often, so raised limits apply quickly
+    static constexpr std::chrono::milliseconds MAX_THROTTLE_WAIT{100};
+
     explicit PeerConnection(io_context& io_context);
 
     void doRead();
     void readMessageType();
     void readMessageLength();
     void readMessageBody();
+    void readChunkHeader();
+    void readChunkPayload(const ChunkMessage::Header& header,
+                          size_t                      size);
+    void readChunkFrame();
+    void dispatchChunk(const ChunkMessage::Header& header);
     void handleRead(const error_code& error, size_t bytes_transferred);
     void processReceivedMessage();
 
     void doWrite();
-    void handleWrite(const error_code& error);
+    void handleWrite(const error_code& error, size_t bytes_transferred);
+    // Cuts the next frame from the highest non-empty lane
+    OutgoingFrame nextFrame();
+    static Lane   laneOf(MessageType type);
+    // Bytes of the current frame the limiters allow now, 0 after arming
+    // throttle_timer_ to try again
+    size_t takeWriteAllowance(size_t remaining);
 
     void applyNetworkSettings();
+    void close();
+    std::array<std::shared_ptr<TokenBucket>, 2> rateLimiters() const;
 
     template <typename T>
-    std::vector<uint8_t> serializeMessage(const T& message);
-
-    tcp::socket                      socket_;
-    std::vector<uint8_t>             read_buffer_;
-    std::queue<std::vector<uint8_t>> write_queue_;
-    MessageHandler                   message_handler_;
-    bool                             is_writing_;
-    bool                             is_connected_;
-    uint32_t                         message_length_;
-    MessageType                      current_message_type_;
-    NetworkSettings                  network_settings_;
+    OutgoingMessage serializeMessage(const T& message);
+    OutgoingMessage serializeChunkMessage(const ChunkMessage& chunk);
+
+    static std::vector<uint8_t> makeEnvelope(MessageType type, uint32_t length,
+                                             size_t body_capacity);
+
+    static std::atomic<uint32_t> next_id_;
+
+    uint32_t                                       id_;
+    Strand                                         strand_;
+    tcp::socket                                    socket_;
+    std::vector<uint8_t>                           read_buffer_;
+    std::array<uint8_t, ChunkMessage::HEADER_SIZE> chunk_header_buffer_;
+    std::vector<uint8_t>                           chunk_payload_;
+    // Header of the chunk whose payload is still arriving in frames, and
+    // the payload bytes read so far
+    std::optional<ChunkMessage::Header>            pending_chunk_;
+    size_t                                         chunk_received_;
+    std::array<WriteQueue, LANE_COUNT>             write_queues_;
+    std::optional<OutgoingFrame>                   current_frame_;
+    // Guards the limiters, which the drain time reads off the strand
+    mutable std::mutex                             limiters_mutex_;
+    std::shared_ptr<TokenBucket>                   peer_limiter_;
+    std::shared_ptr<TokenBucket>                   global_limiter_;
+    boost::asio::steady_timer                      throttle_timer_;
+    MessageHandler                                 message_handler_;
+    CloseHandler                                   close_handler_;
+    bool                                           is_writing_;
+    std::atomic<bool>                              is_connected_;
+    // Counted when a message is handed over, before it reaches the strand
+    std::atomic<size_t>                            queued_bytes_;
+    std::atomic<double>                            write_rate_; // bytes/s
+    std::chrono::steady_clock::time_point          write_start_;
+    uint32_t                                       message_length_;
+    MessageType                                    current_message_type_;
+    NetworkSettings                                network_settings_;
 
     static constexpr size_t MESSAGE_TYPE_SIZE = sizeof(MessageType);
     static constexpr size_t MESSAGE_LENGTH_SIZE = sizeof(uint32_t);
 };
 
 template <typename T>
-std::vector<uint8_t> PeerConnection::serializeMessage(const T& message)
+PeerConnection::OutgoingMessage
+PeerConnection::serializeMessage(const T& message)
 {
     std::vector<uint8_t> serialized_data = message.serialize();
     uint32_t             length = static_cast<uint32_t>(serialized_data.size());
-    MessageType          type = message.getType();
-
-    std::vector<uint8_t> data_to_send(sizeof(MessageType) + sizeof(length) +
-                                      serialized_data.size());
 
-    std::memcpy(data_to_send.data(), &type, sizeof(MessageType));
-    std::memcpy(data_to_send.data() + sizeof(MessageType), &length,
-                sizeof(length));
-    std::memcpy(data_to_send.data() + sizeof(MessageType) + sizeof(length),
-                serialized_data.data(), serialized_data.size());
+    std::vector<uint8_t> data_to_send =
+        makeEnvelope(message.getType(), length, serialized_data.size());
+    data_to_send.insert(data_to_send.end(), serialized_data.begin(),
+                        serialized_data.end());
 
-    return data_to_send;
+    return {std::move(data_to_send), nullptr};
 }
 
 #endif // PEER_CONNECTION_HPP
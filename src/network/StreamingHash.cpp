@@ -0,0 +1,67 @@
+#include "StreamingHash.hpp"
+
+StreamingHash::StreamingHash() : StreamingHash(HashAlgorithm::CRC32) {}
+
+StreamingHash::StreamingHash(HashAlgorithm algorithm,
+                             size_t        max_buffered_bytes) :
+    digest_(Digest::create(algorithm)), hashed_bytes_(0), buffered_bytes_(0),
+    max_buffered_bytes_(max_buffered_bytes), valid_(true)
+{}
+
+void StreamingHash::update(uint64_t offset, Data data)
+{
+    if (!valid_ || !data || offset + data->size() <= hashed_bytes_)
+    {
+        return;
+    }
+
+    if (offset > hashed_bytes_)
+    {
+        if (buffered_bytes_ + data->size() > max_buffered_bytes_)
+        {
+            invalidate();
+            return;
+        }
+
+        buffered_bytes_ += data->size();
+        auto [it, inserted] = reorder_buffer_.emplace(offset, data);
+        if (!inserted)
+        {
+            buffered_bytes_ -= data->size();
+        }
+        return;
+    }
+
+    // Overlapping chunks only contribute the bytes past the hashed prefix
+    consume(*data, static_cast<size_t>(hashed_bytes_ - offset));
+
+    auto it = reorder_buffer_.begin();
+    while (it != reorder_buffer_.end() && it->first <= hashed_bytes_)
+    {
+        const std::vector<uint8_t>& buffered = *it->second;
+        if (it->first + buffered.size() > hashed_bytes_)
+        {
+            consume(buffered, static_cast<size_t>(hashed_bytes_ - it->first));
+        }
+        buffered_bytes_ -= buffered.size();
+        it = reorder_buffer_.erase(it);
+    }
+}
+
+void StreamingHash::invalidate()
+{
+    valid_ = false;
+    reorder_buffer_.clear();
+    buffered_bytes_ = 0;
+}
+
+std::string StreamingHash::digest() const
+{
+    return digest_->digest();
+}
+
+void StreamingHash::consume(const std::vector<uint8_t>& data, size_t skip)
+{
+    digest_->update(data.data() + skip, data.size() - skip);
+    hashed_bytes_ += data.size() - skip;
+}
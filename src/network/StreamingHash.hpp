@@ -0,0 +1,50 @@
+#ifndef STREAMING_HASH_HPP
+#define STREAMING_HASH_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Digest.hpp"
+
+// Folds received chunks into the file digest as they arrive. Chunks ahead
+// of the hashed prefix wait in a bounded reorder buffer; if the buffer
+// overflows the digest is abandoned and the caller falls back to hashing
+// the file from disk
+class StreamingHash
+{
+  public:
+    using Data = std::shared_ptr<const std::vector<uint8_t>>;
+
+    static constexpr size_t DEFAULT_MAX_BUFFERED_BYTES = 67108864; // 64MB
+
+    StreamingHash();
+    explicit StreamingHash(
+        HashAlgorithm algorithm,
+        size_t        max_buffered_bytes = DEFAULT_MAX_BUFFERED_BYTES);
+
+    void update(uint64_t offset, Data data);
+    // For files whose bytes do not all pass through update(), e.g. resumed
+    // transfers
+    void invalidate();
+
+    bool     isValid() const { return valid_; }
+    uint64_t hashedBytes() const { return hashed_bytes_; }
+
+    // Same as FileSystemManager::calculateFileHash with the same algorithm
+    std::string digest() const;
+
+  private:
+    void consume(const std::vector<uint8_t>& data, size_t skip);
+
+    std::unique_ptr<Digest>  digest_;
+    uint64_t                 hashed_bytes_;
+    std::map<uint64_t, Data> reorder_buffer_;
+    size_t                   buffered_bytes_;
+    size_t                   max_buffered_bytes_;
+    bool                     valid_;
+};
+
+#endif // STREAMING_HASH_HPP
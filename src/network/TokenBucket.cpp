@@ -0,0 +1,59 @@
+#include "TokenBucket.hpp"
+
+#include <algorithm>
+
+TokenBucket::TokenBucket(size_t bytes_per_second) :
+    rate_(0), capacity_(0.0), tokens_(0.0), last_refill_(Clock::now())
+{
+    setRate(bytes_per_second);
+}
+
+void TokenBucket::setRate(size_t bytes_per_second)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill();
+    bool was_limited = isLimited();
+    rate_ = bytes_per_second;
+    capacity_ = std::max(rate_ / 10.0, static_cast<double>(MIN_BURST));
+    // A new limit starts with a full burst, a changed one keeps its tokens
+    tokens_ = was_limited ? std::min(tokens_, capacity_) : capacity_;
+}
+
+size_t TokenBucket::available()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill();
+    return tokens_ > 0.0 ? static_cast<size_t>(tokens_) : 0;
+}
+
+void TokenBucket::consume(size_t bytes)
+{
+    if (isLimited())
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tokens_ -= static_cast<double>(bytes);
+    }
+}
+
+TokenBucket::Clock::duration TokenBucket::waitTime(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill();
+    if (!isLimited() || tokens_ >= static_cast<double>(bytes))
+    {
+        return Clock::duration::zero();
+    }
+    std::chrono::duration<double> wait((bytes - tokens_) / rate_);
+    return std::chrono::duration_cast<Clock::duration>(wait);
+}
+
+void TokenBucket::refill()
+{
+    Clock::time_point now = Clock::now();
+    if (isLimited())
+    {
+        std::chrono::duration<double> elapsed = now - last_refill_;
+        tokens_ = std::min(capacity_, tokens_ + elapsed.count() * rate_);
+    }
+    last_refill_ = now;
+}
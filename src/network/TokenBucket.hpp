@@ -0,0 +1,47 @@
+#ifndef TOKEN_BUCKET_HPP
+#define TOKEN_BUCKET_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+// Byte rate limit for outgoing data. Tokens refill at the rate up to a
+// burst of 100ms worth, so a connection that was idle cannot flood the
+// link. Shared by every stream it limits, which write from their own
+// strands, and changed in place so new limits apply to running transfers.
+// Streams may both take what available() reported, the overdraft is then
+// waited off by the next writes
+class TokenBucket
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // Smallest burst, so low rates still write in useful slices
+    static constexpr size_t MIN_BURST = 16384; // 16KB
+
+    // 0 means unlimited
+    explicit TokenBucket(size_t bytes_per_second = 0);
+
+    void   setRate(size_t bytes_per_second);
+    size_t getRate() const { return rate_; }
+    bool   isLimited() const { return rate_ > 0; }
+
+    // Bytes that may be written now
+    size_t available();
+    void   consume(size_t bytes);
+    // Time until the given bytes may be written
+    Clock::duration waitTime(size_t bytes);
+
+  private:
+    // Callers hold mutex_
+    void refill();
+
+    std::mutex          mutex_;
+    std::atomic<size_t> rate_;
+    double              capacity_;
+    double              tokens_;
+    Clock::time_point   last_refill_;
+};
+
+#endif // TOKEN_BUCKET_HPP
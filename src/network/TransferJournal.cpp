@@ -0,0 +1,139 @@
+#include "TransferJournal.hpp"
+
+#include "Logger.hpp"
+#include "Message/WireFormat.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr uint32_t JOURNAL_MAGIC = 0x314A5351; // "QSJ1"
+constexpr size_t   HEADER_SIZE = 20;
+constexpr size_t   RECORD_SIZE = 16;
+
+} // namespace
+
+std::unique_ptr<TransferJournal>
+TransferJournal::open(const fs::path& file_path, uint64_t file_size,
+                      uint64_t file_version)
+{
+    std::unique_ptr<TransferJournal> journal(new TransferJournal(
+        journalPath(file_path), file_size, file_version));
+
+    // A journal without its data file describes nothing
+    std::error_code ec;
+    if (!journal->load() || fs::file_size(file_path, ec) != file_size || ec)
+    {
+        journal->recovered_.clear();
+    }
+
+    if (!journal->rewrite())
+    {
+        return nullptr;
+    }
+    return journal;
+}
+
+fs::path TransferJournal::journalPath(const fs::path& file_path)
+{
+    fs::path path = file_path;
+    path += EXTENSION;
+    return path;
+}
+
+TransferJournal::TransferJournal(fs::path path, uint64_t file_size,
+                                 uint64_t file_version) :
+    path_(std::move(path)),
+    file_size_(file_size), file_version_(file_version)
+{}
+
+void TransferJournal::record(uint64_t offset, uint64_t size)
+{
+    uint8_t record[RECORD_SIZE];
+    wire::putLE<uint64_t>(record, offset);
+    wire::putLE<uint64_t>(record + 8, size);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file_.is_open())
+    {
+        return;
+    }
+    file_.write(reinterpret_cast<const char*>(record), sizeof(record));
+    file_.flush();
+}
+
+void TransferJournal::remove()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_.close();
+    std::error_code ec;
+    fs::remove(path_, ec);
+}
+
+bool TransferJournal::load()
+{
+    std::ifstream file(path_, std::ios::binary);
+    uint8_t       header[HEADER_SIZE];
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+        wire::getLE<uint32_t>(header) != JOURNAL_MAGIC ||
+        wire::getLE<uint64_t>(header + 4) != file_size_ ||
+        wire::getLE<uint64_t>(header + 12) != file_version_)
+    {
+        return false;
+    }
+
+    // A record torn by a crash is shorter than RECORD_SIZE and ignored
+    uint8_t record[RECORD_SIZE];
+    while (file.read(reinterpret_cast<char*>(record), sizeof(record)))
+    {
+        uint64_t offset = wire::getLE<uint64_t>(record);
+        uint64_t size = wire::getLE<uint64_t>(record + 8);
+        if (offset > file_size_ || size > file_size_ - offset)
+        {
+            return false;
+        }
+        recovered_.add(offset, offset + size);
+    }
+    return true;
+}
+
+bool TransferJournal::rewrite()
+{
+    // Merged extents replace the per-chunk records of the previous run
+    fs::path tmp_path = path_;
+    tmp_path += ".tmp";
+    {
+        std::ofstream tmp(tmp_path, std::ios::binary | std::ios::trunc);
+        uint8_t       header[HEADER_SIZE];
+        wire::putLE<uint32_t>(header, JOURNAL_MAGIC);
+        wire::putLE<uint64_t>(header + 4, file_size_);
+        wire::putLE<uint64_t>(header + 12, file_version_);
+        tmp.write(reinterpret_cast<const char*>(header), sizeof(header));
+        for (const auto& [begin, end] : recovered_.extents())
+        {
+            uint8_t record[RECORD_SIZE];
+            wire::putLE<uint64_t>(record, begin);
+            wire::putLE<uint64_t>(record + 8, end - begin);
+            tmp.write(reinterpret_cast<const char*>(record), sizeof(record));
+        }
+        if (!tmp)
+        {
+            LOG_WARNING(QString("Unable to write transfer journal: %1")
+                            .arg(tmp_path.string().c_str()));
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tmp_path, path_, ec);
+    if (ec)
+    {
+        LOG_WARNING(QString("Unable to replace transfer journal: %1")
+                        .arg(ec.message().c_str()));
+        return false;
+    }
+
+    file_.open(path_, std::ios::binary | std::ios::app);
+    return file_.is_open();
+}
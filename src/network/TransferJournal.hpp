@@ -0,0 +1,54 @@
+#ifndef TRANSFER_JOURNAL_HPP
+#define TRANSFER_JOURNAL_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#include "ExtentSet.hpp"
+
+// Sidecar file next to a partially received file, listing the byte ranges
+// already written to it. A range is appended only after its chunk write
+// returned, so after a crash or a dropped connection everything listed is
+// on disk and the transfer can resume from the gaps. The final hash check
+// still guards against writes lost to a power failure
+class TransferJournal
+{
+  public:
+    static constexpr const char* EXTENSION = ".qsjournal";
+
+    // Reopens the journal of the same source version, or starts an empty
+    // one. Returns nullptr if the journal file cannot be written
+    static std::unique_ptr<TransferJournal>
+    open(const std::filesystem::path& file_path, uint64_t file_size,
+         uint64_t file_version);
+
+    static std::filesystem::path
+    journalPath(const std::filesystem::path& file_path);
+
+    // Ranges recovered from a previous run, empty for a new journal
+    const ExtentSet& recoveredExtents() const { return recovered_; }
+
+    // Called from disk workers once a chunk is written
+    void record(uint64_t offset, uint64_t size);
+    // Deletes the journal once the transfer completed or was given up
+    void remove();
+
+  private:
+    TransferJournal(std::filesystem::path path, uint64_t file_size,
+                    uint64_t file_version);
+
+    bool load();
+    bool rewrite();
+
+    std::filesystem::path path_;
+    uint64_t              file_size_;
+    uint64_t              file_version_;
+    ExtentSet             recovered_;
+    std::mutex            mutex_;
+    std::ofstream         file_;
+};
+
+#endif // TRANSFER_JOURNAL_HPP
@@ -0,0 +1,138 @@
+#include "TransferScheduler.hpp"
+
+#include <algorithm>
+
+TransferScheduler::TransferScheduler(SchedulingPolicy policy,
+                                     size_t           max_active) :
+    policy_(policy), max_active_(max_active)
+{}
+
+void TransferScheduler::setPeerWeight(const std::string& peer_id,
+                                      double             weight)
+{
+    peers_[peer_id].weight = weight > 0.0 ? weight : 1.0;
+}
+
+void TransferScheduler::enqueue(Request request)
+{
+    PeerQueue& peer = peers_[request.peer_id];
+    dropStaleSequences(peer);
+    if (peer.sequences.empty())
+    {
+        peer.virtual_time = std::max(peer.virtual_time, virtual_clock_);
+    }
+
+    // Sequences may arrive out of order, keep each peer queue sorted
+    auto position = std::upper_bound(peer.sequences.begin(),
+                                     peer.sequences.end(), request.sequence);
+    peer.sequences.insert(position, request.sequence);
+
+    by_size_.emplace(request.file_size, request.sequence);
+    pending_.emplace(request.sequence, std::move(request));
+}
+
+std::optional<TransferScheduler::Request> TransferScheduler::next()
+{
+    if (pending_.empty() || (max_active_ != 0 && active_count_ >= max_active_))
+    {
+        return std::nullopt;
+    }
+
+    std::map<uint64_t, Request>::iterator it;
+    switch (policy_)
+    {
+        case SchedulingPolicy::SHORTEST_REMAINING_FIRST:
+            it = pending_.find(by_size_.begin()->second);
+            break;
+        case SchedulingPolicy::FAIR_SHARE: it = selectFairShare(); break;
+        case SchedulingPolicy::FIFO:
+        default: it = pending_.begin(); break;
+    }
+
+    Request    request = std::move(it->second);
+    PeerQueue& peer = peers_[request.peer_id];
+    virtual_clock_ = std::max(virtual_clock_, peer.virtual_time);
+    peer.virtual_time += request.file_size / peer.weight;
+    ++peer.active;
+    ++active_count_;
+
+    by_size_.erase({request.file_size, request.sequence});
+    pending_.erase(it);
+    return request;
+}
+
+void TransferScheduler::finished(const std::string& peer_id)
+{
+    if (active_count_ > 0)
+    {
+        --active_count_;
+    }
+
+    auto peer_it = peers_.find(peer_id);
+    if (peer_it == peers_.end())
+    {
+        return;
+    }
+    PeerQueue& peer = peer_it->second;
+    if (peer.active > 0)
+    {
+        --peer.active;
+    }
+    dropStaleSequences(peer);
+    if (peer.active == 0 && peer.sequences.empty() && peer.weight == 1.0)
+    {
+        peers_.erase(peer_it);
+    }
+}
+
+size_t TransferScheduler::dropPeer(const std::string& peer_id)
+{
+    size_t dropped_bytes = 0;
+    for (auto it = pending_.begin(); it != pending_.end();)
+    {
+        if (it->second.peer_id == peer_id)
+        {
+            dropped_bytes += it->second.file_size;
+            by_size_.erase({it->second.file_size, it->second.sequence});
+            it = pending_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    auto peer_it = peers_.find(peer_id);
+    if (peer_it != peers_.end())
+    {
+        peer_it->second.sequences.clear();
+    }
+    return dropped_bytes;
+}
+
+std::map<uint64_t, TransferScheduler::Request>::iterator
+TransferScheduler::selectFairShare()
+{
+    PeerQueue* selected = nullptr;
+    for (auto& [peer_id, peer] : peers_)
+    {
+        dropStaleSequences(peer);
+        if (peer.sequences.empty())
+        {
+            continue;
+        }
+        if (!selected || peer.virtual_time < selected->virtual_time)
+        {
+            selected = &peer;
+        }
+    }
+    return pending_.find(selected->sequences.front());
+}
+
+void TransferScheduler::dropStaleSequences(PeerQueue& queue) const
+{
+    // Requests started by another policy leave their sequence behind
+    while (!queue.sequences.empty() &&
+           pending_.find(queue.sequences.front()) == pending_.end())
+    {
+        queue.sequences.pop_front();
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef TRANSFER_SCHEDULER_HPP
+#define TRANSFER_SCHEDULER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+class FileBundle;
+
+// Order in which queued outgoing files are started
+enum class SchedulingPolicy : uint8_t {
+    FIFO,                     // submission order
+    SHORTEST_REMAINING_FIRST, // smallest file first, submission order on ties
+    FAIR_SHARE,               // bytes started per peer, scaled by peer weight
+};
+
+// Queue of outgoing files that limits how many run at once, so a batch of
+// thousands of files does not open them all against the same sockets and
+// disks. Not thread-safe, FileTransfer only uses it on the network executor
+class TransferScheduler
+{
+  public:
+    struct Request
+    {
+        std::string file_path;
+        std::string peer_id;
+        size_t      file_size = 0;
+        // Submission order, assigned by the caller before the size is known
+        uint64_t    sequence = 0;
+        // Name announced to the receiver, the file name when empty
+        std::string remote_name;
+        // Small files sent together in place of file_path
+        std::shared_ptr<FileBundle> bundle;
+    };
+
+    explicit TransferScheduler(SchedulingPolicy policy = SchedulingPolicy::FIFO,
+                               size_t           max_active = 4);
+
+    void             setPolicy(SchedulingPolicy policy) { policy_ = policy; }
+    SchedulingPolicy getPolicy() const { return policy_; }
+
+    // 0 means unlimited
+    void   setMaxActive(size_t max_active) { max_active_ = max_active; }
+    size_t getMaxActive() const { return max_active_; }
+
+    // Relative share of a peer under FAIR_SHARE, 1 by default
+    void setPeerWeight(const std::string& peer_id, double weight);
+
+    void enqueue(Request request);
+    // Takes the next request to start and counts it as active, or returns
+    // nothing while the active limit is reached or the queue is empty
+    std::optional<Request> next();
+    // Frees the slot of an active transfer to the peer
+    void                   finished(const std::string& peer_id);
+    // Drops the queued requests to a peer that went away, returning their
+    // bytes. Its active transfers still call finished()
+    size_t                 dropPeer(const std::string& peer_id);
+
+    size_t pendingCount() const { return pending_.size(); }
+    size_t activeCount() const { return active_count_; }
+    bool   idle() const { return pending_.empty() && active_count_ == 0; }
+
+  private:
+    struct PeerQueue
+    {
+        std::deque<uint64_t> sequences;
+        double               weight = 1.0;
+        // Bytes started for the peer divided by its weight
+        double               virtual_time = 0.0;
+        size_t               active = 0;
+    };
+
+    std::map<uint64_t, Request>::iterator selectFairShare();
+    void dropStaleSequences(PeerQueue& queue) const;
+
+    SchedulingPolicy                             policy_;
+    size_t                                       max_active_;
+    size_t                                       active_count_ = 0;
+    std::map<uint64_t, Request>                  pending_; // sequence ->
+    std::set<std::pair<size_t, uint64_t>>        by_size_;
+    std::unordered_map<std::string, PeerQueue>   peers_;
+    // Virtual time of the last request started under FAIR_SHARE, new
+    // backlogged peers start here instead of banking idle time
+    double                                       virtual_clock_ = 0.0;
+};
+
+#endif // TRANSFER_SCHEDULER_HPP